@@ -1,5 +1,8 @@
 #include "SVKApp.h"
 
+#include "SVKNBodyCpu.h"
+#include "SVKCheckpoint.h"
+
 template<class T>
 std::string JoinStrings(T strings) {
 	std::stringstream ss;
@@ -13,24 +16,23 @@ std::string JoinStrings(T strings) {
 	return ss.str();
 }
 
-static std::vector<char> ReadFile(const std::string& filename) {
-	std::ifstream file(filename, std::ios::ate | std::ios::binary);
+static std::string NormalizeDeviceKey(const std::string& key) {
+	std::string result;
+	for (char c : key)
+		if (c != '-' && c != ':' && c != '{' && c != '}')
+			result.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+	return result;
+}
 
-	if (!file.is_open()) {
-		std::stringstream ss;
-		ss << "Failed to open file: '" << filename << '\'';
-		throw std::runtime_error(ss.str());
+static std::string FormatUUID(const uint8_t* uuid) {
+	std::stringstream ss;
+	ss << std::hex << std::setfill('0');
+	for (int i = 0; i < VK_UUID_SIZE; ++i) {
+		if (i == 4 || i == 6 || i == 8 || i == 10)
+			ss << '-';
+		ss << std::setw(2) << static_cast<int>(uuid[i]);
 	}
-
-	size_t fileSize = static_cast<size_t>(file.tellg());
-	std::vector<char> buffer(fileSize);
-
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
-
-	file.close();
-
-	return buffer;
+	return ss.str();
 }
 
 // *********************************************************************************
@@ -52,7 +54,10 @@ const bool SVKApp::g_enableValidationLayers = true;
 const bool SVKApp::g_enableValidationLayers = false;
 #endif // _DEBUG
 
-const int SVKApp::g_maxFramesInFlight = 2;
+const int SVKApp::g_offscreenImageCount = 3;
+const VkFormat SVKApp::g_offscreenImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+const uint32_t SVKApp::g_maxGpuProfilerScopes = 16;
+const VkDeviceSize SVKApp::g_uniformRegionSize = 64 * 1024;
 
 const std::vector<SVKApp::Vertex> SVKApp::g_vertices = {
 	{{-0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}},
@@ -140,48 +145,211 @@ SVKApp::SVKApp(const SVKConfig& config) :
 	m_logicalDevice(VK_NULL_HANDLE),
 	m_graphicsQueue(VK_NULL_HANDLE),
 	m_presentQueue(VK_NULL_HANDLE),
+	m_transferQueue(VK_NULL_HANDLE),
+	m_computeQueue(VK_NULL_HANDLE),
+	m_asyncCompute(false),
+	m_fullSubgroups(false),
 	m_swapChain(VK_NULL_HANDLE),
 	m_swapChainImageFormat(VK_FORMAT_UNDEFINED),
 	m_swapChainExtent{ 0, 0 },
+	m_offscreenImageIndex(0),
 	m_renderPass(VK_NULL_HANDLE),
 	m_descriptorSetLayout(VK_NULL_HANDLE),
 	m_pipelineLayout(VK_NULL_HANDLE),
 	m_graphicsPipeline(VK_NULL_HANDLE),
 	m_commandPool(VK_NULL_HANDLE),
+	m_computeCommandPool(VK_NULL_HANDLE),
+	m_texturePixels(nullptr),
+	m_textureWidth(0),
+	m_textureHeight(0),
 	m_textureImage(VK_NULL_HANDLE),
-	m_textureImageMemory(VK_NULL_HANDLE),
+	m_textureImageAllocation{},
 	m_vertexBuffer(VK_NULL_HANDLE),
-	m_vertexBufferMemory(VK_NULL_HANDLE),
+	m_vertexBufferAllocation{},
 	m_indexBuffer(VK_NULL_HANDLE),
-	m_indexBufferMemory(VK_NULL_HANDLE),
+	m_indexBufferAllocation{},
 	m_descriptorPool(VK_NULL_HANDLE),
+	m_asyncStep(0),
 	m_currentFrame(0),
+	m_frameNumber(0),
 	m_framebufferResized(false)
 {
 }
 
 void SVKApp::Initialize() {
-	InitializeWindow();
+	m_jobSystem.Initialize(m_config.m_threadCount);
+	m_timestep.Initialize(1.0 / m_config.m_simulationRate, m_config.m_maxSubsteps, m_config.m_frameRate > 0.0f ? 1.0 / m_config.m_frameRate : 0.0);
+	if (!m_config.m_headless)
+		InitializeWindow();
 	InitializeVulkan();
 }
 
 void SVKApp::Cleanup() {
 	CleanupVulkan();
-	CleanupWindow();
+	if (!m_config.m_headless)
+		CleanupWindow();
+	m_jobSystem.Cleanup();
 }
 
 void SVKApp::Run() {
 	auto startTm = std::chrono::high_resolution_clock::now();
-	auto prevTm = startTm;
+	uint32_t frameLimit = m_config.m_frameCount;
+	uint32_t sweepFrameCount = 0;
+	SVKBenchmark::Statistics cpuCullingInstances{}, cpuCullingRecord{};
+	if (m_config.m_benchmark) {
+		VkPhysicalDeviceProperties physicalDeviceProperties;
+		vkGetPhysicalDeviceProperties(m_physicalDevice, &physicalDeviceProperties);
+
+		m_benchmark.Configure(m_config.m_warmupFrameCount, m_config.m_frameCount);
+		m_benchmark.SetMetadata("device", physicalDeviceProperties.deviceName);
+		m_benchmark.SetMetadata("headless", m_config.m_headless ? "true" : "false");
+		m_benchmark.SetMetadata("extent", std::to_string(m_swapChainExtent.width) + "x" + std::to_string(m_swapChainExtent.height));
+		m_benchmark.SetMetadata("framesInFlight", std::to_string(m_config.m_framesInFlight));
+		m_benchmark.SetMetadata("pipelineCache", m_pipelineCache.IsWarm() ? "warm" : "cold");
+		m_benchmark.SetMetadata("pipelineCreateMs", std::to_string(m_pipelineCache.GetCreationTime()));
+		m_benchmark.SetMetadata("particles", std::to_string(m_nbody.GetParticleCount()));
+		m_benchmark.SetMetadata("nbodyMode", SVKNBody::GetModeName(m_nbody.GetMode()));
+		m_benchmark.SetMetadata("theta", std::to_string(m_nbody.GetKernelConstants().theta));
+		m_benchmark.SetMetadata("forceKernel", m_nbody.GetForceShaderName());
+		m_benchmark.SetMetadata("workGroupSize", std::to_string(m_nbody.GetKernelConstants().workGroupSize));
+		m_benchmark.SetMetadata("tileSize", std::to_string(m_nbody.GetKernelConstants().sharedDataSize));
+		m_benchmark.SetMetadata("asyncCompute", m_nbody.IsAsyncCompute() ? "true" : "false");
+		m_benchmark.SetMetadata("simulationRate", std::to_string(m_config.m_simulationRate));
+		m_benchmark.SetMetadata("maxSubsteps", std::to_string(m_config.m_maxSubsteps));
+		m_benchmark.SetMetadata("frameRate", m_config.m_frameRate > 0.0f ? std::to_string(m_config.m_frameRate) : "wallclock");
+		m_benchmark.SetMetadata("jobThreads", std::to_string(m_jobSystem.GetThreadCount()));
+		m_benchmark.SetMetadata("instances", std::to_string(m_instanceRenderer.GetInstanceCount()));
+		m_benchmark.SetMetadata("instanceCulling", SVKInstanceRenderer::GetCullingName(m_instanceRenderer.GetCulling()));
+		if (m_instanceRenderer.GetCulling() == SVKInstanceRenderer::Culling::Gpu)
+			sweepFrameCount += MeasureCpuCulling(cpuCullingInstances, cpuCullingRecord);
+		if (m_config.m_threadSweep)
+			sweepFrameCount += MeasureThreadSweep();
+		frameLimit = m_benchmark.GetTotalFrameCount();
+	}
+
+	auto prevTm = std::chrono::high_resolution_clock::now();
 	uint32_t frameCount = 0;
-	while (!glfwWindowShouldClose(m_window)) {
+	uint32_t totalFrameCount = sweepFrameCount;
+	while (m_config.m_headless || !glfwWindowShouldClose(m_window)) {
+		if (frameLimit > 0 && totalFrameCount - sweepFrameCount >= frameLimit)
+			break;
+
+		++frameCount;
+		++totalFrameCount;
+		RunFrame();
+
+		auto currTm = std::chrono::high_resolution_clock::now();
+		std::chrono::duration<double> diffPrevTm = currTm - prevTm;
+		if (diffPrevTm.count() > 1.0f) {
+			std::chrono::duration<double> diffStartTm = currTm - startTm;
+			std::stringstream ss;
+			ss << g_appName << " [" << int(diffStartTm.count()) << "] FPS: " << (frameCount / diffPrevTm.count());
+			if (m_config.m_headless)
+				std::cerr << ss.str() << std::endl;
+			else
+				glfwSetWindowTitle(m_window, ss.str().c_str());
+			prevTm = currTm;
+			frameCount = 0;
+		}
+	}
+	vkDeviceWaitIdle(m_logicalDevice);
+
+	// frames of the measurement passes before the run count as frames, but show a frozen simulation and run no steps
+	uint32_t simulationFrameCount = totalFrameCount - sweepFrameCount;
+	std::chrono::duration<double> diffStartTm = std::chrono::high_resolution_clock::now() - startTm;
+	std::cerr << "Frames: " << totalFrameCount;
+	if (sweepFrameCount > 0)
+		std::cerr << " (" << sweepFrameCount << " in measurement passes)";
+	std::cerr << "; time: " << diffStartTm.count() << "s; avg FPS: " << (totalFrameCount / diffStartTm.count()) << std::endl;
+	std::cerr << "Simulation: " << m_timestep.GetStepCount() << " steps at " << m_config.m_simulationRate << " Hz, " << (simulationFrameCount > 0 ? double(m_timestep.GetStepCount()) / simulationFrameCount : 0.0)
+		<< " per frame, " << m_timestep.GetDroppedStepCount() << " dropped (more than " << m_timestep.GetMaxStepCount() << " per frame)" << std::endl;
+
+	m_memoryAllocator.PrintStatistics(std::cerr);
+	m_pipelineCache.PrintStatistics(std::cerr);
+
+	if (m_config.m_benchmark) {
+		m_benchmark.PrintSummary(std::cerr);
+
+		SVKBenchmark::Statistics cpuFrame, gpuFrame;
+		if (m_benchmark.GetStatistics("cpu.frame", cpuFrame) && m_benchmark.GetStatistics("gpu.frame", gpuFrame)) {
+			// the GPU is the bottleneck when it is busy for (almost) the whole frame interval
+			bool gpuBound = gpuFrame.p50 >= 0.9 * cpuFrame.p50;
+			std::cerr << "Frame is " << (gpuBound ? "GPU" : "CPU") << "-bound: gpu.frame p50 " << gpuFrame.p50 << " ms, cpu.frame p50 " << cpuFrame.p50 << " ms" << std::endl;
+		}
+		SVKBenchmark::Statistics gpuNBody;
+		if (m_nbody.IsEnabled() && m_benchmark.GetStatistics("gpu.nbody", gpuNBody) && gpuNBody.p50 > 0.0) {
+			// Barnes-Hut rates are direct sum equivalents, comparable with the brute force numbers. gpu.nbody covers the
+			// steps of one frame; frames without a step record no scope
+			double stepsPerFrame = std::max(simulationFrameCount > 0 ? double(m_timestep.GetStepCount()) / simulationFrameCount : 1.0, 1.0);
+			double interactionsPerSecond = stepsPerFrame * m_nbody.GetInteractionsPerStep() / (gpuNBody.p50 / 1000.0);
+			std::cerr << "N-body GPU (" << SVKNBody::GetModeName(m_nbody.GetMode()) << "): " << m_nbody.GetParticleCount() << " particles, gpu.nbody p50 " << gpuNBody.p50 << " ms, " << (interactionsPerSecond / 1e9) << " G interactions/s, "
+				<< (interactionsPerSecond * SVKNBodyCpu::g_flopsPerInteraction / 1e9) << " GFLOP/s" << std::endl;
+		}
+		if (m_nbody.IsAsyncCompute() && m_benchmark.GetStatistics("gpu.nbody", gpuNBody) && m_benchmark.GetStatistics("gpu.frame", gpuFrame) && m_benchmark.GetStatistics("cpu.frame", cpuFrame)) {
+			// on one queue the step and the frame run back to back; overlapped, a GPU-bound frame only takes the longer of the two.
+			// Both are timed in this run, so the serial time is the sum of the two, not a measured --no-async-compute run
+			double serialMs = gpuNBody.p50 + gpuFrame.p50;
+			double savedMs = serialMs - cpuFrame.p50;
+			std::cerr << "Async compute (estimate): gpu.nbody p50 " << gpuNBody.p50 << " ms + gpu.frame p50 " << gpuFrame.p50 << " ms = " << serialMs << " ms estimated serial, cpu.frame p50 " << cpuFrame.p50
+				<< " ms, overlap saves about " << savedMs << " ms (" << (serialMs > 0.0 ? 100.0 * savedMs / serialMs : 0.0) << "%); compare with a --no-async-compute run to measure it" << std::endl;
+			m_benchmark.SetMetadata("overlapSavedMsEstimate", std::to_string(savedMs));
+		}
+		SVKBenchmark::Statistics gpuInstances, cpuInstances, cpuRecord;
+		if (m_instanceRenderer.IsEnabled() && m_benchmark.GetStatistics("gpu.instances", gpuInstances) && m_benchmark.GetStatistics("cpu.instances", cpuInstances)
+			&& m_benchmark.GetStatistics("cpu.record", cpuRecord) && gpuInstances.p50 > 0.0) {
+			// the GPU rate covers the instance draws, the CPU cost is the per-frame stream update and, with CPU culling,
+			// the culling
+			SVKInstanceRenderer::Culling culling = m_instanceRenderer.GetCulling();
+			double instanceCount = m_instanceRenderer.GetInstanceCount();
+			double instancesPerSecond = instanceCount / (gpuInstances.p50 / 1000.0);
+			double cpuNsPerInstance = cpuInstances.p50 * 1e6 / instanceCount;
+			std::cerr << "Instances: " << m_instanceRenderer.GetInstanceCount() << " (" << SVKInstanceRenderer::GetCullingName(culling) << " culling) in " << m_instanceRenderer.GetDrawCount()
+				<< " draw(s), gpu.instances p50 " << gpuInstances.p50 << " ms, " << (instancesPerSecond / 1e6) << " M instances/s, cpu.instances p50 " << cpuInstances.p50 << " ms, "
+				<< cpuNsPerInstance << " ns/instance, cpu.record p50 " << cpuRecord.p50 << " ms" << std::endl;
+			m_benchmark.SetMetadata("instancesPerSecond", std::to_string(instancesPerSecond));
+			m_benchmark.SetMetadata("cpuNsPerInstance", std::to_string(cpuNsPerInstance));
+
+			SVKBenchmark::Statistics gpuCull;
+			if (culling == SVKInstanceRenderer::Culling::Cpu)
+				std::cerr << "CPU culling: " << m_instanceRenderer.GetVisibleCount() << " visible in the last frame" << std::endl;
+			else if (culling == SVKInstanceRenderer::Culling::Gpu && m_benchmark.GetStatistics("gpu.cull", gpuCull))
+				std::cerr << "GPU culling: gpu.cull p50 " << gpuCull.p50 << " ms, " << (gpuCull.p50 * 1e6 / instanceCount) << " ns/instance" << std::endl;
+
+			if (culling == SVKInstanceRenderer::Culling::Gpu && cpuCullingInstances.count > 0 && cpuCullingRecord.count > 0) {
+				// culling changes the stream update and the recording, the CPU culling pass measured both before the run
+				double cpuCullingMs = cpuCullingInstances.p50 + cpuCullingRecord.p50;
+				double gpuCullingMs = cpuInstances.p50 + cpuRecord.p50;
+				std::cerr << "Culling on the GPU saves " << (cpuCullingMs - gpuCullingMs) << " ms CPU per frame: cpu.instances + cpu.record p50 " << cpuCullingMs << " ms with CPU culling, "
+					<< gpuCullingMs << " ms with GPU culling" << std::endl;
+				m_benchmark.SetMetadata("cullingCpuSavedMs", std::to_string(cpuCullingMs - gpuCullingMs));
+			}
+		}
+		if (!m_config.m_benchmarkOutput.empty()) {
+			m_benchmark.Write(m_config.m_benchmarkOutput);
+			std::cerr << "Benchmark written: " << m_config.m_benchmarkOutput.string() << std::endl;
+		}
+	}
+
+	if (m_config.m_nbodyValidate)
+		ValidateNBody();
+	SaveCheckpoint();
+}
+
+void SVKApp::RunFrame() {
+	m_benchmark.BeginFrame();
+	m_uploadContext.Poll();
+	if (m_config.m_headless) {
+		SVKBenchmark::ScopedTimer frameTimer(m_benchmark, "cpu.frame");
+		DrawFrameHeadless();
+	}
+	else {
 		glfwPollEvents();
 		if (m_framebufferResized) {
 			RecreateSwapChain();
 			m_framebufferResized = false;
 		}
 		try {
-			++frameCount;
+			SVKBenchmark::ScopedTimer frameTimer(m_benchmark, "cpu.frame");
 			DrawFrame();
 		}
 		catch (const VkException& e) {
@@ -190,18 +358,125 @@ void SVKApp::Run() {
 			else
 				throw;
 		}
-		auto currTm = std::chrono::high_resolution_clock::now();
-		std::chrono::duration<double> diffPrevTm = currTm - prevTm;
-		if (diffPrevTm.count() > 1.0f) {
-			std::chrono::duration<double> diffStartTm = currTm - startTm;
-			std::stringstream ss;
-			ss << g_appName << " [" << int(diffStartTm.count()) << "] FPS: " << (frameCount / diffPrevTm.count());
-			glfwSetWindowTitle(m_window, ss.str().c_str());
-			prevTm = currTm;
-			frameCount = 0;
-		}
 	}
+	m_benchmark.EndFrame();
+}
+
+uint32_t SVKApp::MeasureCpuCulling(SVKBenchmark::Statistics& cpuInstances, SVKBenchmark::Statistics& cpuRecord) {
+	// warmup and measured frames with the instances culled on the CPU, the baseline of the GPU culling run that
+	// follows. Like the thread sweep it draws a frozen simulation. Returns the number of frames drawn
 	vkDeviceWaitIdle(m_logicalDevice);
+	m_instanceRenderer.Cleanup();
+	CreateInstanceRenderer(SVKInstanceRenderer::Culling::Cpu);
+	m_uploadContext.Submit();
+
+	uint32_t frameCount = 0;
+	m_timestep.SetFrozen(true);
+	m_benchmark.Configure(m_config.m_warmupFrameCount, m_config.m_frameCount);
+	for (uint32_t frame = 0; frame < m_benchmark.GetTotalFrameCount(); ++frame) {
+		if (!m_config.m_headless && glfwWindowShouldClose(m_window))
+			break;
+		RunFrame();
+		++frameCount;
+	}
+	m_timestep.SetFrozen(false);
+
+	if (m_benchmark.GetStatistics("cpu.instances", cpuInstances) && m_benchmark.GetStatistics("cpu.record", cpuRecord)) {
+		std::cerr << "CPU culling pass: cpu.instances p50 " << cpuInstances.p50 << " ms, cpu.record p50 " << cpuRecord.p50 << " ms" << std::endl;
+		m_benchmark.SetMetadata("cpuCulling.instancesMs", std::to_string(cpuInstances.p50));
+		m_benchmark.SetMetadata("cpuCulling.recordMs", std::to_string(cpuRecord.p50));
+	}
+
+	vkDeviceWaitIdle(m_logicalDevice);
+	m_instanceRenderer.Cleanup();
+	CreateInstanceRenderer(SVKInstanceRenderer::Culling::Gpu);
+	m_uploadContext.Submit();
+	m_benchmark.Configure(m_config.m_warmupFrameCount, m_config.m_frameCount);
+	return frameCount;
+}
+
+uint32_t SVKApp::MeasureThreadSweep() {
+	// warmup and measured frames once per active job thread count, 1, 2, 4, ..., all. The job threads update the
+	// instances and record the frame command buffer every frame, so cpu.instances, cpu.record and the whole
+	// cpu.frame show how the frame scales. The simulation is frozen, every thread count draws the same state and
+	// the regular frames start where they would have without the sweep. Returns the number of frames drawn
+	static const std::pair<const char*, const char*> sweepSeries[] = {
+		{ "cpu.frame", "frameMs." },
+		{ "cpu.instances", "instancesMs." },
+		{ "cpu.record", "recordMs." }
+	};
+
+	uint32_t threadCount = m_jobSystem.GetThreadCount();
+	uint32_t frameCount = 0;
+	bool closed = false;
+	double singleThreadMs = 0.0;
+	m_timestep.SetFrozen(true);
+	for (uint32_t activeThreadCount = 1; !closed; activeThreadCount = std::min(activeThreadCount * 2, threadCount)) {
+		m_jobSystem.SetActiveThreadCount(activeThreadCount);
+		m_benchmark.Configure(m_config.m_warmupFrameCount, m_config.m_frameCount);
+		for (uint32_t frame = 0; frame < m_benchmark.GetTotalFrameCount(); ++frame) {
+			if (!m_config.m_headless && glfwWindowShouldClose(m_window)) {
+				closed = true;
+				break;
+			}
+			RunFrame();
+			++frameCount;
+		}
+
+		std::cerr << "Thread sweep: " << activeThreadCount << " threads";
+		for (const std::pair<const char*, const char*>& series : sweepSeries) {
+			SVKBenchmark::Statistics statistics;
+			if (!m_benchmark.GetStatistics(series.first, statistics))
+				continue;
+			std::cerr << ", " << series.first << " p50 " << statistics.p50 << " ms";
+			m_benchmark.SetMetadata(series.second + std::to_string(activeThreadCount), std::to_string(statistics.p50));
+		}
+
+		SVKBenchmark::Statistics cpuFrame;
+		if (m_benchmark.GetStatistics("cpu.frame", cpuFrame)) {
+			if (activeThreadCount == 1)
+				singleThreadMs = cpuFrame.p50;
+			std::cerr << ", frame speedup " << (cpuFrame.p50 > 0.0 ? singleThreadMs / cpuFrame.p50 : 0.0);
+		}
+		std::cerr << std::endl;
+
+		if (activeThreadCount == threadCount)
+			break;
+	}
+	m_timestep.SetFrozen(false);
+	m_jobSystem.SetActiveThreadCount(threadCount);
+	m_benchmark.Configure(m_config.m_warmupFrameCount, m_config.m_frameCount);
+	return frameCount;
+}
+
+void SVKApp::RunBatch() {
+	SVKSnapshotWriter::Encoding encoding = SVKSnapshotWriter::Encoding::Raw;
+	SVKSnapshotWriter::GetEncoding(m_config.m_snapshotEncoding, encoding);
+
+	std::cerr << "Batch: " << m_nbody.GetParticleCount() << " particles (" << SVKNBody::GetModeName(m_nbody.GetMode()) << "), " << m_config.m_stepCount << " steps, "
+		<< m_config.m_stepsPerSubmit << " per submit, snapshot every " << m_config.m_snapshotInterval << " steps (" << SVKSnapshotWriter::GetEncodingName(encoding) << ") to '" << m_config.m_batchOutput.string() << '\'' << std::endl;
+
+	SVKSnapshotWriter writer;
+	writer.Open(m_config.m_batchOutput, encoding, m_nbody.GetParticleCount(), SVKNBody::g_fixedDeltaT);
+
+	auto startTm = std::chrono::high_resolution_clock::now();
+	m_batchRunner.Run(m_config.m_stepCount, m_config.m_stepsPerSubmit, m_config.m_snapshotInterval, writer);
+	writer.Close();
+	std::chrono::duration<double> diffStartTm = std::chrono::high_resolution_clock::now() - startTm;
+
+	// the raw size is what the same snapshots take as plain Particle arrays
+	uint64_t snapshotCount = writer.GetSnapshotCount();
+	uint64_t rawBytes = sizeof(SVKSnapshotWriter::FileHeader) + snapshotCount * (sizeof(SVKSnapshotWriter::SnapshotHeader) + sizeof(SVKNBody::Particle) * static_cast<uint64_t>(m_nbody.GetParticleCount()));
+	uint64_t bytesWritten = writer.GetBytesWritten();
+	double stepsPerSecond = m_config.m_stepCount / diffStartTm.count();
+	std::cerr << "Batch: " << m_config.m_stepCount << " steps in " << diffStartTm.count() << "s, " << stepsPerSecond << " steps/s, "
+		<< (stepsPerSecond * m_nbody.GetInteractionsPerStep() / 1e9) << " G interactions/s" << std::endl;
+	std::cerr << "Snapshots: " << snapshotCount << ", " << bytesWritten << " bytes (" << (rawBytes > 0 ? 100.0 * bytesWritten / rawBytes : 0.0) << "% of raw), writer wait " << writer.GetWaitTime() << " ms" << std::endl;
+
+	m_memoryAllocator.PrintStatistics(std::cerr);
+	m_pipelineCache.PrintStatistics(std::cerr);
+
+	SaveCheckpoint();
 }
 
 void SVKApp::InitializeWindow() {
@@ -217,26 +492,58 @@ void SVKApp::InitializeWindow() {
 }
 
 void SVKApp::InitializeVulkan() {
+	// decoded by the job system while the device and the pipelines are created
+	if (m_config.m_batchOutput.empty())
+		DecodeTextureImage();
+
 	CreateInstance();
 	if (g_enableValidationLayers)
 		CreateDebugMessenger();
-	CreateSurface();
+	if (!m_config.m_headless)
+		CreateSurface();
 	PickPhysicalDevice();
 	CreateLogicalDevice();
-	CreateSwapChain();
+	CreatePipelineCache();
+	if (!m_config.m_batchOutput.empty()) {
+		// compute only: no render targets, pipelines or frame resources
+		CreateCommandPool();
+		CreateUploadContext();
+		CreateKernelTuner();
+		CreateNBody();
+		m_uploadContext.Submit();
+		m_nbody.Tune(m_kernelTuner, m_config.m_tune);
+		CreateBatchRunner();
+		return;
+	}
+	if (m_config.m_headless)
+		CreateOffscreenTargets();
+	else
+		CreateSwapChain();
 	CreateImageViews();
 	CreateRenderPass();
 	CreateDescriptorSetLayout();
 	CreateGraphicsPipeline();
 	CreateFrameBuffers();
 	CreateCommandPool();
+	CreateUploadContext();
+	CreateGpuProfiler();
+	CreateKernelTuner();
 	CreateTextureImage();
 	CreateVertexBuffer();
 	CreateIndexBuffer();
+	SVKInstanceRenderer::Culling culling = SVKInstanceRenderer::Culling::None;
+	SVKInstanceRenderer::GetCulling(m_config.m_instanceCulling, culling);
+	CreateInstanceRenderer(culling);
+	CreateNBody();
+	m_uploadContext.Submit();
+	m_nbody.Tune(m_kernelTuner, m_config.m_tune);
+	CreateAsyncCompute();
 	CreateUniformBuffers();
 	CreateDescriptorPool();
 	CreateDescriptorSets();
+	CreateParticleRenderer();
 	CreateCommandBuffers();
+	CreateComputeCommandBuffers();
 	CreateSyncObjects();
 }
 
@@ -247,7 +554,7 @@ void SVKApp::CreateInstance() {
 	appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
 	appInfo.pEngineName = g_engineName;
 	appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-	appInfo.apiVersion = VK_API_VERSION_1_0;
+	appInfo.apiVersion = VK_API_VERSION_1_1;
 
 	VkInstanceCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -303,10 +610,13 @@ void SVKApp::CheckValidationLayerSupport(const std::vector<const char*> validati
 }
 
 std::vector<const char*> SVKApp::GetRequiredExtensions() {
-	uint32_t glfwExtensionCount = 0;
-	const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+	std::vector<const char*> extensions;
 
-	std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	if (!m_config.m_headless) {
+		uint32_t glfwExtensionCount = 0;
+		const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+		extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	}
 
 	if (g_enableValidationLayers)
 		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -372,7 +682,7 @@ void SVKApp::PickPhysicalDevice() {
 	for (VkPhysicalDevice& physicalDevice : physicalDevices) {
 		VkPhysicalDeviceProperties physicalDeviceProperties;
 		vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
-		std::cerr << '\t' << physicalDeviceProperties.deviceName << " (";
+		std::cerr << '\t' << physicalDeviceProperties.deviceName << " [" << GetPhysicalDeviceUUID(physicalDevice) << "] (";
 		if (IsPhysicalDeviceSuitable(physicalDevice))
 			std::cerr << GetPhysicalDeviceScore(physicalDevice);
 		else
@@ -381,15 +691,43 @@ void SVKApp::PickPhysicalDevice() {
 	}
 
 	std::optional<std::pair<int, VkPhysicalDevice>> physicalDeviceCandidate;
-	for (VkPhysicalDevice& physicalDevice : physicalDevices)
-		if (IsPhysicalDeviceSuitable(physicalDevice)) {
-			int score = GetPhysicalDeviceScore(physicalDevice);
-			if (!physicalDeviceCandidate.has_value() || physicalDeviceCandidate.value().first < score)
-				physicalDeviceCandidate = std::make_pair(score, physicalDevice);
+	if (!m_config.m_deviceName.empty()) {
+		std::string deviceKey = NormalizeDeviceKey(m_config.m_deviceName);
+		for (VkPhysicalDevice& physicalDevice : physicalDevices) {
+			VkPhysicalDeviceProperties physicalDeviceProperties;
+			vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+			std::string deviceName = NormalizeDeviceKey(physicalDeviceProperties.deviceName);
+			std::string deviceUUID = NormalizeDeviceKey(GetPhysicalDeviceUUID(physicalDevice));
+			if (deviceUUID != deviceKey && deviceName.find(deviceKey) == std::string::npos)
+				continue;
+
+			if (!IsPhysicalDeviceSuitable(physicalDevice)) {
+				std::stringstream ss;
+				ss << "Requested physical device is not suitable: '" << physicalDeviceProperties.deviceName << '\'';
+				throw std::runtime_error(ss.str());
+			}
+
+			physicalDeviceCandidate = std::make_pair(GetPhysicalDeviceScore(physicalDevice), physicalDevice);
+			break;
 		}
 
-	if (!physicalDeviceCandidate.has_value())
-		throw std::runtime_error("No suitable physical device found");
+		if (!physicalDeviceCandidate.has_value()) {
+			std::stringstream ss;
+			ss << "Requested physical device not found: '" << m_config.m_deviceName << '\'';
+			throw std::runtime_error(ss.str());
+		}
+	}
+	else {
+		for (VkPhysicalDevice& physicalDevice : physicalDevices)
+			if (IsPhysicalDeviceSuitable(physicalDevice)) {
+				int score = GetPhysicalDeviceScore(physicalDevice);
+				if (!physicalDeviceCandidate.has_value() || physicalDeviceCandidate.value().first < score)
+					physicalDeviceCandidate = std::make_pair(score, physicalDevice);
+			}
+
+		if (!physicalDeviceCandidate.has_value())
+			throw std::runtime_error("No suitable physical device found");
+	}
 
 	m_physicalDevice = physicalDeviceCandidate.value().second;
 
@@ -398,6 +736,12 @@ void SVKApp::PickPhysicalDevice() {
 	std::cerr << "selected: " << physicalDeviceProperties.deviceName << std::endl;
 }
 
+std::vector<const char*> SVKApp::GetRequiredDeviceExtensions() {
+	if (m_config.m_headless)
+		return {};
+	return g_deviceExtensions;
+}
+
 bool SVKApp::IsPhysicalDeviceExtensionSupport(VkPhysicalDevice physicalDevice, const std::vector<const char*> extensions) {
 	uint32_t vkAvailableExtensionCount;
 	vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &vkAvailableExtensionCount, nullptr);
@@ -414,21 +758,19 @@ bool SVKApp::IsPhysicalDeviceExtensionSupport(VkPhysicalDevice physicalDevice, c
 bool SVKApp::IsPhysicalDeviceSuitable(VkPhysicalDevice physicalDevice) {
 	VkPhysicalDeviceProperties physicalDeviceProperties;
 	vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
-	if (physicalDeviceProperties.deviceType != VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
-		return false;
-
-	VkPhysicalDeviceFeatures physicalDeviceFeatures;
-	vkGetPhysicalDeviceFeatures(physicalDevice, &physicalDeviceFeatures);
-	if (!physicalDeviceFeatures.geometryShader)
+	if (physicalDeviceProperties.apiVersion < VK_API_VERSION_1_1)
 		return false;
 
 	QueueFamilyIndices queueFamilyIndices = FindQueueFamilyIndices(physicalDevice);
-	if (!queueFamilyIndices.IsComplete())
+	if (!queueFamilyIndices.IsComplete(!m_config.m_headless))
 		return false;
 
-	if (!IsPhysicalDeviceExtensionSupport(physicalDevice, g_deviceExtensions))
+	if (!IsPhysicalDeviceExtensionSupport(physicalDevice, GetRequiredDeviceExtensions()))
 		return false;
 
+	if (m_config.m_headless)
+		return true;
+
 	SwapChainSupportDetails swapChainSupportDetails = FindSwapChainSupportDetails(physicalDevice);
 	if (swapChainSupportDetails.formats.empty())
 		return false;
@@ -447,11 +789,78 @@ int SVKApp::GetPhysicalDeviceScore(VkPhysicalDevice physicalDevice)
 
 	int score = 0;
 
-	score += physicalDeviceProperties.limits.maxImageDimension2D;
+	// device type dominates: any real GPU wins over a software rasterizer
+	switch (physicalDeviceProperties.deviceType) {
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: score += 400000; break;
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: score += 300000; break;
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: score += 200000; break;
+	case VK_PHYSICAL_DEVICE_TYPE_CPU: score += 100000; break;
+	default: break;
+	}
+
+	// device local memory, in MiB
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+	VkDeviceSize deviceLocalSize = 0;
+	for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i)
+		if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+			deviceLocalSize += memoryProperties.memoryHeaps[i].size;
+	score += static_cast<int>(std::min<VkDeviceSize>(deviceLocalSize >> 20, 65535));
+
+	// dedicated compute and transfer queue families
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+	bool hasComputeOnly = false;
+	bool hasTransferOnly = false;
+	for (const VkQueueFamilyProperties& queueFamily : queueFamilies) {
+		if ((queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT))
+			hasComputeOnly = true;
+		if ((queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFamily.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+			hasTransferOnly = true;
+	}
+	if (hasComputeOnly)
+		score += 2000;
+	if (hasTransferOnly)
+		score += 1000;
+
+	// optional features used by profiling and indirect drawing
+	if (physicalDeviceProperties.limits.timestampComputeAndGraphics)
+		score += 500;
+	if (physicalDeviceFeatures.multiDrawIndirect)
+		score += 250;
+	if (physicalDeviceFeatures.drawIndirectFirstInstance)
+		score += 250;
+	if (physicalDeviceFeatures.samplerAnisotropy)
+		score += 100;
+
+	score += physicalDeviceProperties.limits.maxImageDimension2D / 1024;
 
 	return score;
 }
 
+std::string SVKApp::GetPhysicalDeviceUUID(VkPhysicalDevice physicalDevice) {
+	VkPhysicalDeviceProperties physicalDeviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+	if (physicalDeviceProperties.apiVersion < VK_API_VERSION_1_1) {
+		// vkGetPhysicalDeviceProperties2 is core only from 1.1 on, a 1.0 device is named by vendor and device ID
+		std::stringstream ss;
+		ss << std::hex << std::setfill('0') << std::setw(4) << physicalDeviceProperties.vendorID << ':' << std::setw(4) << physicalDeviceProperties.deviceID;
+		return ss.str();
+	}
+
+	VkPhysicalDeviceIDProperties idProperties{};
+	idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+
+	VkPhysicalDeviceProperties2 properties{};
+	properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	properties.pNext = &idProperties;
+
+	vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+	return FormatUUID(idProperties.deviceUUID);
+}
+
 SVKApp::QueueFamilyIndices SVKApp::FindQueueFamilyIndices(VkPhysicalDevice physicalDevice) {
 	uint32_t queueFamilyCount = 0;
 	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
@@ -461,16 +870,25 @@ SVKApp::QueueFamilyIndices SVKApp::FindQueueFamilyIndices(VkPhysicalDevice physi
 	QueueFamilyIndices queueFamilyIndices;
 	for (uint32_t i = 0; i < queueFamilyCount; ++i) {
 		VkQueueFamilyProperties& queueFamily = queueFamilies[i];
-		if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		if ((queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && !queueFamilyIndices.graphicsFamily.has_value())
 			queueFamilyIndices.graphicsFamily = i;
 
-		VkBool32 presentSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, m_windowSurface, &presentSupport);
-		if (presentSupport)
-			queueFamilyIndices.presentFamily = i;
-
-		if (queueFamilyIndices.IsComplete())
-			break;
+		// a transfer-only family is usually backed by the DMA engines
+		if ((queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFamily.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))
+			&& !queueFamilyIndices.transferFamily.has_value())
+			queueFamilyIndices.transferFamily = i;
+
+		// a compute-only family runs alongside the graphics queue (async compute)
+		if ((queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+			&& !queueFamilyIndices.computeFamily.has_value())
+			queueFamilyIndices.computeFamily = i;
+
+		if (m_windowSurface != VK_NULL_HANDLE && !queueFamilyIndices.presentFamily.has_value()) {
+			VkBool32 presentSupport = false;
+			vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, m_windowSurface, &presentSupport);
+			if (presentSupport)
+				queueFamilyIndices.presentFamily = i;
+		}
 	}
 
 	return queueFamilyIndices;
@@ -500,14 +918,20 @@ SVKApp::SwapChainSupportDetails SVKApp::FindSwapChainSupportDetails(VkPhysicalDe
 
 void SVKApp::CreateLogicalDevice() {
 	QueueFamilyIndices queueFamilyIndices = FindQueueFamilyIndices(m_physicalDevice);
-	std::set<uint32_t> uniqueQueueFamilies = { queueFamilyIndices.graphicsFamily.value(), queueFamilyIndices.presentFamily.value() };
+	std::set<uint32_t> uniqueQueueFamilies = { queueFamilyIndices.graphicsFamily.value() };
+	if (queueFamilyIndices.presentFamily.has_value())
+		uniqueQueueFamilies.insert(queueFamilyIndices.presentFamily.value());
+	if (queueFamilyIndices.transferFamily.has_value())
+		uniqueQueueFamilies.insert(queueFamilyIndices.transferFamily.value());
+	if (queueFamilyIndices.computeFamily.has_value())
+		uniqueQueueFamilies.insert(queueFamilyIndices.computeFamily.value());
 	float queuePriority = 1.0;
 
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 	for (uint32_t queueFamily : uniqueQueueFamilies) {
 		VkDeviceQueueCreateInfo queueCreateInfo{};
 		queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-		queueCreateInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+		queueCreateInfo.queueFamilyIndex = queueFamily;
 		queueCreateInfo.queueCount = 1;
 		queueCreateInfo.pQueuePriorities = &queuePriority;
 		queueCreateInfos.push_back(queueCreateInfo);
@@ -521,8 +945,28 @@ void SVKApp::CreateLogicalDevice() {
 	createInfo.pQueueCreateInfos = queueCreateInfos.data();
 	createInfo.pEnabledFeatures = &physicalDeviceFeatures;
 
-	createInfo.enabledExtensionCount = static_cast<uint32_t>(g_deviceExtensions.size());
-	createInfo.ppEnabledExtensionNames = g_deviceExtensions.data();
+	std::vector<const char*> deviceExtensions = GetRequiredDeviceExtensions();
+
+	// the subgroup N-body kernel is only offered when its pipeline can require full subgroups
+	VkPhysicalDeviceSubgroupSizeControlFeaturesEXT subgroupSizeControlFeatures{};
+	subgroupSizeControlFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_SIZE_CONTROL_FEATURES_EXT;
+	m_fullSubgroups = false;
+	if (IsPhysicalDeviceExtensionSupport(m_physicalDevice, { VK_EXT_SUBGROUP_SIZE_CONTROL_EXTENSION_NAME })) {
+		VkPhysicalDeviceFeatures2 features{};
+		features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+		features.pNext = &subgroupSizeControlFeatures;
+		vkGetPhysicalDeviceFeatures2(m_physicalDevice, &features);
+		m_fullSubgroups = subgroupSizeControlFeatures.computeFullSubgroups == VK_TRUE;
+	}
+	if (m_fullSubgroups) {
+		subgroupSizeControlFeatures.pNext = nullptr;
+		subgroupSizeControlFeatures.subgroupSizeControl = VK_FALSE;
+		deviceExtensions.push_back(VK_EXT_SUBGROUP_SIZE_CONTROL_EXTENSION_NAME);
+		createInfo.pNext = &subgroupSizeControlFeatures;
+	}
+
+	createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+	createInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
 	if (g_enableValidationLayers) {
 		createInfo.enabledLayerCount = static_cast<uint32_t>(g_validationLayers.size());
@@ -534,7 +978,28 @@ void SVKApp::CreateLogicalDevice() {
 	vkCheckResult(vkCreateDevice(m_physicalDevice, &createInfo, nullptr, &m_logicalDevice), "Create Device");
 
 	vkGetDeviceQueue(m_logicalDevice, queueFamilyIndices.graphicsFamily.value(), 0, &m_graphicsQueue);
-	vkGetDeviceQueue(m_logicalDevice, queueFamilyIndices.presentFamily.value(), 0, &m_presentQueue);
+	if (queueFamilyIndices.presentFamily.has_value())
+		vkGetDeviceQueue(m_logicalDevice, queueFamilyIndices.presentFamily.value(), 0, &m_presentQueue);
+	if (queueFamilyIndices.transferFamily.has_value())
+		vkGetDeviceQueue(m_logicalDevice, queueFamilyIndices.transferFamily.value(), 0, &m_transferQueue);
+	else
+		m_transferQueue = m_graphicsQueue;
+	if (queueFamilyIndices.computeFamily.has_value())
+		vkGetDeviceQueue(m_logicalDevice, queueFamilyIndices.computeFamily.value(), 0, &m_computeQueue);
+	else
+		m_computeQueue = m_graphicsQueue;
+
+	// decided here, the profiler slots and command buffers created before the simulation depend on it
+	bool asyncCompute = m_config.m_asyncCompute && m_config.m_particleCount > 0 && m_config.m_batchOutput.empty();
+	m_asyncCompute = asyncCompute && queueFamilyIndices.computeFamily.has_value();
+	if (asyncCompute && !m_asyncCompute)
+		std::cerr << "Async compute: no compute-only queue family, the simulation runs on the graphics queue" << std::endl;
+
+	m_memoryAllocator.Initialize(m_physicalDevice, m_logicalDevice, SVKMemoryAllocator::g_defaultBlockSize);
+}
+
+void SVKApp::CreatePipelineCache() {
+	m_pipelineCache.Initialize(m_physicalDevice, m_logicalDevice, m_config.m_pipelineCachePath);
 }
 
 void SVKApp::CreateSwapChain() {
@@ -573,7 +1038,8 @@ void SVKApp::CreateSwapChain() {
 	createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 	createInfo.presentMode = presentMode;
 	createInfo.clipped = VK_TRUE;
-	createInfo.oldSwapchain = VK_NULL_HANDLE;
+	// lets the driver hand resources over from the swapchain being replaced
+	createInfo.oldSwapchain = m_swapChain;
 
 	vkCheckResult(vkCreateSwapchainKHR(m_logicalDevice, &createInfo, nullptr, &m_swapChain), "Create SwapChain");
 
@@ -619,6 +1085,27 @@ VkExtent2D SVKApp::ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities
 	return actualExtent;
 }
 
+void SVKApp::CreateOffscreenTargets() {
+	m_swapChainImageFormat = g_offscreenImageFormat;
+	m_swapChainExtent = { static_cast<uint32_t>(g_width), static_cast<uint32_t>(g_height) };
+
+	m_swapChainImages.resize(g_offscreenImageCount);
+	m_offscreenImageAllocations.resize(g_offscreenImageCount);
+	for (int i = 0; i < g_offscreenImageCount; ++i)
+		CreateImage(
+			m_swapChainExtent.width,
+			m_swapChainExtent.height,
+			m_swapChainImageFormat,
+			VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			m_swapChainImages[i],
+			m_offscreenImageAllocations[i]
+		);
+
+	m_offscreenImageIndex = 0;
+}
+
 void SVKApp::CreateImageViews() {
 	m_swapChainImageViews.resize(m_swapChainImages.size());
 	for (int i = 0; i < m_swapChainImages.size(); ++i) {
@@ -650,7 +1137,7 @@ void SVKApp::CreateRenderPass() {
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	colorAttachment.finalLayout = m_config.m_headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
 	VkAttachmentReference colorAttachmentRef{};
 	colorAttachmentRef.attachment = 0;
@@ -684,7 +1171,7 @@ void SVKApp::CreateRenderPass() {
 void SVKApp::CreateDescriptorSetLayout() {
 	VkDescriptorSetLayoutBinding uboLayoutBinding{};
 	uboLayoutBinding.binding = 0;
-	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	uboLayoutBinding.descriptorCount = 1;
 	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 	uboLayoutBinding.pImmutableSamplers = nullptr; // Optional
@@ -733,24 +1220,20 @@ void SVKApp::CreateGraphicsPipeline() {
 	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 	inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-	VkViewport viewport{};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = static_cast<float>(m_swapChainExtent.width);
-	viewport.height = static_cast<float>(m_swapChainExtent.height);
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-
-	VkRect2D scissor{};
-	scissor.offset = { 0, 0 };
-	scissor.extent = m_swapChainExtent;
-
+	// viewport and scissor are set while recording, so a resize does not invalidate the pipeline
 	VkPipelineViewportStateCreateInfo viewportState{};
 	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 	viewportState.viewportCount = 1;
-	viewportState.pViewports = &viewport;
+	viewportState.pViewports = nullptr;
 	viewportState.scissorCount = 1;
-	viewportState.pScissors = &scissor;
+	viewportState.pScissors = nullptr;
+
+	VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+	VkPipelineDynamicStateCreateInfo dynamicState{};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = 2;
+	dynamicState.pDynamicStates = dynamicStates;
 
 	VkPipelineRasterizationStateCreateInfo rasterizer{};
 	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -815,14 +1298,17 @@ void SVKApp::CreateGraphicsPipeline() {
 	pipelineInfo.pMultisampleState = &multisampling;
 	pipelineInfo.pDepthStencilState = nullptr; // Optional
 	pipelineInfo.pColorBlendState = &colorBlending;
-	pipelineInfo.pDynamicState = nullptr; // Optional
+	pipelineInfo.pDynamicState = &dynamicState;
 	pipelineInfo.layout = m_pipelineLayout;
 	pipelineInfo.renderPass = m_renderPass;
 	pipelineInfo.subpass = 0;
 	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
 	pipelineInfo.basePipelineIndex = -1; // Optional
 
-	vkCheckResult(vkCreateGraphicsPipelines(m_logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_graphicsPipeline), "Create GraphicsPipeline");
+	auto startTm = std::chrono::high_resolution_clock::now();
+	vkCheckResult(vkCreateGraphicsPipelines(m_logicalDevice, m_pipelineCache.Get(), 1, &pipelineInfo, nullptr, &m_graphicsPipeline), "Create GraphicsPipeline");
+	std::chrono::duration<double, std::milli> createTm = std::chrono::high_resolution_clock::now() - startTm;
+	m_pipelineCache.RecordCreation("graphics", createTm.count());
 
 	vkDestroyShaderModule(m_logicalDevice, shaderVertModule, nullptr);
 	vkDestroyShaderModule(m_logicalDevice, shaderFragModule, nullptr);
@@ -867,33 +1353,81 @@ void SVKApp::CreateCommandPool() {
 	poolInfo.flags = 0; // Optional
 
 	vkCheckResult(vkCreateCommandPool(m_logicalDevice, &poolInfo, nullptr, &m_commandPool), "Create CommandPool");
+
+	if (m_asyncCompute) {
+		poolInfo.queueFamilyIndex = queueFamilyIndices.computeFamily.value();
+		vkCheckResult(vkCreateCommandPool(m_logicalDevice, &poolInfo, nullptr, &m_computeCommandPool), "Create Compute CommandPool");
+	}
+
+	// batch runs draw nothing
+	if (!m_config.m_batchOutput.empty())
+		return;
+
+	// every frame re-records its command buffers; a pool per frame in flight is reset in one go once the frame's fence signaled
+	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	m_frameCommandPools.resize(m_config.m_framesInFlight);
+	for (VkCommandPool& frameCommandPool : m_frameCommandPools)
+		vkCheckResult(vkCreateCommandPool(m_logicalDevice, &poolInfo, nullptr, &frameCommandPool), "Create Frame CommandPool");
+
+	// the draws are recorded into secondary command buffers from per thread pools
+	m_commandRecorder.Initialize(m_logicalDevice, queueFamilyIndices.graphicsFamily.value(), m_jobSystem, m_config.m_framesInFlight);
 }
 
-void SVKApp::CreateTextureImage() {
-	int texWidth, texHeight, texChannels;
-	stbi_uc* pixels = stbi_load((m_config.m_appDir / "texture.jpg").string().c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-	VkDeviceSize imageSize = static_cast<long>(texWidth) * static_cast<long>(texHeight) * 4;
+void SVKApp::CreateUploadContext() {
+	QueueFamilyIndices queueFamilyIndices = FindQueueFamilyIndices(m_physicalDevice);
 
-	if (!pixels)
-		throw std::runtime_error("failed to load texture image!");
+	m_uploadContext.Initialize(
+		m_logicalDevice,
+		m_memoryAllocator,
+		queueFamilyIndices.transferFamily.value_or(queueFamilyIndices.graphicsFamily.value()),
+		m_transferQueue,
+		queueFamilyIndices.graphicsFamily.value(),
+		m_graphicsQueue
+	);
+}
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
+void SVKApp::CreateKernelTuner() {
+	QueueFamilyIndices queueFamilyIndices = FindQueueFamilyIndices(m_physicalDevice);
 
-	CreateBuffer(
-		imageSize, 
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
-		stagingBuffer, 
-		stagingBufferMemory
+	m_kernelTuner.Initialize(
+		m_physicalDevice,
+		m_logicalDevice,
+		queueFamilyIndices.graphicsFamily.value(),
+		m_graphicsQueue,
+		m_config.m_tuningCachePath
 	);
+}
 
-	void* data;
-	vkMapMemory(m_logicalDevice, stagingBufferMemory, 0, imageSize, 0, &data);
-	memcpy(data, pixels, static_cast<size_t>(imageSize));
-	vkUnmapMemory(m_logicalDevice, stagingBufferMemory);
+void SVKApp::CreateGpuProfiler() {
+	QueueFamilyIndices queueFamilyIndices = FindQueueFamilyIndices(m_physicalDevice);
 
-	stbi_image_free(pixels);
+	m_gpuProfiler.Initialize(
+		m_physicalDevice,
+		m_logicalDevice,
+		queueFamilyIndices.graphicsFamily.value(),
+		m_config.m_framesInFlight,
+		g_maxGpuProfilerScopes
+	);
+}
+
+void SVKApp::DecodeTextureImage() {
+	m_jobSystem.Run([this]() {
+		int texChannels;
+		m_texturePixels = stbi_load((m_config.m_appDir / "texture.jpg").string().c_str(), &m_textureWidth, &m_textureHeight, &texChannels, STBI_rgb_alpha);
+
+		if (!m_texturePixels)
+			throw std::runtime_error("failed to load texture image!");
+	}, &m_textureDecoded);
+}
+
+void SVKApp::CreateTextureImage() {
+	m_jobSystem.Wait(m_textureDecoded);
+
+	stbi_uc* pixels = m_texturePixels;
+	int texWidth = m_textureWidth;
+	int texHeight = m_textureHeight;
+	VkDeviceSize imageSize = static_cast<long>(texWidth) * static_cast<long>(texHeight) * 4;
 
 	CreateImage(
 		texWidth, 
@@ -903,15 +1437,22 @@ void SVKApp::CreateTextureImage() {
 		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, 
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 
 		m_textureImage, 
-		m_textureImageMemory
+		m_textureImageAllocation
 	);
 
-	TransitionImageLayout(m_textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-	CopyBufferToImage(stagingBuffer, m_textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-	TransitionImageLayout(m_textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	m_uploadContext.UploadImage(
+		m_textureImage,
+		pixels,
+		imageSize,
+		static_cast<uint32_t>(texWidth),
+		static_cast<uint32_t>(texHeight),
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		VK_ACCESS_SHADER_READ_BIT
+	);
 
-	vkDestroyBuffer(m_logicalDevice, stagingBuffer, nullptr);
-	vkFreeMemory(m_logicalDevice, stagingBufferMemory, nullptr);
+	stbi_image_free(pixels);
+	m_texturePixels = nullptr;
 }
 
 void SVKApp::CreateImage(
@@ -922,7 +1463,7 @@ void SVKApp::CreateImage(
 	VkImageUsageFlags usage, 
 	VkMemoryPropertyFlags properties, 
 	VkImage& image, 
-	VkDeviceMemory& imageMemory
+	SVKMemoryAllocator::Allocation& imageAllocation
 ) {
 	VkImageCreateInfo imageInfo{};
 	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -944,154 +1485,168 @@ void SVKApp::CreateImage(
 	VkMemoryRequirements memRequirements;
 	vkGetImageMemoryRequirements(m_logicalDevice, image, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
-
-	vkCheckResult(vkAllocateMemory(m_logicalDevice, &allocInfo, nullptr, &imageMemory), "Allocate Texture Memory");
-	vkCheckResult(vkBindImageMemory(m_logicalDevice, image, imageMemory, 0), "Bind Image Memory");
-}
-
-void SVKApp::TransitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout) {
-	VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
-
-	VkImageMemoryBarrier barrier{};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.oldLayout = oldLayout;
-	barrier.newLayout = newLayout;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.image = image;
-	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = 1;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
-
-	VkPipelineStageFlags sourceStage;
-	VkPipelineStageFlags destinationStage;
-	if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-		barrier.srcAccessMask = 0;
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-		sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-		destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-	}
-	else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-		sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-		destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-	}
-	else
-		throw std::runtime_error("unsupported layout transition!");
-
-	vkCmdPipelineBarrier(commandBuffer, sourceStage,  destinationStage, 0, 0, nullptr, 0, nullptr, 1,  &barrier);
-
-	EndSingleTimeCommands(commandBuffer);
-}
-
-void SVKApp::CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
-	VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
-
-	VkBufferImageCopy region{};
-	region.bufferOffset = 0;
-	region.bufferRowLength = 0;
-	region.bufferImageHeight = 0;
-
-	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	region.imageSubresource.mipLevel = 0;
-	region.imageSubresource.baseArrayLayer = 0;
-	region.imageSubresource.layerCount = 1;
-
-	region.imageOffset = { 0, 0, 0 };
-	region.imageExtent = { width, height, 1 };
-
-	vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-	EndSingleTimeCommands(commandBuffer);
+	imageAllocation = m_memoryAllocator.Allocate(memRequirements, properties, SVKMemoryAllocator::Strategy::General, tiling == VK_IMAGE_TILING_OPTIMAL);
+	vkCheckResult(vkBindImageMemory(m_logicalDevice, image, imageAllocation.memory, imageAllocation.offset), "Bind Image Memory");
 }
 
 void SVKApp::CreateVertexBuffer() {
 	VkDeviceSize bufferSize = sizeof(g_vertices[0]) * g_vertices.size();
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	CreateBuffer(
-		bufferSize, 
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
-		stagingBuffer, 
-		stagingBufferMemory
-	);
-
-	void* data;
-	vkMapMemory(m_logicalDevice, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, g_vertices.data(), static_cast<size_t>(bufferSize));
-	vkUnmapMemory(m_logicalDevice, stagingBufferMemory);
-
 	CreateBuffer(
 		bufferSize, 
 		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 
 		m_vertexBuffer, 
-		m_vertexBufferMemory
+		m_vertexBufferAllocation,
+		SVKMemoryAllocator::Strategy::General
 	);
 
-	CopyBuffer(stagingBuffer, m_vertexBuffer, bufferSize);
-
-	vkDestroyBuffer(m_logicalDevice, stagingBuffer, nullptr);
-	vkFreeMemory(m_logicalDevice, stagingBufferMemory, nullptr);
+	m_uploadContext.UploadBuffer(m_vertexBuffer, g_vertices.data(), bufferSize, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
 }
 
 void SVKApp::CreateIndexBuffer() {
 	VkDeviceSize bufferSize = sizeof(g_indices[0]) * g_indices.size();
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	CreateBuffer(
-		bufferSize, 
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
-		stagingBuffer, 
-		stagingBufferMemory
-	);
-
-	void* data;
-	vkMapMemory(m_logicalDevice, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, g_indices.data(), (size_t)bufferSize);
-	vkUnmapMemory(m_logicalDevice, stagingBufferMemory);
-
 	CreateBuffer(
 		bufferSize, 
 		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, 
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 
 		m_indexBuffer, 
-		m_indexBufferMemory
+		m_indexBufferAllocation,
+		SVKMemoryAllocator::Strategy::General
+	);
+
+	m_uploadContext.UploadBuffer(m_indexBuffer, g_indices.data(), bufferSize, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+}
+
+void SVKApp::CreateNBody() {
+	// mapped until the particles are copied into staging memory by Initialize
+	SVKCheckpoint checkpoint;
+	auto startTm = std::chrono::high_resolution_clock::now();
+	if (!m_config.m_restorePath.empty())
+		checkpoint.Open(m_config.m_restorePath);
+
+	// the CPU reference sums over all pairs, so a validated Barnes-Hut run opens every node like it
+	float theta = m_config.m_theta;
+	if (m_config.m_nbodyValidate && m_config.m_barnesHut && theta != 0.0f) {
+		std::cerr << "N-body: --nbody-validate runs Barnes-Hut with theta 0 instead of " << theta << std::endl;
+		theta = 0.0f;
+	}
+
+	m_nbody.Initialize(
+		m_physicalDevice,
+		m_logicalDevice,
+		m_memoryAllocator,
+		m_uploadContext,
+		m_pipelineCache,
+		m_config.m_appDir,
+		m_config.m_particleCount,
+		m_config.m_barnesHut ? SVKNBody::Mode::BarnesHut : SVKNBody::Mode::BruteForce,
+		theta,
+		m_config.m_batchOutput.empty() ? m_config.m_framesInFlight : SVKBatchRunner::g_submissionCount,
+		m_fullSubgroups,
+		m_config.m_restorePath.empty() ? nullptr : &checkpoint
+	);
+
+	if (!m_config.m_restorePath.empty()) {
+		std::chrono::duration<double, std::milli> restoreTm = std::chrono::high_resolution_clock::now() - startTm;
+		std::cerr << "Checkpoint: restored " << m_nbody.GetParticleCount() << " particles at step " << m_nbody.GetStepCount() << " (dt " << m_nbody.GetDeltaT() << ") from '"
+			<< m_config.m_restorePath.string() << "' in " << restoreTm.count() << " ms" << std::endl;
+	}
+}
+
+void SVKApp::CreateParticleRenderer() {
+	if (!m_nbody.IsEnabled())
+		return;
+
+	std::vector<VkBuffer> particleBuffers;
+	for (uint32_t i = 0; i < GetRenderBufferCount(); ++i)
+		particleBuffers.push_back(m_nbody.GetRenderBuffer(i));
+
+	m_particleRenderer.Initialize(
+		m_logicalDevice,
+		m_pipelineCache,
+		m_config.m_appDir,
+		m_renderPass,
+		m_uniformRing.GetBuffer(),
+		sizeof(UniformBufferObject),
+		particleBuffers,
+		m_nbody.GetParticleCount()
 	);
+}
+
+void SVKApp::CreateInstanceRenderer(SVKInstanceRenderer::Culling culling) {
+	VkVertexInputBindingDescription meshBinding = Vertex::GetBindingDescription();
+	auto meshAttributes = Vertex::GetAttributeDescriptions();
+
+	// the bounding sphere of an instance is this radius times its scale
+	float meshRadius = 0.0f;
+	for (const Vertex& vertex : g_vertices)
+		meshRadius = std::max(meshRadius, glm::length(vertex.pos));
+
+	// instances of the textured quad, drawn with its vertex and index buffer
+	m_instanceRenderer.Initialize(
+		m_logicalDevice,
+		m_memoryAllocator,
+		m_uploadContext,
+		m_pipelineCache,
+		m_config.m_appDir,
+		m_renderPass,
+		m_pipelineLayout,
+		meshBinding,
+		std::vector<VkVertexInputAttributeDescription>(meshAttributes.begin(), meshAttributes.end()),
+		meshRadius,
+		m_config.m_framesInFlight,
+		m_config.m_instanceCount,
+		culling
+	);
+}
 
-	CopyBuffer(stagingBuffer, m_indexBuffer, bufferSize);
+void SVKApp::CreateAsyncCompute() {
+	if (!m_asyncCompute)
+		return;
 
-	vkDestroyBuffer(m_logicalDevice, stagingBuffer, nullptr);
-	vkFreeMemory(m_logicalDevice, stagingBufferMemory, nullptr);
+	QueueFamilyIndices queueFamilyIndices = FindQueueFamilyIndices(m_physicalDevice);
+
+	m_nbody.EnableAsyncCompute(
+		queueFamilyIndices.graphicsFamily.value(),
+		m_commandPool,
+		m_graphicsQueue,
+		queueFamilyIndices.computeFamily.value(),
+		m_computeCommandPool,
+		m_computeQueue
+	);
+
+	m_computeProfiler.Initialize(
+		m_physicalDevice,
+		m_logicalDevice,
+		queueFamilyIndices.computeFamily.value(),
+		m_config.m_framesInFlight * SVKNBody::g_renderBufferCount * GetStepVariantCount(),
+		g_maxGpuProfilerScopes
+	);
+}
+
+void SVKApp::CreateBatchRunner() {
+	QueueFamilyIndices queueFamilyIndices = FindQueueFamilyIndices(m_physicalDevice);
+
+	m_batchRunner.Initialize(
+		m_logicalDevice,
+		m_memoryAllocator,
+		queueFamilyIndices.graphicsFamily.value(),
+		m_graphicsQueue,
+		m_nbody
+	);
 }
 
 void SVKApp::CreateUniformBuffers() {
-	VkDeviceSize bufferSize = sizeof(UniformBufferObject);
-
-	m_uniformBuffers.resize(m_swapChainImages.size());
-	m_uniformBuffersMemory.resize(m_swapChainImages.size());
-
-	for (size_t i = 0; i < m_swapChainImages.size(); ++i)
-		CreateBuffer(
-			bufferSize, 
-			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, 
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
-			m_uniformBuffers[i], 
-			m_uniformBuffersMemory[i]
-		);
+	// one region per frame in flight, each command buffer binds its frame's region via a dynamic offset
+	m_uniformRing.Initialize(
+		m_physicalDevice,
+		m_logicalDevice,
+		m_memoryAllocator,
+		m_config.m_framesInFlight,
+		g_uniformRegionSize
+	);
 }
 
 void SVKApp::CreateBuffer(
@@ -1099,7 +1654,8 @@ void SVKApp::CreateBuffer(
 	VkBufferUsageFlags usage, 
 	VkMemoryPropertyFlags properties, 
 	VkBuffer& buffer, 
-	VkDeviceMemory& bufferMemory
+	SVKMemoryAllocator::Allocation& bufferAllocation,
+	SVKMemoryAllocator::Strategy strategy
 ) {
 	VkBufferCreateInfo bufferInfo{};
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -1112,65 +1668,39 @@ void SVKApp::CreateBuffer(
 	VkMemoryRequirements memRequirements;
 	vkGetBufferMemoryRequirements(m_logicalDevice, buffer, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
-
-	vkCheckResult(vkAllocateMemory(m_logicalDevice, &allocInfo, nullptr, &bufferMemory), "Allocate Memory");
-	vkCheckResult(vkBindBufferMemory(m_logicalDevice, buffer, bufferMemory, 0), "Bind Memory To Buffer");
-}
-
-void SVKApp::CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-	VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
-
-	VkBufferCopy copyRegion{};
-	copyRegion.size = size;
-	vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-
-	EndSingleTimeCommands(commandBuffer);
-}
-
-uint32_t SVKApp::FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-	VkPhysicalDeviceMemoryProperties memProperties;
-	vkGetPhysicalDeviceMemoryProperties(m_physicalDevice, &memProperties);
-
-	for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i)
-		if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
-			return i;
-
-	throw std::runtime_error("No suitable memory type found");
+	bufferAllocation = m_memoryAllocator.Allocate(memRequirements, properties, strategy, false);
+	vkCheckResult(vkBindBufferMemory(m_logicalDevice, buffer, bufferAllocation.memory, bufferAllocation.offset), "Bind Memory To Buffer");
 }
 
 void SVKApp::CreateDescriptorPool() {
 	VkDescriptorPoolSize poolSize{};
-	poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSize.descriptorCount = static_cast<uint32_t>(m_swapChainImages.size());
+	poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	poolSize.descriptorCount = m_config.m_framesInFlight;
 
 	VkDescriptorPoolCreateInfo poolInfo{};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	poolInfo.poolSizeCount = 1;
 	poolInfo.pPoolSizes = &poolSize;
-	poolInfo.maxSets = static_cast<uint32_t>(m_swapChainImages.size());
+	poolInfo.maxSets = m_config.m_framesInFlight;
 
 	vkCheckResult(vkCreateDescriptorPool(m_logicalDevice, &poolInfo, nullptr, &m_descriptorPool), "Create DescriptorPool");
 }
 
 void SVKApp::CreateDescriptorSets() {
-	std::vector<VkDescriptorSetLayout> layouts(m_swapChainImages.size(), m_descriptorSetLayout);
+	std::vector<VkDescriptorSetLayout> layouts(m_config.m_framesInFlight, m_descriptorSetLayout);
 
 	VkDescriptorSetAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = m_descriptorPool;
-	allocInfo.descriptorSetCount = static_cast<uint32_t>(m_swapChainImages.size());
+	allocInfo.descriptorSetCount = m_config.m_framesInFlight;
 	allocInfo.pSetLayouts = layouts.data();
 
-	m_descriptorSets.resize(m_swapChainImages.size());
+	m_descriptorSets.resize(m_config.m_framesInFlight);
 	vkCheckResult(vkAllocateDescriptorSets(m_logicalDevice, &allocInfo, m_descriptorSets.data()), "Allocate DescriptorSets");
 
-	for (size_t i = 0; i < m_swapChainImages.size(); ++i) {
+	for (size_t i = 0; i < m_descriptorSets.size(); ++i) {
 		VkDescriptorBufferInfo bufferInfo{};
-		bufferInfo.buffer = m_uniformBuffers[i];
+		bufferInfo.buffer = m_uniformRing.GetBuffer();
 		bufferInfo.offset = 0;
 		bufferInfo.range = sizeof(UniformBufferObject);
 
@@ -1179,7 +1709,7 @@ void SVKApp::CreateDescriptorSets() {
 		descriptorWrite.dstSet = m_descriptorSets[i];
 		descriptorWrite.dstBinding = 0;
 		descriptorWrite.dstArrayElement = 0;
-		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 		descriptorWrite.descriptorCount = 1;
 		descriptorWrite.pBufferInfo = &bufferInfo;
 		descriptorWrite.pImageInfo = nullptr; // Optional
@@ -1190,54 +1720,220 @@ void SVKApp::CreateDescriptorSets() {
 }
 
 void SVKApp::CreateCommandBuffers() {
-	m_commandBuffers.resize(m_swapChainFrameBuffers.size());
+	// one primary command buffer per frame in flight, re-recorded every frame from the frame's own pool
+	m_commandBuffers.resize(m_config.m_framesInFlight);
+	for (uint32_t frame = 0; frame < m_config.m_framesInFlight; ++frame) {
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = m_frameCommandPools[frame];
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+
+		vkCheckResult(vkAllocateCommandBuffers(m_logicalDevice, &allocInfo, &m_commandBuffers[frame]), "Allocate CommandBuffers");
+	}
+}
+
+void SVKApp::UpdateAndRecordFrame(uint32_t frame, uint32_t imageIndex) {
+	if (m_instanceRenderer.IsEnabled()) {
+		// CPU culling decides the instance draws, so the instances are updated before recording; the update spreads
+		// over all job system threads anyway
+		SVKBenchmark::ScopedTimer timer(m_benchmark, "cpu.instances");
+		glm::mat4 view, proj;
+		GetCameraMatrices(view, proj);
+		m_instanceRenderer.Update(frame, static_cast<float>(m_timestep.GetTime()), proj * view, m_jobSystem);
+	}
+
+	// the command buffer only refers to the uniform regions of the frame, so the update runs as a job while the
+	// frame is recorded. The benchmark is not thread safe, the job only measures its time
+	double updateTime = 0.0;
+	SVKJobSystem::Counter updated;
+	m_jobSystem.Run([this, frame, &updateTime]() {
+		auto startTm = std::chrono::high_resolution_clock::now();
+		UpdateUniformBuffer(frame);
+		std::chrono::duration<double, std::milli> updateTm = std::chrono::high_resolution_clock::now() - startTm;
+		updateTime = updateTm.count();
+	}, &updated);
+
+	try {
+		SVKBenchmark::ScopedTimer timer(m_benchmark, "cpu.record");
+		RecordFrame(frame, imageIndex);
+	}
+	catch (...) {
+		// the job refers to this stack frame
+		m_jobSystem.Wait(updated);
+		throw;
+	}
+
+	m_jobSystem.Wait(updated);
+	m_benchmark.Record("cpu.update", updateTime);
+}
+
+void SVKApp::RecordFrame(uint32_t frame, uint32_t imageIndex) {
+	// the fence of the frame has been waited for, so nothing recorded from its pools is still pending
+	vkCheckResult(vkResetCommandPool(m_logicalDevice, m_frameCommandPools[frame], 0), "Reset Frame CommandPool");
+	m_commandRecorder.ResetFrame(frame);
+
+	VkCommandBuffer commandBuffer = m_commandBuffers[frame];
+	uint32_t renderIndex = GetRenderIndex();
+	uint32_t stepCount = m_timestep.GetFrameStepCount();
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = nullptr; // Optional
+
+	vkCheckResult(vkBeginCommandBuffer(commandBuffer, &beginInfo), "Begin Command Sequence");
+
+	m_gpuProfiler.BeginFrame(commandBuffer, frame);
+	uint32_t frameScope = m_gpuProfiler.BeginScope(commandBuffer, frame, "frame");
+
+	if (m_nbody.IsAsyncCompute())
+		m_nbody.RecordRenderAcquire(commandBuffer, renderIndex);
+	else if (m_nbody.IsEnabled() && stepCount > 0) {
+		uint32_t nbodyScope = m_gpuProfiler.BeginScope(commandBuffer, frame, "nbody");
+		m_nbody.RecordDispatch(commandBuffer, frame, stepCount);
+		m_gpuProfiler.EndScope(commandBuffer, frame, nbodyScope);
+	}
+
+	if (m_instanceRenderer.GetCulling() == SVKInstanceRenderer::Culling::Gpu) {
+		uint32_t cullScope = m_gpuProfiler.BeginScope(commandBuffer, frame, "cull");
+		m_instanceRenderer.RecordCull(commandBuffer, frame, static_cast<uint32_t>(g_indices.size()));
+		m_gpuProfiler.EndScope(commandBuffer, frame, cullScope);
+	}
+
+	VkClearValue clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
+
+	VkRenderPassBeginInfo renderPassInfo{};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass = m_renderPass;
+	renderPassInfo.framebuffer = m_swapChainFrameBuffers[imageIndex];
+	renderPassInfo.renderArea.offset = { 0, 0 };
+	renderPassInfo.renderArea.extent = m_swapChainExtent;
+	renderPassInfo.clearValueCount = 1;
+	renderPassInfo.pClearValues = &clearColor;
+
+	uint32_t renderPassScope = m_gpuProfiler.BeginScope(commandBuffer, frame, "renderPass");
+	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+	// draw 0 is the textured quad, then the particles and the instances if they are enabled
+	std::vector<SVKCommandRecorder::Pass> passes = { { frame, frame, m_swapChainFrameBuffers[imageIndex] } };
+	uint32_t drawCount = 1 + (m_particleRenderer.IsEnabled() ? 1 : 0) + (m_instanceRenderer.IsEnabled() ? 1 : 0);
+	m_commandRecorder.Record(
+		m_renderPass,
+		passes,
+		drawCount,
+		[this, renderIndex](VkCommandBuffer secondaryCommandBuffer, const SVKCommandRecorder::Pass& pass, uint32_t firstDraw, uint32_t chunkDrawCount) {
+			RecordDraws(secondaryCommandBuffer, pass.frame, renderIndex, firstDraw, chunkDrawCount);
+		},
+		m_secondaryCommandBuffers
+	);
+
+	const std::vector<VkCommandBuffer>& secondaryCommandBuffers = m_secondaryCommandBuffers.front();
+	vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaryCommandBuffers.size()), secondaryCommandBuffers.data());
+	vkCmdEndRenderPass(commandBuffer);
+	m_gpuProfiler.EndScope(commandBuffer, frame, renderPassScope);
+
+	m_nbody.RecordRenderRelease(commandBuffer, renderIndex);
+
+	m_gpuProfiler.EndScope(commandBuffer, frame, frameScope);
+
+	vkCheckResult(vkEndCommandBuffer(commandBuffer), "End Command Sequence");
+}
+
+void SVKApp::RecordDraws(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t renderIndex, uint32_t firstDraw, uint32_t drawCount) {
+	// runs on the recorder threads; a secondary command buffer inherits no state from the primary
+	uint32_t uniformOffset = m_uniformRing.GetRegionOffset(frame);
+
+	VkViewport viewport{};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = static_cast<float>(m_swapChainExtent.width);
+	viewport.height = static_cast<float>(m_swapChainExtent.height);
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+	VkRect2D scissor{};
+	scissor.offset = { 0, 0 };
+	scissor.extent = m_swapChainExtent;
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+	for (uint32_t draw = firstDraw; draw < firstDraw + drawCount; ++draw) {
+		if (draw == 0) {
+			VkBuffer vertexBuffers[] = { m_vertexBuffer };
+			VkDeviceSize offsets[] = { 0 };
+
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphicsPipeline);
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+			vkCmdBindIndexBuffer(commandBuffer, m_indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descriptorSets[frame], 1, &uniformOffset);
+			uint32_t drawScope = m_gpuProfiler.BeginScope(commandBuffer, frame, "draw");
+			vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(g_indices.size()), 1, 0, 0, 0);
+			m_gpuProfiler.EndScope(commandBuffer, frame, drawScope);
+		}
+		else if (draw == 1 && m_particleRenderer.IsEnabled()) {
+			uint32_t particlesScope = m_gpuProfiler.BeginScope(commandBuffer, frame, "particles");
+			m_particleRenderer.RecordDraw(commandBuffer, uniformOffset, renderIndex);
+			m_gpuProfiler.EndScope(commandBuffer, frame, particlesScope);
+		}
+		else {
+			// the quad mesh at binding 0, possibly recorded into another command buffer than draw 0
+			VkBuffer vertexBuffers[] = { m_vertexBuffer };
+			VkDeviceSize offsets[] = { 0 };
+
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+			vkCmdBindIndexBuffer(commandBuffer, m_indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descriptorSets[frame], 1, &uniformOffset);
+			uint32_t instancesScope = m_gpuProfiler.BeginScope(commandBuffer, frame, "instances");
+			m_instanceRenderer.RecordDraw(commandBuffer, frame, static_cast<uint32_t>(g_indices.size()));
+			m_gpuProfiler.EndScope(commandBuffer, frame, instancesScope);
+		}
+	}
+}
+
+void SVKApp::CreateComputeCommandBuffers() {
+	if (!m_nbody.IsAsyncCompute())
+		return;
+
+	// one per (frame in flight, render buffer written by the step, steps per frame); they do not depend on the swapchain
+	m_computeCommandBuffers.resize(m_config.m_framesInFlight * SVKNBody::g_renderBufferCount * GetStepVariantCount());
 
 	VkCommandBufferAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocInfo.commandPool = m_commandPool;
+	allocInfo.commandPool = m_computeCommandPool;
 	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandBufferCount = static_cast<uint32_t>(m_commandBuffers.size());
+	allocInfo.commandBufferCount = static_cast<uint32_t>(m_computeCommandBuffers.size());
 
-	vkCheckResult(vkAllocateCommandBuffers(m_logicalDevice, &allocInfo, m_commandBuffers.data()), "Allocate CommandBuffers");
+	vkCheckResult(vkAllocateCommandBuffers(m_logicalDevice, &allocInfo, m_computeCommandBuffers.data()), "Allocate Compute CommandBuffers");
 
-	for (size_t i = 0; i < m_commandBuffers.size(); ++i) {
+	for (size_t i = 0; i < m_computeCommandBuffers.size(); ++i) {
 		VkCommandBufferBeginInfo beginInfo{};
 		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = 0; // Optional
-		beginInfo.pInheritanceInfo = nullptr; // Optional
-
-		vkCheckResult(vkBeginCommandBuffer(m_commandBuffers[i], &beginInfo), "Begin Command Sequence");
-
-		VkClearValue clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
-
-		VkRenderPassBeginInfo renderPassInfo{};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		renderPassInfo.renderPass = m_renderPass;
-		renderPassInfo.framebuffer = m_swapChainFrameBuffers[i];
-		renderPassInfo.renderArea.offset = { 0, 0 };
-		renderPassInfo.renderArea.extent = m_swapChainExtent;
-		renderPassInfo.clearValueCount = 1;
-		renderPassInfo.pClearValues = &clearColor;
 
-		VkBuffer vertexBuffers[] = { m_vertexBuffer };
-		VkDeviceSize offsets[] = { 0 };
-
-		vkCmdBeginRenderPass(m_commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-		vkCmdBindPipeline(m_commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphicsPipeline);
-		vkCmdBindVertexBuffers(m_commandBuffers[i], 0, 1, vertexBuffers, offsets);
-		vkCmdBindIndexBuffer(m_commandBuffers[i], m_indexBuffer, 0, VK_INDEX_TYPE_UINT16);
-		vkCmdBindDescriptorSets(m_commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descriptorSets[i], 0, nullptr);
-		vkCmdDrawIndexed(m_commandBuffers[i], static_cast<uint32_t>(g_indices.size()), 1, 0, 0, 0);
-		vkCmdEndRenderPass(m_commandBuffers[i]);
+		vkCheckResult(vkBeginCommandBuffer(m_computeCommandBuffers[i], &beginInfo), "Begin Compute Command Sequence");
+
+		uint32_t slot = static_cast<uint32_t>(i);
+		uint32_t frame = (slot / SVKNBody::g_renderBufferCount) % m_config.m_framesInFlight;
+		uint32_t renderIndex = slot % SVKNBody::g_renderBufferCount;
+		uint32_t stepCount = slot / (SVKNBody::g_renderBufferCount * m_config.m_framesInFlight);
+		m_computeProfiler.BeginFrame(m_computeCommandBuffers[i], slot);
+		// without a step the submission only copies the state into the render buffer, which is no gpu.nbody sample
+		if (stepCount > 0) {
+			uint32_t nbodyScope = m_computeProfiler.BeginScope(m_computeCommandBuffers[i], slot, "nbody");
+			m_nbody.RecordAsyncDispatch(m_computeCommandBuffers[i], frame, renderIndex, stepCount);
+			m_computeProfiler.EndScope(m_computeCommandBuffers[i], slot, nbodyScope);
+		}
+		else
+			m_nbody.RecordAsyncDispatch(m_computeCommandBuffers[i], frame, renderIndex, stepCount);
 
-		vkCheckResult(vkEndCommandBuffer(m_commandBuffers[i]), "End Command Sequence");
+		vkCheckResult(vkEndCommandBuffer(m_computeCommandBuffers[i]), "End Compute Command Sequence");
 	}
 }
 
 void SVKApp::CreateSyncObjects() {
-	m_imageAvailableSemaphores.resize(g_maxFramesInFlight);
-	m_renderFinishedSemaphores.resize(g_maxFramesInFlight);
-	m_inFlightFences.resize(g_maxFramesInFlight);
+	m_imageAvailableSemaphores.resize(m_config.m_framesInFlight);
+	m_renderFinishedSemaphores.resize(m_config.m_framesInFlight);
+	m_inFlightFences.resize(m_config.m_framesInFlight);
 	m_imagesInFlight.resize(m_swapChainImages.size(), VK_NULL_HANDLE);
 
 	VkSemaphoreCreateInfo semaphoreInfo{};
@@ -1247,11 +1943,26 @@ void SVKApp::CreateSyncObjects() {
 	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-	for (int i = 0; i < g_maxFramesInFlight; ++i) {
+	for (uint32_t i = 0; i < m_config.m_framesInFlight; ++i) {
 		vkCheckResult(vkCreateSemaphore(m_logicalDevice, &semaphoreInfo, nullptr, &m_imageAvailableSemaphores[i]), "Create ImageAvailable Semaphore");
 		vkCheckResult(vkCreateSemaphore(m_logicalDevice, &semaphoreInfo, nullptr, &m_renderFinishedSemaphores[i]), "Create RenderFinished Semaphore");
 		vkCheckResult(vkCreateFence(m_logicalDevice, &fenceInfo, nullptr, &m_inFlightFences[i]), "Create InFlight Fence");
 	}
+
+	if (!m_nbody.IsAsyncCompute())
+		return;
+
+	// the step may still run when the graphics fence of its frame signals, it has a fence of its own
+	m_computeFences.resize(m_config.m_framesInFlight);
+	for (uint32_t i = 0; i < m_config.m_framesInFlight; ++i)
+		vkCheckResult(vkCreateFence(m_logicalDevice, &fenceInfo, nullptr, &m_computeFences[i]), "Create Compute Fence");
+
+	m_computeFinishedSemaphores.resize(SVKNBody::g_renderBufferCount);
+	m_renderReleasedSemaphores.resize(SVKNBody::g_renderBufferCount);
+	for (uint32_t i = 0; i < SVKNBody::g_renderBufferCount; ++i) {
+		vkCheckResult(vkCreateSemaphore(m_logicalDevice, &semaphoreInfo, nullptr, &m_computeFinishedSemaphores[i]), "Create ComputeFinished Semaphore");
+		vkCheckResult(vkCreateSemaphore(m_logicalDevice, &semaphoreInfo, nullptr, &m_renderReleasedSemaphores[i]), "Create RenderReleased Semaphore");
+	}
 }
 
 void SVKApp::CleanupWindow() {
@@ -1262,14 +1973,38 @@ void SVKApp::CleanupWindow() {
 }
 
 void SVKApp::CleanupVulkan() {
+	DestroyRetiredSwapChains(true);
 	CleanupSwapChain();
 
+	vkDestroyDescriptorPool(m_logicalDevice, m_descriptorPool, nullptr);
+	m_descriptorPool = VK_NULL_HANDLE;
+
+	m_uniformRing.Cleanup();
+	m_gpuProfiler.Cleanup();
+	m_computeProfiler.Cleanup();
+
+	m_particleRenderer.Cleanup();
+	m_instanceRenderer.Cleanup();
+	vkDestroyPipeline(m_logicalDevice, m_graphicsPipeline, nullptr);
+	m_graphicsPipeline = VK_NULL_HANDLE;
+
+	vkDestroyPipelineLayout(m_logicalDevice, m_pipelineLayout, nullptr);
+	m_pipelineLayout = VK_NULL_HANDLE;
+
+	vkDestroyRenderPass(m_logicalDevice, m_renderPass, nullptr);
+	m_renderPass = VK_NULL_HANDLE;
+
+	m_batchRunner.Cleanup();
+	m_nbody.Cleanup();
+	m_kernelTuner.Cleanup();
+	m_uploadContext.Cleanup();
+
 	vkDestroyDescriptorSetLayout(m_logicalDevice, m_descriptorSetLayout, nullptr);
 	m_descriptorSetLayout = VK_NULL_HANDLE;
 
 	m_currentFrame = 0;
 	m_imagesInFlight.clear();
-	for (int i = 0; i < g_maxFramesInFlight; ++i) {
+	for (size_t i = 0; i < m_inFlightFences.size(); ++i) {
 		vkDestroyFence(m_logicalDevice, m_inFlightFences[i], nullptr);
 		vkDestroySemaphore(m_logicalDevice, m_renderFinishedSemaphores[i], nullptr);
 		vkDestroySemaphore(m_logicalDevice, m_imageAvailableSemaphores[i], nullptr);
@@ -1278,32 +2013,61 @@ void SVKApp::CleanupVulkan() {
 	m_renderFinishedSemaphores.clear();
 	m_imageAvailableSemaphores.clear();
 
+	for (size_t i = 0; i < m_computeFences.size(); ++i)
+		vkDestroyFence(m_logicalDevice, m_computeFences[i], nullptr);
+	for (size_t i = 0; i < m_computeFinishedSemaphores.size(); ++i) {
+		vkDestroySemaphore(m_logicalDevice, m_computeFinishedSemaphores[i], nullptr);
+		vkDestroySemaphore(m_logicalDevice, m_renderReleasedSemaphores[i], nullptr);
+	}
+	m_computeFences.clear();
+	m_computeFinishedSemaphores.clear();
+	m_renderReleasedSemaphores.clear();
+	m_asyncStep = 0;
+
 	vkDestroyBuffer(m_logicalDevice, m_indexBuffer, nullptr);
 	m_indexBuffer = VK_NULL_HANDLE;
-	vkFreeMemory(m_logicalDevice, m_indexBufferMemory, nullptr);
-	m_indexBufferMemory = VK_NULL_HANDLE;
+	m_memoryAllocator.Free(m_indexBufferAllocation);
 
 	vkDestroyBuffer(m_logicalDevice, m_vertexBuffer, nullptr);
 	m_vertexBuffer = VK_NULL_HANDLE;
-	vkFreeMemory(m_logicalDevice, m_vertexBufferMemory, nullptr);
-	m_vertexBufferMemory = VK_NULL_HANDLE;
+	m_memoryAllocator.Free(m_vertexBufferAllocation);
 
 	vkDestroyImage(m_logicalDevice, m_textureImage, nullptr);
 	m_textureImage = VK_NULL_HANDLE;
-	vkFreeMemory(m_logicalDevice, m_textureImageMemory, nullptr);
-	m_textureImageMemory = VK_NULL_HANDLE;
+	m_memoryAllocator.Free(m_textureImageAllocation);
 
 	vkDestroyCommandPool(m_logicalDevice, m_commandPool, nullptr);
 	m_commandPool = VK_NULL_HANDLE;
 
+	// frees the frame command buffers
+	for (VkCommandPool frameCommandPool : m_frameCommandPools)
+		vkDestroyCommandPool(m_logicalDevice, frameCommandPool, nullptr);
+	m_frameCommandPools.clear();
+	m_commandBuffers.clear();
+	m_secondaryCommandBuffers.clear();
+	m_commandRecorder.Cleanup();
+
+	// frees the compute command buffers
+	vkDestroyCommandPool(m_logicalDevice, m_computeCommandPool, nullptr);
+	m_computeCommandPool = VK_NULL_HANDLE;
+	m_computeCommandBuffers.clear();
+
+	m_computeQueue = VK_NULL_HANDLE;
+	m_asyncCompute = false;
+	m_transferQueue = VK_NULL_HANDLE;
 	m_presentQueue = VK_NULL_HANDLE;
 	m_graphicsQueue = VK_NULL_HANDLE;
+	m_pipelineCache.Save();
+	m_pipelineCache.Cleanup();
+	m_memoryAllocator.Cleanup();
 	vkDestroyDevice(m_logicalDevice, nullptr);
 	m_logicalDevice = VK_NULL_HANDLE;
 
 	m_physicalDevice = VK_NULL_HANDLE;
-	vkDestroySurfaceKHR(m_instance, m_windowSurface, nullptr);
-	m_windowSurface = VK_NULL_HANDLE;
+	if (m_windowSurface != VK_NULL_HANDLE) {
+		vkDestroySurfaceKHR(m_instance, m_windowSurface, nullptr);
+		m_windowSurface = VK_NULL_HANDLE;
+	}
 
 	if (g_enableValidationLayers) {
 		DestroyDebugUtilsMessengerEXT(m_instance, m_debugMessenger, nullptr);
@@ -1319,26 +2083,6 @@ void SVKApp::CleanupSwapChain() {
 		vkDestroyFramebuffer(m_logicalDevice, frameBuffer, nullptr);
 	m_swapChainFrameBuffers.clear();
 
-	vkDestroyDescriptorPool(m_logicalDevice, m_descriptorPool, nullptr);
-	m_descriptorPool = VK_NULL_HANDLE;
-
-	for (size_t i = 0; i < m_swapChainImages.size(); ++i) {
-		vkDestroyBuffer(m_logicalDevice, m_uniformBuffers[i], nullptr);
-		vkFreeMemory(m_logicalDevice, m_uniformBuffersMemory[i], nullptr);
-	}
-	m_uniformBuffers.clear();
-	m_uniformBuffersMemory.clear();
-
-	vkFreeCommandBuffers(m_logicalDevice, m_commandPool, static_cast<uint32_t>(m_commandBuffers.size()), m_commandBuffers.data());
-
-	vkDestroyPipeline(m_logicalDevice, m_graphicsPipeline, nullptr);
-	m_graphicsPipeline = VK_NULL_HANDLE;
-
-	vkDestroyPipelineLayout(m_logicalDevice, m_pipelineLayout, nullptr);
-	m_pipelineLayout = VK_NULL_HANDLE;
-
-	vkDestroyRenderPass(m_logicalDevice, m_renderPass, nullptr);
-	m_renderPass = VK_NULL_HANDLE;
 
 	for (const VkImageView& view : m_swapChainImageViews)
 		vkDestroyImageView(m_logicalDevice, view, nullptr);
@@ -1346,9 +2090,18 @@ void SVKApp::CleanupSwapChain() {
 
 	m_swapChainExtent = { 0, 0 };
 	m_swapChainImageFormat = VK_FORMAT_UNDEFINED;
+	if (m_swapChain != VK_NULL_HANDLE) {
+		vkDestroySwapchainKHR(m_logicalDevice, m_swapChain, nullptr);
+		m_swapChain = VK_NULL_HANDLE;
+	}
+	else {
+		for (size_t i = 0; i < m_swapChainImages.size(); ++i) {
+			vkDestroyImage(m_logicalDevice, m_swapChainImages[i], nullptr);
+			m_memoryAllocator.Free(m_offscreenImageAllocations[i]);
+		}
+		m_offscreenImageAllocations.clear();
+	}
 	m_swapChainImages.clear();
-	vkDestroySwapchainKHR(m_logicalDevice, m_swapChain, nullptr);
-	m_swapChain = VK_NULL_HANDLE;
 }
 
 void SVKApp::RecreateSwapChain() {
@@ -1360,118 +2113,341 @@ void SVKApp::RecreateSwapChain() {
 		glfwWaitEvents();
 	}
 
-	vkDeviceWaitIdle(m_logicalDevice);
+	auto startTm = std::chrono::high_resolution_clock::now();
 
-	std::cerr << "RecreateSwapChain" << std::endl;
-
-	CleanupSwapChain();
+	VkFormat oldFormat = m_swapChainImageFormat;
+	size_t oldImageCount = m_swapChainImages.size();
 
+	// frames in flight keep using the old views and framebuffers until they retire
+	RetireSwapChain();
 	CreateSwapChain();
+
+	bool formatChanged = m_swapChainImageFormat != oldFormat;
+	bool imageCountChanged = m_swapChainImages.size() != oldImageCount;
+	if (formatChanged || imageCountChanged)
+		WaitForFramesInFlight();
+
 	CreateImageViews();
-	CreateRenderPass();
-	CreateGraphicsPipeline();
+	if (formatChanged) {
+		m_particleRenderer.DestroyPipeline();
+		m_instanceRenderer.DestroyPipeline();
+		vkDestroyPipeline(m_logicalDevice, m_graphicsPipeline, nullptr);
+		vkDestroyPipelineLayout(m_logicalDevice, m_pipelineLayout, nullptr);
+		vkDestroyRenderPass(m_logicalDevice, m_renderPass, nullptr);
+
+		CreateRenderPass();
+		CreateGraphicsPipeline();
+		m_particleRenderer.CreatePipeline(m_renderPass);
+		m_instanceRenderer.CreatePipeline(m_renderPass, m_pipelineLayout);
+	}
 	CreateFrameBuffers();
-	CreateUniformBuffers();
-	CreateDescriptorPool();
-	CreateDescriptorSets();
-	CreateCommandBuffers();
+
+	m_imagesInFlight.assign(m_swapChainImages.size(), VK_NULL_HANDLE);
+
+	std::chrono::duration<double, std::milli> recreateTm = std::chrono::high_resolution_clock::now() - startTm;
+	m_benchmark.Record("cpu.recreateSwapChain", recreateTm.count());
+	std::cerr << "RecreateSwapChain: " << m_swapChainExtent.width << "x" << m_swapChainExtent.height << " in " << recreateTm.count() << " ms"
+		<< (formatChanged ? " (format changed)" : "") << std::endl;
+}
+
+void SVKApp::RetireSwapChain() {
+	RetiredSwapChain retired{};
+	retired.retiredFrame = m_frameNumber;
+	retired.swapChain = m_swapChain;
+	retired.imageViews.swap(m_swapChainImageViews);
+	retired.frameBuffers.swap(m_swapChainFrameBuffers);
+	m_retiredSwapChains.push_back(std::move(retired));
+
+	// m_swapChain stays set, CreateSwapChain passes it as oldSwapchain
+	m_swapChainImages.clear();
+}
+
+void SVKApp::DestroyRetiredSwapChains(bool force) {
+	auto it = m_retiredSwapChains.begin();
+	while (it != m_retiredSwapChains.end()) {
+		// frame N waited for the fence of frame N - framesInFlight, so everything submitted before the retirement is done
+		if (!force && m_frameNumber < it->retiredFrame + m_config.m_framesInFlight) {
+			++it;
+			continue;
+		}
+
+		for (const VkFramebuffer& frameBuffer : it->frameBuffers)
+			vkDestroyFramebuffer(m_logicalDevice, frameBuffer, nullptr);
+		for (const VkImageView& view : it->imageViews)
+			vkDestroyImageView(m_logicalDevice, view, nullptr);
+		vkDestroySwapchainKHR(m_logicalDevice, it->swapChain, nullptr);
+
+		it = m_retiredSwapChains.erase(it);
+	}
+}
+
+void SVKApp::WaitForFramesInFlight() {
+	vkCheckResult(vkWaitForFences(m_logicalDevice, static_cast<uint32_t>(m_inFlightFences.size()), m_inFlightFences.data(), VK_TRUE, UINT64_MAX), "InFlight Fence Wait");
 }
 
 void SVKApp::DrawFrame() {
-	vkCheckResult(vkWaitForFences(m_logicalDevice, 1, &m_inFlightFences[m_currentFrame], VK_TRUE, UINT64_MAX), "InFlight Fence Wait");
+	{
+		SVKBenchmark::ScopedTimer timer(m_benchmark, "cpu.wait");
+		vkCheckResult(vkWaitForFences(m_logicalDevice, 1, &m_inFlightFences[m_currentFrame], VK_TRUE, UINT64_MAX), "InFlight Fence Wait");
+		if (m_nbody.IsAsyncCompute())
+			vkCheckResult(vkWaitForFences(m_logicalDevice, 1, &m_computeFences[m_currentFrame], VK_TRUE, UINT64_MAX), "Compute Fence Wait");
+	}
+
+	DestroyRetiredSwapChains(false);
 
 	uint32_t imageIndex;
-	vkCheckResult(vkAcquireNextImageKHR(m_logicalDevice, m_swapChain, UINT64_MAX, m_imageAvailableSemaphores[m_currentFrame], VK_NULL_HANDLE, &imageIndex), "Acquire Next Image");
+	{
+		SVKBenchmark::ScopedTimer timer(m_benchmark, "cpu.acquire");
+		vkCheckResult(vkAcquireNextImageKHR(m_logicalDevice, m_swapChain, UINT64_MAX, m_imageAvailableSemaphores[m_currentFrame], VK_NULL_HANDLE, &imageIndex), "Acquire Next Image");
+	}
+
+	{
+		SVKBenchmark::ScopedTimer timer(m_benchmark, "cpu.wait");
+		if (m_imagesInFlight[imageIndex] != VK_NULL_HANDLE)
+			vkCheckResult(vkWaitForFences(m_logicalDevice, 1, &m_imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX), "InFlight Fence Wait");
+		m_imagesInFlight[imageIndex] = m_inFlightFences[m_currentFrame];
+	}
 
-	if (m_imagesInFlight[imageIndex] != VK_NULL_HANDLE)
-		vkCheckResult(vkWaitForFences(m_logicalDevice, 1, &m_imagesInFlight[m_currentFrame], VK_TRUE, UINT64_MAX), "InFlight Fence Wait");
-	m_imagesInFlight[imageIndex] = m_inFlightFences[m_currentFrame];
+	// the step count is recorded into the frame and selects the compute command buffer
+	m_timestep.Advance();
+	uint32_t frame = static_cast<uint32_t>(m_currentFrame);
 
-	UpdateUniformBuffer(imageIndex);
+	// the fence of this frame guarded its previous submission
+	m_gpuProfiler.Report(frame, m_benchmark);
+	for (uint32_t i = 0; i < GetStepVariantCount() * SVKNBody::g_renderBufferCount && m_nbody.IsAsyncCompute(); ++i)
+		m_computeProfiler.Report(GetComputeSlot(frame, i % SVKNBody::g_renderBufferCount, i / SVKNBody::g_renderBufferCount), m_benchmark);
 
-	VkSemaphore waitSemaphores[] = { m_imageAvailableSemaphores[m_currentFrame] };
-	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+	UpdateAndRecordFrame(frame, imageIndex);
+
+	std::vector<VkSemaphore> waitSemaphores = { m_imageAvailableSemaphores[m_currentFrame] };
+	std::vector<VkPipelineStageFlags> waitStages = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+	std::vector<VkSemaphore> signalSemaphores = { m_renderFinishedSemaphores[m_currentFrame] };
+	SubmitAsyncCompute(waitSemaphores, waitStages, signalSemaphores);
 
 	VkSubmitInfo submitInfo{};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = waitSemaphores;
-	submitInfo.pWaitDstStageMask = waitStages;
+	submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+	submitInfo.pWaitSemaphores = waitSemaphores.data();
+	submitInfo.pWaitDstStageMask = waitStages.data();
 	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &m_commandBuffers[imageIndex];
-
-	VkSemaphore signalSemaphores[] = { m_renderFinishedSemaphores[m_currentFrame] };
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = signalSemaphores;
-
-	vkCheckResult(vkResetFences(m_logicalDevice, 1, &m_inFlightFences[m_currentFrame]), "inFlight Fence Reset");
-	vkCheckResult(vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, m_inFlightFences[m_currentFrame]), "Queue Submit");
+	submitInfo.pCommandBuffers = &m_commandBuffers[frame];
+	submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+	submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+	{
+		SVKBenchmark::ScopedTimer timer(m_benchmark, "cpu.submit");
+		vkCheckResult(vkResetFences(m_logicalDevice, 1, &m_inFlightFences[m_currentFrame]), "inFlight Fence Reset");
+		vkCheckResult(vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, m_inFlightFences[m_currentFrame]), "Queue Submit");
+		m_gpuProfiler.MarkSubmitted(frame);
+		if (m_nbody.IsAsyncCompute())
+			++m_asyncStep;
+	}
 
 	VkSwapchainKHR swapChains[] = { m_swapChain };
 
 	VkPresentInfoKHR presentInfo{};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 	presentInfo.waitSemaphoreCount = 1;
-	presentInfo.pWaitSemaphores = signalSemaphores;
+	presentInfo.pWaitSemaphores = &m_renderFinishedSemaphores[m_currentFrame];
 	presentInfo.swapchainCount = 1;
 	presentInfo.pSwapchains = swapChains;
 	presentInfo.pImageIndices = &imageIndex;
 	presentInfo.pResults = nullptr; // Optional
 
-	vkCheckResult(vkQueuePresentKHR(m_presentQueue, &presentInfo), "Queue Present");
-	vkCheckResult(vkQueueWaitIdle(m_presentQueue), "Queue Present Wait");
+	{
+		SVKBenchmark::ScopedTimer timer(m_benchmark, "cpu.present");
+		vkCheckResult(vkQueuePresentKHR(m_presentQueue, &presentInfo), "Queue Present");
+	}
 
-	m_currentFrame = (m_currentFrame + 1) % g_maxFramesInFlight;
+	m_currentFrame = (m_currentFrame + 1) % m_config.m_framesInFlight;
+	++m_frameNumber;
 }
 
-void SVKApp::UpdateUniformBuffer(uint32_t currentImage) {
-	static auto startTime = std::chrono::high_resolution_clock::now();
-	auto currentTime = std::chrono::high_resolution_clock::now();
-	float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+void SVKApp::DrawFrameHeadless() {
+	uint32_t imageIndex = m_offscreenImageIndex;
+	m_offscreenImageIndex = (m_offscreenImageIndex + 1) % static_cast<uint32_t>(m_swapChainImages.size());
+
+	{
+		SVKBenchmark::ScopedTimer timer(m_benchmark, "cpu.wait");
+		vkCheckResult(vkWaitForFences(m_logicalDevice, 1, &m_inFlightFences[m_currentFrame], VK_TRUE, UINT64_MAX), "InFlight Fence Wait");
+		if (m_nbody.IsAsyncCompute())
+			vkCheckResult(vkWaitForFences(m_logicalDevice, 1, &m_computeFences[m_currentFrame], VK_TRUE, UINT64_MAX), "Compute Fence Wait");
+		if (m_imagesInFlight[imageIndex] != VK_NULL_HANDLE)
+			vkCheckResult(vkWaitForFences(m_logicalDevice, 1, &m_imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX), "InFlight Fence Wait");
+		m_imagesInFlight[imageIndex] = m_inFlightFences[m_currentFrame];
+	}
+
+	// the step count is recorded into the frame and selects the compute command buffer
+	m_timestep.Advance();
+	uint32_t frame = static_cast<uint32_t>(m_currentFrame);
+
+	// the fence of this frame guarded its previous submission
+	m_gpuProfiler.Report(frame, m_benchmark);
+	for (uint32_t i = 0; i < GetStepVariantCount() * SVKNBody::g_renderBufferCount && m_nbody.IsAsyncCompute(); ++i)
+		m_computeProfiler.Report(GetComputeSlot(frame, i % SVKNBody::g_renderBufferCount, i / SVKNBody::g_renderBufferCount), m_benchmark);
+
+	UpdateAndRecordFrame(frame, imageIndex);
+
+	std::vector<VkSemaphore> waitSemaphores;
+	std::vector<VkPipelineStageFlags> waitStages;
+	std::vector<VkSemaphore> signalSemaphores;
+	SubmitAsyncCompute(waitSemaphores, waitStages, signalSemaphores);
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+	submitInfo.pWaitSemaphores = waitSemaphores.data();
+	submitInfo.pWaitDstStageMask = waitStages.data();
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &m_commandBuffers[frame];
+	submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+	submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+	{
+		SVKBenchmark::ScopedTimer timer(m_benchmark, "cpu.submit");
+		vkCheckResult(vkResetFences(m_logicalDevice, 1, &m_inFlightFences[m_currentFrame]), "inFlight Fence Reset");
+		vkCheckResult(vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, m_inFlightFences[m_currentFrame]), "Queue Submit");
+		m_gpuProfiler.MarkSubmitted(frame);
+		if (m_nbody.IsAsyncCompute())
+			++m_asyncStep;
+	}
+
+	m_currentFrame = (m_currentFrame + 1) % m_config.m_framesInFlight;
+	++m_frameNumber;
+}
+
+void SVKApp::SubmitAsyncCompute(std::vector<VkSemaphore>& waitSemaphores, std::vector<VkPipelineStageFlags>& waitStages, std::vector<VkSemaphore>& signalSemaphores) {
+	if (!m_nbody.IsAsyncCompute())
+		return;
+
+	// step k writes render buffer k % 2 while the frame submitted next draws step k - 1 from the other one.
+	// Each semaphore pairs one step with one frame: frame k waits for step k - 1, step k + 1 waits until frame k
+	// released the buffer it drew. Step 0 and frame 0 start from the buffers set up by EnableAsyncCompute
+	uint32_t writeIndex = static_cast<uint32_t>(m_asyncStep % SVKNBody::g_renderBufferCount);
+	uint32_t renderIndex = GetRenderIndex();
+	uint32_t slot = GetComputeSlot(static_cast<uint32_t>(m_currentFrame), writeIndex, GetStepVariant());
+
+	VkPipelineStageFlags computeWaitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.waitSemaphoreCount = m_asyncStep > 0 ? 1 : 0;
+	submitInfo.pWaitSemaphores = &m_renderReleasedSemaphores[writeIndex];
+	submitInfo.pWaitDstStageMask = &computeWaitStage;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &m_computeCommandBuffers[slot];
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &m_computeFinishedSemaphores[writeIndex];
+
+	{
+		SVKBenchmark::ScopedTimer timer(m_benchmark, "cpu.submit");
+		vkCheckResult(vkResetFences(m_logicalDevice, 1, &m_computeFences[m_currentFrame]), "Compute Fence Reset");
+		vkCheckResult(vkQueueSubmit(m_computeQueue, 1, &submitInfo, m_computeFences[m_currentFrame]), "Compute Queue Submit");
+		m_computeProfiler.MarkSubmitted(slot);
+	}
+
+	if (m_asyncStep > 0) {
+		waitSemaphores.push_back(m_computeFinishedSemaphores[renderIndex]);
+		waitStages.push_back(VK_PIPELINE_STAGE_VERTEX_SHADER_BIT);
+	}
+	signalSemaphores.push_back(m_renderReleasedSemaphores[renderIndex]);
+}
+
+void SVKApp::UpdateUniformBuffer(uint32_t frame) {
+	// animation and simulation both follow the scheduler's clock, never the frame rate
+	float time = static_cast<float>(m_timestep.GetTime());
+	float deltaT = static_cast<float>(m_timestep.GetStepTime()) * SVKNBody::g_timeScale;
+	m_nbody.Update(frame, deltaT, m_timestep.GetFrameStepCount());
 
 	UniformBufferObject ubo{};
 	ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	ubo.proj = glm::perspective(glm::radians(45.0f), m_swapChainExtent.width / (float)m_swapChainExtent.height, 0.1f, 10.0f);
-	ubo.proj[1][1] *= -1;
+	GetCameraMatrices(ubo.view, ubo.proj);
 
-	void* data;
-	vkMapMemory(m_logicalDevice, m_uniformBuffersMemory[currentImage], 0, sizeof(ubo), 0, &data);
-	memcpy(data, &ubo, sizeof(ubo));
-	vkUnmapMemory(m_logicalDevice, m_uniformBuffersMemory[currentImage]);
+	// a step only adds deltaT * velocity to the positions, so moving back along the velocity is exactly
+	// the linear interpolation between the last two states
+	ubo.interpolationTime = (m_timestep.GetInterpolation() - 1.0f) * deltaT;
+
+	// the first block of a region lands at the region start, which is the offset recorded in the command buffer
+	m_uniformRing.BeginRegion(frame);
+	m_uniformRing.Push(&ubo, sizeof(ubo));
 }
 
-VkCommandBuffer SVKApp::BeginSingleTimeCommands() {
-	VkCommandBufferAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandPool = m_commandPool;
-	allocInfo.commandBufferCount = 1;
+void SVKApp::GetCameraMatrices(glm::mat4& view, glm::mat4& proj) const {
+	view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	proj = glm::perspective(glm::radians(45.0f), m_swapChainExtent.width / (float)m_swapChainExtent.height, 0.1f, 10.0f);
+	proj[1][1] *= -1;
+}
 
-	VkCommandBuffer commandBuffer;
-	vkAllocateCommandBuffers(m_logicalDevice, &allocInfo, &commandBuffer);
+void SVKApp::ValidateNBody() {
+	std::vector<SVKNBody::Particle> gpuParticles;
+	if (m_nbody.IsAsyncCompute())
+		m_nbody.ReadParticles(m_computeCommandPool, m_computeQueue, gpuParticles);
+	else
+		m_nbody.ReadParticles(m_commandPool, m_graphicsQueue, gpuParticles);
 
-	VkCommandBufferBeginInfo beginInfo{};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	SVKNBodyCpu reference;
+	reference.Initialize(SVKNBody::GenerateParticles(m_nbody.GetParticleCount()), m_nbody.GetKernelConstants(), m_jobSystem);
+
+	uint32_t stepCount = m_nbody.GetStepCount();
+	auto startTm = std::chrono::high_resolution_clock::now();
+	for (uint32_t step = 0; step < stepCount; ++step)
+		reference.Step(m_nbody.GetDeltaT());
+	std::chrono::duration<double, std::milli> referenceTm = std::chrono::high_resolution_clock::now() - startTm;
+
+	if (stepCount > 0) {
+		double stepMs = referenceTm.count() / stepCount;
+		double interactionsPerSecond = reference.GetInteractionsPerStep() / (stepMs / 1000.0);
+		std::cerr << "N-body CPU: " << reference.GetThreadCount() << " threads, " << SVKNBodyCpu::GetInstructionSet() << ", " << stepMs << " ms/step, "
+			<< (interactionsPerSecond / 1e9) << " G interactions/s, " << (interactionsPerSecond * SVKNBodyCpu::g_flopsPerInteraction / 1e9) << " GFLOP/s" << std::endl;
+	}
+
+	std::vector<SVKNBody::Particle> cpuParticles;
+	reference.GetParticles(cpuParticles);
 
-	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	// the system is chaotic, so the difference grows with the step count; validate short runs
+	double error = SVKNBodyCpu::ComputeRelativeError(cpuParticles, gpuParticles);
+	bool passed = error <= SVKNBodyCpu::g_validationTolerance;
+	std::cerr << "N-body validation (" << SVKNBody::GetModeName(m_nbody.GetMode()) << ") after " << stepCount << " steps: relative position error " << error
+		<< " (tolerance " << SVKNBodyCpu::g_validationTolerance << "): " << (passed ? "passed" : "FAILED") << std::endl;
 
-	return commandBuffer;
+	if (!passed)
+		throw std::runtime_error("N-body GPU results differ from the CPU reference");
 }
 
-void SVKApp::EndSingleTimeCommands(VkCommandBuffer commandBuffer) {
-	vkEndCommandBuffer(commandBuffer);
+void SVKApp::SaveCheckpoint() {
+	if (m_config.m_checkpointPath.empty() || !m_nbody.IsEnabled())
+		return;
 
-	VkSubmitInfo submitInfo{};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
+	std::vector<SVKNBody::Particle> particles;
+	if (m_nbody.IsAsyncCompute())
+		m_nbody.ReadParticles(m_computeCommandPool, m_computeQueue, particles);
+	else
+		m_nbody.ReadParticles(m_commandPool, m_graphicsQueue, particles);
 
-	vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(m_graphicsQueue);
+	SVKCheckpoint::Write(m_config.m_checkpointPath, m_nbody, particles);
+	std::cerr << "Checkpoint: saved " << particles.size() << " particles at step " << m_nbody.GetStepCount() << " to '" << m_config.m_checkpointPath.string() << '\'' << std::endl;
+}
+
+uint32_t SVKApp::GetComputeSlot(uint32_t frame, uint32_t writeIndex, uint32_t stepCount) const {
+	return (stepCount * m_config.m_framesInFlight + frame) * SVKNBody::g_renderBufferCount + writeIndex;
+}
+
+uint32_t SVKApp::GetStepVariantCount() const {
+	// decided by the configuration, the profilers are created before the simulation
+	return m_config.m_particleCount > 0 ? m_timestep.GetMaxStepCount() + 1 : 1;
+}
+
+uint32_t SVKApp::GetStepVariant() const {
+	return GetStepVariantCount() > 1 ? m_timestep.GetFrameStepCount() : 0;
+}
+
+uint32_t SVKApp::GetRenderBufferCount() const {
+	return m_asyncCompute ? SVKNBody::g_renderBufferCount : 1;
+}
 
-	vkFreeCommandBuffers(m_logicalDevice, m_commandPool, 1, &commandBuffer);
+uint32_t SVKApp::GetRenderIndex() const {
+	// the frame draws the result of the previous step
+	return m_asyncCompute ? static_cast<uint32_t>((m_asyncStep + 1) % SVKNBody::g_renderBufferCount) : 0;
 }
 
 
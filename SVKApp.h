@@ -3,6 +3,19 @@
 #include "common.h"
 
 #include "SVKConfig.h"
+#include "SVKBenchmark.h"
+#include "SVKGpuProfiler.h"
+#include "SVKMemoryAllocator.h"
+#include "SVKUniformRing.h"
+#include "SVKUploadContext.h"
+#include "SVKPipelineCache.h"
+#include "SVKNBody.h"
+#include "SVKParticleRenderer.h"
+#include "SVKInstanceRenderer.h"
+#include "SVKBatchRunner.h"
+#include "SVKFixedTimestep.h"
+#include "SVKCommandRecorder.h"
+#include "SVKJobSystem.h"
 
 class SVKApp
 {
@@ -10,12 +23,22 @@ protected:
 	struct QueueFamilyIndices {
 		std::optional<uint32_t> graphicsFamily;
 		std::optional<uint32_t> presentFamily;
+		std::optional<uint32_t> transferFamily;
+		std::optional<uint32_t> computeFamily;
 
-		bool IsComplete() {
-			return graphicsFamily.has_value() && presentFamily.has_value();
+		bool IsComplete(bool presentRequired) {
+			return graphicsFamily.has_value() && (presentFamily.has_value() || !presentRequired);
 		}
 	};
 
+	// swapchain resources replaced by a resize, destroyed once no frame in flight can use them
+	struct RetiredSwapChain {
+		uint64_t retiredFrame;
+		VkSwapchainKHR swapChain;
+		std::vector<VkImageView> imageViews;
+		std::vector<VkFramebuffer> frameBuffers;
+	};
+
 	struct SwapChainSupportDetails {
 		VkSurfaceCapabilitiesKHR capabilities;
 		std::vector<VkSurfaceFormatKHR> formats;
@@ -34,6 +57,7 @@ protected:
 		alignas(16) glm::mat4 model;
 		alignas(16) glm::mat4 view;
 		alignas(16) glm::mat4 proj;
+		float interpolationTime;	// particle.vert: positions move by this times the velocity
 	};
 
 public:
@@ -44,7 +68,10 @@ public:
 	static const bool g_enableValidationLayers;
 	static const std::vector<const char*> g_validationLayers;
 	static const std::vector<const char*> g_deviceExtensions;
-	static const int g_maxFramesInFlight;
+	static const int g_offscreenImageCount;
+	static const VkFormat g_offscreenImageFormat;
+	static const uint32_t g_maxGpuProfilerScopes;
+	static const VkDeviceSize g_uniformRegionSize;
 	static const std::vector<SVKApp::Vertex> g_vertices;
 	static const std::vector<uint16_t> g_indices;
 
@@ -73,6 +100,7 @@ public:
 	void Initialize();
 	void Cleanup();
 	void Run();
+	void RunBatch();
 
 protected:
 	void InitializeWindow();
@@ -89,18 +117,23 @@ protected:
 	void CreateSurface();
 
 	void PickPhysicalDevice();
+	std::vector<const char*> GetRequiredDeviceExtensions();
 	bool IsPhysicalDeviceExtensionSupport(VkPhysicalDevice physicalDevice, const std::vector<const char*> extensions);
 	bool IsPhysicalDeviceSuitable(VkPhysicalDevice physicalDevice);
 	int GetPhysicalDeviceScore(VkPhysicalDevice physicalDevice);
+	// vendor and device ID instead for Vulkan 1.0 devices, which do not report a UUID
+	std::string GetPhysicalDeviceUUID(VkPhysicalDevice physicalDevice);
 	QueueFamilyIndices FindQueueFamilyIndices(VkPhysicalDevice physicalDevice);
 	SwapChainSupportDetails FindSwapChainSupportDetails(VkPhysicalDevice physicalDevice);
 
 	void CreateLogicalDevice();
+	void CreatePipelineCache();
 
 	void CreateSwapChain();
 	VkSurfaceFormatKHR ChooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);
 	VkPresentModeKHR ChooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes);
 	VkExtent2D ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities);
+	void CreateOffscreenTargets();
 
 	void CreateImageViews();
 	void CreateRenderPass();
@@ -111,7 +144,11 @@ protected:
 
 	void CreateFrameBuffers();
 	void CreateCommandPool();
+	void CreateUploadContext();
+	void CreateGpuProfiler();
+	void CreateKernelTuner();
 	
+	void DecodeTextureImage();
 	void CreateTextureImage();
 	void CreateImage(
 		uint32_t width, 
@@ -121,33 +158,34 @@ protected:
 		VkImageUsageFlags usage, 
 		VkMemoryPropertyFlags properties, 
 		VkImage& image, 
-		VkDeviceMemory& imageMemory
-	);
-	void TransitionImageLayout(
-		VkImage image,
-		VkFormat format,
-		VkImageLayout oldLayout,
-		VkImageLayout newLayout
+		SVKMemoryAllocator::Allocation& imageAllocation
 	);
-	void CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
 
 	void CreateVertexBuffer();
 	void CreateIndexBuffer();
 	void CreateUniformBuffers();
+	void CreateNBody();
+	void CreateParticleRenderer();
+	void CreateInstanceRenderer(SVKInstanceRenderer::Culling culling);
+	void CreateAsyncCompute();
+	void CreateBatchRunner();
 
 	void CreateBuffer(
 		VkDeviceSize size, 
 		VkBufferUsageFlags usage, 
 		VkMemoryPropertyFlags properties, 
 		VkBuffer& buffer, 
-		VkDeviceMemory& bufferMemory
+		SVKMemoryAllocator::Allocation& bufferAllocation,
+		SVKMemoryAllocator::Strategy strategy
 	);
-	void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
-	uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
 
 	void CreateDescriptorPool();
 	void CreateDescriptorSets();
 	void CreateCommandBuffers();
+	void UpdateAndRecordFrame(uint32_t frame, uint32_t imageIndex);
+	void RecordFrame(uint32_t frame, uint32_t imageIndex);
+	void RecordDraws(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t renderIndex, uint32_t firstDraw, uint32_t drawCount);
+	void CreateComputeCommandBuffers();
 	void CreateSyncObjects();
 
 	void CleanupVulkan();
@@ -155,11 +193,25 @@ protected:
 
 	void CleanupSwapChain();
 	void RecreateSwapChain();
+	void RetireSwapChain();
+	void DestroyRetiredSwapChains(bool force);
+	void WaitForFramesInFlight();
 
+	void RunFrame();
+	uint32_t MeasureThreadSweep();
+	uint32_t MeasureCpuCulling(SVKBenchmark::Statistics& cpuInstances, SVKBenchmark::Statistics& cpuRecord);
 	void DrawFrame();
-	void UpdateUniformBuffer(uint32_t currentImage);
-	VkCommandBuffer BeginSingleTimeCommands();
-	void EndSingleTimeCommands(VkCommandBuffer commandBuffer);
+	void DrawFrameHeadless();
+	void SubmitAsyncCompute(std::vector<VkSemaphore>& waitSemaphores, std::vector<VkPipelineStageFlags>& waitStages, std::vector<VkSemaphore>& signalSemaphores);
+	void UpdateUniformBuffer(uint32_t frame);
+	void GetCameraMatrices(glm::mat4& view, glm::mat4& proj) const;
+	void ValidateNBody();
+	void SaveCheckpoint();
+	uint32_t GetComputeSlot(uint32_t frame, uint32_t writeIndex, uint32_t stepCount) const;
+	uint32_t GetStepVariantCount() const;
+	uint32_t GetStepVariant() const;
+	uint32_t GetRenderBufferCount() const;
+	uint32_t GetRenderIndex() const;
 
 	bool OnDebug(
 		VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
@@ -179,8 +231,15 @@ protected:
 	VkDevice m_logicalDevice;
 	VkQueue m_graphicsQueue;
 	VkQueue m_presentQueue;
+	VkQueue m_transferQueue;
+	VkQueue m_computeQueue;
+	bool m_asyncCompute;
+	bool m_fullSubgroups;	// VK_EXT_subgroup_size_control enabled with computeFullSubgroups
+	SVKMemoryAllocator m_memoryAllocator;
 	VkSwapchainKHR m_swapChain;
 	std::vector<VkImage> m_swapChainImages;
+	std::vector<SVKMemoryAllocator::Allocation> m_offscreenImageAllocations;
+	uint32_t m_offscreenImageIndex;
 	VkFormat m_swapChainImageFormat;
 	VkExtent2D m_swapChainExtent;
 	std::vector<VkImageView> m_swapChainImageViews;
@@ -188,24 +247,53 @@ protected:
 	VkDescriptorSetLayout m_descriptorSetLayout;
 	VkPipelineLayout m_pipelineLayout;
 	VkPipeline m_graphicsPipeline;
+	SVKPipelineCache m_pipelineCache;
 	std::vector<VkFramebuffer> m_swapChainFrameBuffers;
 	VkCommandPool m_commandPool;
+	VkCommandPool m_computeCommandPool;
+	SVKUploadContext m_uploadContext;
+	SVKJobSystem::Counter m_textureDecoded;
+	stbi_uc* m_texturePixels;
+	int m_textureWidth;
+	int m_textureHeight;
 	VkImage m_textureImage;
-	VkDeviceMemory m_textureImageMemory;
+	SVKMemoryAllocator::Allocation m_textureImageAllocation;
 	VkBuffer m_vertexBuffer;
-	VkDeviceMemory m_vertexBufferMemory;
+	SVKMemoryAllocator::Allocation m_vertexBufferAllocation;
 	VkBuffer m_indexBuffer;
-	VkDeviceMemory m_indexBufferMemory;
-	std::vector<VkBuffer> m_uniformBuffers;
-	std::vector<VkDeviceMemory> m_uniformBuffersMemory;
+	SVKMemoryAllocator::Allocation m_indexBufferAllocation;
+	SVKUniformRing m_uniformRing;
+	SVKNBody m_nbody;
+	SVKParticleRenderer m_particleRenderer;
+	SVKInstanceRenderer m_instanceRenderer;
+	SVKKernelTuner m_kernelTuner;
+	SVKBatchRunner m_batchRunner;
+	SVKFixedTimestep m_timestep;
 	VkDescriptorPool m_descriptorPool;
 	std::vector<VkDescriptorSet> m_descriptorSets;
-	std::vector<VkCommandBuffer> m_commandBuffers;
+	std::vector<VkCommandPool> m_frameCommandPools;
+	std::vector<VkCommandBuffer> m_commandBuffers;	// per frame in flight
+	SVKCommandRecorder m_commandRecorder;
+	std::vector<std::vector<VkCommandBuffer>> m_secondaryCommandBuffers;	// of the frame being recorded, executed in order
 	std::vector<VkSemaphore> m_imageAvailableSemaphores;
 	std::vector<VkSemaphore> m_renderFinishedSemaphores;
 	std::vector<VkFence> m_inFlightFences;
 	std::vector<VkFence> m_imagesInFlight;
+	std::vector<VkCommandBuffer> m_computeCommandBuffers;
+	std::vector<VkSemaphore> m_computeFinishedSemaphores;
+	std::vector<VkSemaphore> m_renderReleasedSemaphores;
+	std::vector<VkFence> m_computeFences;
+	uint64_t m_asyncStep;
 	size_t m_currentFrame;
+	uint64_t m_frameNumber;
 	bool m_framebufferResized;
+	std::vector<RetiredSwapChain> m_retiredSwapChains;
+
+	SVKBenchmark m_benchmark;
+	SVKGpuProfiler m_gpuProfiler;
+	SVKGpuProfiler m_computeProfiler;
+
+	// last, so its threads finish their jobs before anything they use is destroyed
+	SVKJobSystem m_jobSystem;
 };
 
@@ -0,0 +1,201 @@
+#include "SVKBatchRunner.h"
+
+const uint32_t SVKBatchRunner::g_submissionCount = 3;
+
+// one more than the submissions in flight, so the buffer a new snapshot goes to has
+// normally been written while the GPU ran the submissions in between
+const uint32_t SVKBatchRunner::g_stagingBufferCount = 4;
+
+SVKBatchRunner::SVKBatchRunner() :
+	m_logicalDevice(VK_NULL_HANDLE),
+	m_memoryAllocator(nullptr),
+	m_queue(VK_NULL_HANDLE),
+	m_nbody(nullptr),
+	m_commandPool(VK_NULL_HANDLE),
+	m_baseStepCount(0),
+	m_completedStepCount(0)
+{
+}
+
+void SVKBatchRunner::Initialize(
+	VkDevice logicalDevice,
+	SVKMemoryAllocator& memoryAllocator,
+	uint32_t queueFamilyIndex,
+	VkQueue queue,
+	SVKNBody& nbody
+) {
+	m_logicalDevice = logicalDevice;
+	m_memoryAllocator = &memoryAllocator;
+	m_queue = queue;
+	m_nbody = &nbody;
+	m_completedStepCount = 0;
+
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+	vkCheckResult(vkCreateCommandPool(m_logicalDevice, &poolInfo, nullptr, &m_commandPool), "Create Batch CommandPool");
+
+	std::vector<VkCommandBuffer> commandBuffers(g_submissionCount);
+
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = m_commandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = g_submissionCount;
+
+	vkCheckResult(vkAllocateCommandBuffers(m_logicalDevice, &allocInfo, commandBuffers.data()), "Allocate Batch CommandBuffers");
+
+	VkFenceCreateInfo fenceInfo{};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+	m_submissions.resize(g_submissionCount);
+	for (uint32_t i = 0; i < g_submissionCount; ++i) {
+		Submission& submission = m_submissions[i];
+		submission.commandBuffer = commandBuffers[i];
+		submission.endStep = 0;
+		submission.stagingIndex = g_stagingBufferCount;
+		submission.pending = false;
+		vkCheckResult(vkCreateFence(m_logicalDevice, &fenceInfo, nullptr, &submission.fence), "Create Batch Fence");
+	}
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = sizeof(SVKNBody::Particle) * static_cast<VkDeviceSize>(m_nbody->GetParticleCount());
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	m_stagingBuffers.resize(g_stagingBufferCount);
+	for (StagingBuffer& stagingBuffer : m_stagingBuffers) {
+		vkCheckResult(vkCreateBuffer(m_logicalDevice, &bufferInfo, nullptr, &stagingBuffer.buffer), "Create Batch Staging Buffer");
+
+		VkMemoryRequirements memRequirements;
+		vkGetBufferMemoryRequirements(m_logicalDevice, stagingBuffer.buffer, &memRequirements);
+
+		stagingBuffer.allocation = m_memoryAllocator->Allocate(memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, SVKMemoryAllocator::Strategy::Linear, false);
+		vkCheckResult(vkBindBufferMemory(m_logicalDevice, stagingBuffer.buffer, stagingBuffer.allocation.memory, stagingBuffer.allocation.offset), "Bind Batch Staging Memory");
+		stagingBuffer.writeTicket = 0;
+	}
+}
+
+void SVKBatchRunner::Cleanup() {
+	if (m_logicalDevice == VK_NULL_HANDLE)
+		return;
+
+	for (StagingBuffer& stagingBuffer : m_stagingBuffers) {
+		vkDestroyBuffer(m_logicalDevice, stagingBuffer.buffer, nullptr);
+		m_memoryAllocator->Free(stagingBuffer.allocation);
+	}
+	m_stagingBuffers.clear();
+
+	for (Submission& submission : m_submissions)
+		vkDestroyFence(m_logicalDevice, submission.fence, nullptr);
+	m_submissions.clear();
+
+	// frees the command buffers
+	vkDestroyCommandPool(m_logicalDevice, m_commandPool, nullptr);
+	m_commandPool = VK_NULL_HANDLE;
+
+	m_nbody = nullptr;
+	m_queue = VK_NULL_HANDLE;
+	m_memoryAllocator = nullptr;
+	m_logicalDevice = VK_NULL_HANDLE;
+}
+
+void SVKBatchRunner::Run(uint32_t stepCount, uint32_t stepsPerSubmit, uint32_t snapshotInterval, SVKSnapshotWriter& writer) {
+	auto startTm = std::chrono::high_resolution_clock::now();
+	auto prevTm = startTm;
+	uint32_t prevStepCount = 0;
+
+	uint32_t recordedStepCount = 0;
+	uint32_t submissionIndex = 0;
+	uint32_t stagingIndex = 0;
+	m_completedStepCount = 0;
+
+	// a restored simulation continues the step numbering of its checkpoint
+	m_baseStepCount = m_nbody->GetStepCount();
+
+	// the first submission only reads back the initial state
+	bool initial = true;
+	while (initial || recordedStepCount < stepCount) {
+		uint32_t slot = submissionIndex % g_submissionCount;
+		Submission& submission = m_submissions[slot];
+		if (submission.pending)
+			Retire(submission, writer);
+
+		// a submission ends at the next snapshot, so the readback sees exactly that step
+		uint32_t steps = 0;
+		if (!initial) {
+			steps = std::min(stepsPerSubmit, stepCount - recordedStepCount);
+			if (snapshotInterval > 0)
+				steps = std::min(steps, snapshotInterval - recordedStepCount % snapshotInterval);
+		}
+		recordedStepCount += steps;
+		bool snapshot = initial || recordedStepCount == stepCount || (snapshotInterval > 0 && recordedStepCount % snapshotInterval == 0);
+		initial = false;
+
+		vkCheckResult(vkResetCommandBuffer(submission.commandBuffer, 0), "Reset Batch CommandBuffer");
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		vkCheckResult(vkBeginCommandBuffer(submission.commandBuffer, &beginInfo), "Begin Batch Commands");
+		if (steps > 0) {
+			m_nbody->Update(slot, SVKNBody::g_fixedDeltaT, steps);
+			m_nbody->RecordSteps(submission.commandBuffer, slot, steps);
+		}
+		submission.stagingIndex = g_stagingBufferCount;
+		if (snapshot) {
+			// the only place the simulation waits for the disk
+			StagingBuffer& stagingBuffer = m_stagingBuffers[stagingIndex];
+			writer.Wait(stagingBuffer.writeTicket);
+			m_nbody->RecordReadback(submission.commandBuffer, stagingBuffer.buffer);
+			submission.stagingIndex = stagingIndex;
+			stagingIndex = (stagingIndex + 1) % g_stagingBufferCount;
+		}
+		vkCheckResult(vkEndCommandBuffer(submission.commandBuffer), "End Batch Commands");
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &submission.commandBuffer;
+
+		vkCheckResult(vkQueueSubmit(m_queue, 1, &submitInfo, submission.fence), "Submit Batch Commands");
+		submission.endStep = recordedStepCount;
+		submission.pending = true;
+		++submissionIndex;
+
+		auto currTm = std::chrono::high_resolution_clock::now();
+		std::chrono::duration<double> diffPrevTm = currTm - prevTm;
+		if (diffPrevTm.count() > 1.0) {
+			std::chrono::duration<double> diffStartTm = currTm - startTm;
+			std::cerr << "Batch [" << int(diffStartTm.count()) << "] step " << m_completedStepCount << " / " << stepCount
+				<< ", steps/s: " << ((m_completedStepCount - prevStepCount) / diffPrevTm.count()) << ", snapshots: " << writer.GetSnapshotCount() << std::endl;
+			prevTm = currTm;
+			prevStepCount = m_completedStepCount;
+		}
+	}
+
+	// retire in submission order, the writer expects the snapshots sorted by step
+	for (uint32_t i = 0; i < g_submissionCount; ++i) {
+		Submission& submission = m_submissions[(submissionIndex + i) % g_submissionCount];
+		if (submission.pending)
+			Retire(submission, writer);
+	}
+}
+
+void SVKBatchRunner::Retire(Submission& submission, SVKSnapshotWriter& writer) {
+	vkCheckResult(vkWaitForFences(m_logicalDevice, 1, &submission.fence, VK_TRUE, UINT64_MAX), "Wait Batch Fence");
+	vkCheckResult(vkResetFences(m_logicalDevice, 1, &submission.fence), "Reset Batch Fence");
+	submission.pending = false;
+	m_completedStepCount = submission.endStep;
+
+	if (submission.stagingIndex == g_stagingBufferCount)
+		return;
+
+	StagingBuffer& stagingBuffer = m_stagingBuffers[submission.stagingIndex];
+	m_memoryAllocator->InvalidateAllocation(stagingBuffer.allocation, 0, sizeof(SVKNBody::Particle) * static_cast<VkDeviceSize>(m_nbody->GetParticleCount()));
+	stagingBuffer.writeTicket = writer.Enqueue(m_baseStepCount + submission.endStep, static_cast<const SVKNBody::Particle*>(stagingBuffer.allocation.mappedData));
+}
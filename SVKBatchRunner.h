@@ -0,0 +1,63 @@
+#pragma once
+
+#include "common.h"
+
+#include "SVKMemoryAllocator.h"
+#include "SVKNBody.h"
+#include "SVKSnapshotWriter.h"
+
+// Offline N-body simulation without rendering. Each submission records up to
+// stepsPerSubmit steps; a few submissions stay in flight, so the CPU records the
+// next batch while the GPU runs the previous ones. Snapshots are copied into a
+// ring of host visible staging buffers and handed to the snapshot writer when
+// their submission retires; a staging buffer is reused only after the writer
+// has written it, so the GPU only stalls when the disk falls behind by more than
+// the whole ring.
+class SVKBatchRunner
+{
+public:
+	static const uint32_t g_submissionCount;
+	static const uint32_t g_stagingBufferCount;
+
+public:
+	SVKBatchRunner();
+
+	void Initialize(
+		VkDevice logicalDevice,
+		SVKMemoryAllocator& memoryAllocator,
+		uint32_t queueFamilyIndex,
+		VkQueue queue,
+		SVKNBody& nbody
+	);
+	void Cleanup();
+
+	void Run(uint32_t stepCount, uint32_t stepsPerSubmit, uint32_t snapshotInterval, SVKSnapshotWriter& writer);
+
+protected:
+	struct Submission {
+		VkCommandBuffer commandBuffer;
+		VkFence fence;
+		uint32_t endStep;
+		uint32_t stagingIndex;	// g_stagingBufferCount when the submission takes no snapshot
+		bool pending;
+	};
+
+	struct StagingBuffer {
+		VkBuffer buffer;
+		SVKMemoryAllocator::Allocation allocation;
+		uint64_t writeTicket;	// writer ticket of the last snapshot read from this buffer
+	};
+
+	void Retire(Submission& submission, SVKSnapshotWriter& writer);
+
+protected:
+	VkDevice m_logicalDevice;
+	SVKMemoryAllocator* m_memoryAllocator;
+	VkQueue m_queue;
+	SVKNBody* m_nbody;
+	VkCommandPool m_commandPool;
+	std::vector<Submission> m_submissions;
+	std::vector<StagingBuffer> m_stagingBuffers;
+	uint32_t m_baseStepCount;
+	uint32_t m_completedStepCount;
+};
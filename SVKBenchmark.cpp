@@ -0,0 +1,280 @@
+#include "SVKBenchmark.h"
+
+#include <cmath>
+
+// a series that is not recorded in a frame gets no sample for it, but keeps its place in the frame order
+static const double g_noSample = std::numeric_limits<double>::quiet_NaN();
+
+static void WriteJsonString(std::ostream& os, const std::string& str) {
+	os << '"';
+	for (char c : str) {
+		switch (c) {
+		case '"': os << "\\\""; break;
+		case '\\': os << "\\\\"; break;
+		case '\n': os << "\\n"; break;
+		case '\r': os << "\\r"; break;
+		case '\t': os << "\\t"; break;
+		default:
+			if (static_cast<unsigned char>(c) < 0x20)
+				os << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec << std::setfill(' ');
+			else
+				os << c;
+		}
+	}
+	os << '"';
+}
+
+static double Percentile(const std::vector<double>& sorted, double percent) {
+	if (sorted.empty())
+		return 0.0;
+
+	double rank = percent / 100.0 * static_cast<double>(sorted.size() - 1);
+	size_t lower = static_cast<size_t>(rank);
+	size_t upper = std::min(lower + 1, sorted.size() - 1);
+	double fraction = rank - static_cast<double>(lower);
+	return sorted[lower] + (sorted[upper] - sorted[lower]) * fraction;
+}
+
+// *********************************************************************************
+
+SVKBenchmark::ScopedTimer::ScopedTimer(SVKBenchmark& benchmark, const char* series) :
+	m_benchmark(benchmark),
+	m_series(series),
+	m_startTm(std::chrono::high_resolution_clock::now())
+{
+}
+
+SVKBenchmark::ScopedTimer::~ScopedTimer() {
+	std::chrono::duration<double, std::milli> diffTm = std::chrono::high_resolution_clock::now() - m_startTm;
+	m_benchmark.Record(m_series, diffTm.count());
+}
+
+SVKBenchmark::Statistics SVKBenchmark::ComputeStatistics(std::vector<double> samples) {
+	samples.erase(std::remove_if(samples.begin(), samples.end(), [](double sample) { return std::isnan(sample); }), samples.end());
+
+	Statistics statistics{};
+	statistics.count = samples.size();
+	if (samples.empty())
+		return statistics;
+
+	std::sort(samples.begin(), samples.end());
+
+	double sum = 0.0;
+	for (double sample : samples)
+		sum += sample;
+
+	statistics.min = samples.front();
+	statistics.mean = sum / static_cast<double>(samples.size());
+	statistics.p50 = Percentile(samples, 50.0);
+	statistics.p95 = Percentile(samples, 95.0);
+	statistics.p99 = Percentile(samples, 99.0);
+	statistics.max = samples.back();
+
+	return statistics;
+}
+
+// *********************************************************************************
+
+SVKBenchmark::SVKBenchmark() :
+	m_warmupFrameCount(0),
+	m_measuredFrameCount(0),
+	m_frameIndex(0)
+{
+}
+
+void SVKBenchmark::Configure(uint32_t warmupFrameCount, uint32_t measuredFrameCount) {
+	m_warmupFrameCount = warmupFrameCount;
+	m_measuredFrameCount = measuredFrameCount;
+	m_frameIndex = 0;
+
+	m_currentFrame.assign(m_seriesNames.size(), g_noSample);
+	for (std::vector<double>& samples : m_samples) {
+		samples.clear();
+		samples.reserve(measuredFrameCount);
+	}
+}
+
+void SVKBenchmark::SetMetadata(const std::string& key, const std::string& value) {
+	for (std::pair<std::string, std::string>& entry : m_metadata)
+		if (entry.first == key) {
+			entry.second = value;
+			return;
+		}
+	m_metadata.emplace_back(key, value);
+}
+
+void SVKBenchmark::BeginFrame() {
+	std::fill(m_currentFrame.begin(), m_currentFrame.end(), g_noSample);
+}
+
+void SVKBenchmark::Record(const std::string& series, double milliseconds) {
+	double& sample = m_currentFrame[GetSeriesIndex(series)];
+	sample = std::isnan(sample) ? milliseconds : sample + milliseconds;
+}
+
+void SVKBenchmark::EndFrame() {
+	// without Configure() interactive runs keep neither samples nor a frame count
+	if (m_measuredFrameCount == 0)
+		return;
+
+	if (IsMeasuring())
+		for (size_t i = 0; i < m_samples.size(); ++i) {
+			// series first seen after measuring started have no samples for the frames before
+			m_samples[i].resize(m_frameIndex - m_warmupFrameCount, g_noSample);
+			m_samples[i].push_back(m_currentFrame[i]);
+		}
+
+	++m_frameIndex;
+}
+
+bool SVKBenchmark::IsMeasuring() const {
+	return m_measuredFrameCount > 0 && m_frameIndex >= m_warmupFrameCount && !IsComplete();
+}
+
+bool SVKBenchmark::IsComplete() const {
+	return m_measuredFrameCount > 0 && m_frameIndex >= GetTotalFrameCount();
+}
+
+uint32_t SVKBenchmark::GetTotalFrameCount() const {
+	return m_warmupFrameCount + m_measuredFrameCount;
+}
+
+bool SVKBenchmark::GetStatistics(const std::string& series, Statistics& statistics) const {
+	auto it = m_seriesIndices.find(series);
+	if (it == m_seriesIndices.end())
+		return false;
+
+	statistics = ComputeStatistics(m_samples[it->second]);
+	return statistics.count > 0;
+}
+
+void SVKBenchmark::PrintSummary(std::ostream& os) const {
+	os << "Benchmark: " << m_warmupFrameCount << " warm-up frames, " << m_measuredFrameCount << " measured frames (ms)" << std::endl;
+	os << std::fixed << std::setprecision(3);
+	os << '\t' << std::left << std::setw(24) << "series" << std::right
+		<< std::setw(10) << "min" << std::setw(10) << "mean" << std::setw(10) << "p50"
+		<< std::setw(10) << "p95" << std::setw(10) << "p99" << std::setw(10) << "max" << std::endl;
+	for (size_t i = 0; i < m_seriesNames.size(); ++i) {
+		Statistics statistics = ComputeStatistics(m_samples[i]);
+		os << '\t' << std::left << std::setw(24) << m_seriesNames[i] << std::right
+			<< std::setw(10) << statistics.min << std::setw(10) << statistics.mean << std::setw(10) << statistics.p50
+			<< std::setw(10) << statistics.p95 << std::setw(10) << statistics.p99 << std::setw(10) << statistics.max << std::endl;
+	}
+	os << std::defaultfloat;
+}
+
+void SVKBenchmark::Write(const std::filesystem::path& path) const {
+	std::ofstream file(path, std::ios::out | std::ios::trunc);
+	if (!file.is_open()) {
+		std::stringstream ss;
+		ss << "Failed to open file: '" << path.string() << '\'';
+		throw std::runtime_error(ss.str());
+	}
+
+	if (path.extension() == ".csv")
+		WriteCsv(file);
+	else
+		WriteJson(file);
+}
+
+void SVKBenchmark::WriteJson(std::ostream& os) const {
+	os << std::setprecision(9);
+	os << "{" << std::endl;
+
+	os << "\t\"metadata\": {";
+	for (size_t i = 0; i < m_metadata.size(); ++i) {
+		os << (i == 0 ? "" : ",") << std::endl << "\t\t";
+		WriteJsonString(os, m_metadata[i].first);
+		os << ": ";
+		WriteJsonString(os, m_metadata[i].second);
+	}
+	os << std::endl << "\t}," << std::endl;
+
+	os << "\t\"warmupFrames\": " << m_warmupFrameCount << "," << std::endl;
+	os << "\t\"measuredFrames\": " << m_measuredFrameCount << "," << std::endl;
+	os << "\t\"unit\": \"ms\"," << std::endl;
+
+	os << "\t\"series\": {";
+	for (size_t i = 0; i < m_seriesNames.size(); ++i) {
+		Statistics statistics = ComputeStatistics(m_samples[i]);
+
+		os << (i == 0 ? "" : ",") << std::endl << "\t\t";
+		WriteJsonString(os, m_seriesNames[i]);
+		os << ": {" << std::endl;
+		os << "\t\t\t\"count\": " << statistics.count << "," << std::endl;
+		os << "\t\t\t\"min\": " << statistics.min << "," << std::endl;
+		os << "\t\t\t\"mean\": " << statistics.mean << "," << std::endl;
+		os << "\t\t\t\"p50\": " << statistics.p50 << "," << std::endl;
+		os << "\t\t\t\"p95\": " << statistics.p95 << "," << std::endl;
+		os << "\t\t\t\"p99\": " << statistics.p99 << "," << std::endl;
+		os << "\t\t\t\"max\": " << statistics.max << "," << std::endl;
+		os << "\t\t\t\"samples\": [";
+		for (size_t j = 0; j < m_samples[i].size(); ++j) {
+			os << (j == 0 ? "" : ", ");
+			if (std::isnan(m_samples[i][j]))
+				os << "null";
+			else
+				os << m_samples[i][j];
+		}
+		os << "]" << std::endl;
+		os << "\t\t}";
+	}
+	os << std::endl << "\t}" << std::endl;
+
+	os << "}" << std::endl;
+}
+
+void SVKBenchmark::WriteCsv(std::ostream& os) const {
+	os << std::setprecision(9);
+
+	os << "frame";
+	for (const std::string& name : m_seriesNames)
+		os << ',' << name;
+	os << std::endl;
+
+	size_t frameCount = 0;
+	for (const std::vector<double>& samples : m_samples)
+		frameCount = std::max(frameCount, samples.size());
+
+	for (size_t j = 0; j < frameCount; ++j) {
+		os << j;
+		for (const std::vector<double>& samples : m_samples) {
+			os << ',';
+			if (j < samples.size() && !std::isnan(samples[j]))
+				os << samples[j];
+		}
+		os << std::endl;
+	}
+
+	std::vector<Statistics> statistics;
+	for (const std::vector<double>& samples : m_samples)
+		statistics.push_back(ComputeStatistics(samples));
+
+	const std::pair<const char*, double Statistics::*> rows[] = {
+		{ "min", &Statistics::min },
+		{ "mean", &Statistics::mean },
+		{ "p50", &Statistics::p50 },
+		{ "p95", &Statistics::p95 },
+		{ "p99", &Statistics::p99 },
+		{ "max", &Statistics::max }
+	};
+	for (const auto& row : rows) {
+		os << row.first;
+		for (const Statistics& stat : statistics)
+			os << ',' << stat.*row.second;
+		os << std::endl;
+	}
+}
+
+size_t SVKBenchmark::GetSeriesIndex(const std::string& series) {
+	auto it = m_seriesIndices.find(series);
+	if (it != m_seriesIndices.end())
+		return it->second;
+
+	size_t index = m_seriesNames.size();
+	m_seriesNames.push_back(series);
+	m_seriesIndices[series] = index;
+	m_currentFrame.push_back(g_noSample);
+	m_samples.emplace_back();
+	return index;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "common.h"
+
+class SVKBenchmark
+{
+public:
+	struct Statistics {
+		size_t count;
+		double min;
+		double mean;
+		double p50;
+		double p95;
+		double p99;
+		double max;
+	};
+
+	class ScopedTimer
+	{
+	public:
+		ScopedTimer(SVKBenchmark& benchmark, const char* series);
+		~ScopedTimer();
+
+	protected:
+		SVKBenchmark& m_benchmark;
+		const char* m_series;
+		std::chrono::high_resolution_clock::time_point m_startTm;
+	};
+
+	static Statistics ComputeStatistics(std::vector<double> samples);
+
+public:
+	SVKBenchmark();
+
+	void Configure(uint32_t warmupFrameCount, uint32_t measuredFrameCount);
+	void SetMetadata(const std::string& key, const std::string& value);
+
+	void BeginFrame();
+	void Record(const std::string& series, double milliseconds);
+	void EndFrame();
+
+	// false until Configure() has set a measured frame count
+	bool IsMeasuring() const;
+	bool IsComplete() const;
+	uint32_t GetTotalFrameCount() const;
+	bool GetStatistics(const std::string& series, Statistics& statistics) const;
+
+	void PrintSummary(std::ostream& os) const;
+	void Write(const std::filesystem::path& path) const;
+	void WriteJson(std::ostream& os) const;
+	void WriteCsv(std::ostream& os) const;
+
+protected:
+	size_t GetSeriesIndex(const std::string& series);
+
+protected:
+	uint32_t m_warmupFrameCount;
+	uint32_t m_measuredFrameCount;
+	uint32_t m_frameIndex;
+
+	std::vector<std::pair<std::string, std::string>> m_metadata;
+	std::vector<std::string> m_seriesNames;
+	std::map<std::string, size_t> m_seriesIndices;
+	std::vector<double> m_currentFrame;
+	std::vector<std::vector<double>> m_samples;
+};
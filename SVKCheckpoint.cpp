@@ -0,0 +1,230 @@
+#include "SVKCheckpoint.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(SVKCheckpoint::Header) == 64, "checkpoint header layout changed");
+
+const char SVKCheckpoint::g_magic[4] = { 'S', 'V', 'K', 'C' };
+const uint32_t SVKCheckpoint::g_version = 1;
+
+// writes the blocks into a new file and returns once the file system reports them on disk
+static bool WriteFileDurably(const std::filesystem::path& path, const std::vector<std::pair<const void*, size_t>>& blocks) {
+#ifdef _WIN32
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	bool written = true;
+	for (const std::pair<const void*, size_t>& block : blocks) {
+		const uint8_t* data = static_cast<const uint8_t*>(block.first);
+		for (size_t offset = 0; written && offset < block.second; ) {
+			DWORD chunkSize = static_cast<DWORD>(std::min<size_t>(block.second - offset, 1u << 30));
+			DWORD chunkWritten = 0;
+			written = WriteFile(file, data + offset, chunkSize, &chunkWritten, nullptr) && chunkWritten > 0;
+			offset += chunkWritten;
+		}
+	}
+	written = written && FlushFileBuffers(file);
+	return CloseHandle(file) && written;
+#else
+	int file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (file < 0)
+		return false;
+
+	bool written = true;
+	for (const std::pair<const void*, size_t>& block : blocks) {
+		const uint8_t* data = static_cast<const uint8_t*>(block.first);
+		for (size_t offset = 0; written && offset < block.second; ) {
+			ssize_t chunkWritten = write(file, data + offset, block.second - offset);
+			written = chunkWritten > 0;
+			offset += written ? static_cast<size_t>(chunkWritten) : 0;
+		}
+	}
+	written = written && fsync(file) == 0;
+	return close(file) == 0 && written;
+#endif
+}
+
+SVKCheckpoint::SVKCheckpoint() :
+	m_data(nullptr),
+	m_size(0),
+#ifdef _WIN32
+	m_fileHandle(nullptr),
+	m_mappingHandle(nullptr)
+#else
+	m_fileDescriptor(-1)
+#endif
+{
+}
+
+SVKCheckpoint::~SVKCheckpoint() {
+	Close();
+}
+
+void SVKCheckpoint::Open(const std::filesystem::path& path) {
+	Close();
+
+	auto fail = [&](const char* reason) {
+		Close();
+		std::stringstream ss;
+		ss << "Checkpoint: cannot map '" << path.string() << "': " << reason;
+		throw std::runtime_error(ss.str());
+	};
+
+#ifdef _WIN32
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		fail("open failed");
+	m_fileHandle = file;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize))
+		fail("size query failed");
+	if (static_cast<uint64_t>(fileSize.QuadPart) < sizeof(Header))
+		fail("file too small");
+	m_size = static_cast<size_t>(fileSize.QuadPart);
+
+	m_mappingHandle = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_mappingHandle == nullptr)
+		fail("CreateFileMapping failed");
+
+	m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0));
+	if (m_data == nullptr)
+		fail("MapViewOfFile failed");
+#else
+	m_fileDescriptor = open(path.c_str(), O_RDONLY);
+	if (m_fileDescriptor < 0)
+		fail("open failed");
+
+	struct stat fileStat;
+	if (fstat(m_fileDescriptor, &fileStat) != 0)
+		fail("fstat failed");
+	if (static_cast<uint64_t>(fileStat.st_size) < sizeof(Header))
+		fail("file too small");
+	m_size = static_cast<size_t>(fileStat.st_size);
+
+	void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fileDescriptor, 0);
+	if (data == MAP_FAILED)
+		fail("mmap failed");
+	m_data = static_cast<const uint8_t*>(data);
+
+	// the upload reads the file front to back exactly once
+	madvise(data, m_size, MADV_SEQUENTIAL);
+#endif
+
+	try {
+		ValidateHeader(path, GetHeader(), m_size);
+	}
+	catch (...) {
+		Close();
+		throw;
+	}
+}
+
+void SVKCheckpoint::Close() {
+#ifdef _WIN32
+	if (m_data != nullptr)
+		UnmapViewOfFile(m_data);
+	if (m_mappingHandle != nullptr)
+		CloseHandle(m_mappingHandle);
+	if (m_fileHandle != nullptr)
+		CloseHandle(m_fileHandle);
+	m_mappingHandle = nullptr;
+	m_fileHandle = nullptr;
+#else
+	if (m_data != nullptr)
+		munmap(const_cast<uint8_t*>(m_data), m_size);
+	if (m_fileDescriptor >= 0)
+		close(m_fileDescriptor);
+	m_fileDescriptor = -1;
+#endif
+	m_data = nullptr;
+	m_size = 0;
+}
+
+const SVKCheckpoint::Header& SVKCheckpoint::GetHeader() const {
+	return *reinterpret_cast<const Header*>(m_data);
+}
+
+const SVKNBody::Particle* SVKCheckpoint::GetParticles() const {
+	return reinterpret_cast<const SVKNBody::Particle*>(m_data + sizeof(Header));
+}
+
+SVKCheckpoint::Header SVKCheckpoint::ReadHeader(const std::filesystem::path& path) {
+	Header header{};
+	std::ifstream file(path, std::ios::binary);
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+		std::stringstream ss;
+		ss << "Checkpoint: cannot read '" << path.string() << '\'';
+		throw std::runtime_error(ss.str());
+	}
+
+	std::error_code error;
+	uint64_t fileSize = std::filesystem::file_size(path, error);
+	ValidateHeader(path, header, error ? 0 : fileSize);
+	return header;
+}
+
+void SVKCheckpoint::Write(const std::filesystem::path& path, const SVKNBody& nbody, const std::vector<SVKNBody::Particle>& particles) {
+	Header header{};
+	std::copy(g_magic, g_magic + 4, header.magic);
+	header.version = g_version;
+	header.particleCount = static_cast<uint32_t>(particles.size());
+	header.particleSize = sizeof(SVKNBody::Particle);
+	header.stepCount = nbody.GetStepCount();
+	header.deltaT = nbody.GetDeltaT();
+	header.kernelConstants = nbody.GetKernelConstants();
+
+	// written next to the old checkpoint, flushed to the disk and only then renamed over it, so a crash leaves
+	// either the old or the new file, never a torn one
+	std::filesystem::path tempPath = path;
+	tempPath += ".tmp";
+	if (!WriteFileDurably(tempPath, { { &header, sizeof(header) }, { particles.data(), particles.size() * sizeof(SVKNBody::Particle) } })) {
+		std::error_code error;
+		std::filesystem::remove(tempPath, error);
+		std::stringstream ss;
+		ss << "Checkpoint: failed to write '" << tempPath.string() << '\'';
+		throw std::runtime_error(ss.str());
+	}
+
+	std::filesystem::rename(tempPath, path);
+
+#ifndef _WIN32
+	// the rename itself is only durable once the directory entry is
+	std::filesystem::path directory = path.has_parent_path() ? path.parent_path() : std::filesystem::path(".");
+	int directoryFile = open(directory.c_str(), O_RDONLY);
+	if (directoryFile >= 0) {
+		fsync(directoryFile);
+		close(directoryFile);
+	}
+#endif
+}
+
+void SVKCheckpoint::ValidateHeader(const std::filesystem::path& path, const Header& header, uint64_t fileSize) {
+	const char* reason = nullptr;
+	if (!std::equal(g_magic, g_magic + 4, header.magic))
+		reason = "not a checkpoint file";
+	else if (header.version != g_version)
+		reason = "unsupported version";
+	else if (header.particleSize != sizeof(SVKNBody::Particle))
+		reason = "particle layout differs";
+	else if (header.particleCount == 0)
+		reason = "no particles";
+	else if (fileSize < sizeof(Header) + sizeof(SVKNBody::Particle) * static_cast<uint64_t>(header.particleCount))
+		reason = "file truncated";
+
+	if (reason != nullptr) {
+		std::stringstream ss;
+		ss << "Checkpoint: invalid '" << path.string() << "': " << reason;
+		throw std::runtime_error(ss.str());
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "common.h"
+
+#include "SVKNBody.h"
+
+// N-body checkpoint file: a fixed size header followed by the particle array in
+// the layout of struct Particle in test.comp. A restore maps the file and hands
+// the array straight to the upload, so the only copy is the one into staging
+// memory; the file pages are read by that copy.
+class SVKCheckpoint
+{
+public:
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint32_t particleCount;
+		uint32_t particleSize;	// sizeof(Particle), rejects files of a different layout
+		uint32_t stepCount;
+		float deltaT;		// time step of the last step before the checkpoint
+		SVKNBody::KernelConstants kernelConstants;
+		uint32_t reserved[4];	// keeps the particles 16 byte aligned in the mapping
+	};
+
+	static const char g_magic[4];
+	static const uint32_t g_version;
+
+public:
+	SVKCheckpoint();
+	~SVKCheckpoint();
+
+	void Open(const std::filesystem::path& path);
+	void Close();
+
+	const Header& GetHeader() const;
+	const SVKNBody::Particle* GetParticles() const;
+
+	static Header ReadHeader(const std::filesystem::path& path);
+	static void Write(const std::filesystem::path& path, const SVKNBody& nbody, const std::vector<SVKNBody::Particle>& particles);
+
+protected:
+	static void ValidateHeader(const std::filesystem::path& path, const Header& header, uint64_t fileSize);
+
+protected:
+	const uint8_t* m_data;
+	size_t m_size;
+#ifdef _WIN32
+	void* m_fileHandle;
+	void* m_mappingHandle;
+#else
+	int m_fileDescriptor;
+#endif
+};
@@ -0,0 +1,121 @@
+#include "SVKCommandRecorder.h"
+
+// below this a secondary command buffer costs more to begin and execute than recording the draws inline
+const uint32_t SVKCommandRecorder::g_minDrawsPerChunk = 16;
+
+SVKCommandRecorder::SVKCommandRecorder() :
+	m_logicalDevice(VK_NULL_HANDLE),
+	m_jobSystem(nullptr),
+	m_threadCount(0),
+	m_frameCount(0)
+{
+}
+
+void SVKCommandRecorder::Initialize(VkDevice logicalDevice, uint32_t queueFamilyIndex, SVKJobSystem& jobSystem, uint32_t frameCount) {
+	m_logicalDevice = logicalDevice;
+	m_jobSystem = &jobSystem;
+	m_threadCount = std::max(m_jobSystem->GetThreadCount(), 1u);
+	m_frameCount = frameCount;
+
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+	m_pools.resize(static_cast<size_t>(m_frameCount) * m_threadCount);
+	for (Pool& pool : m_pools) {
+		vkCheckResult(vkCreateCommandPool(m_logicalDevice, &poolInfo, nullptr, &pool.commandPool), "Create Recorder CommandPool");
+		pool.usedCount = 0;
+	}
+}
+
+void SVKCommandRecorder::Cleanup() {
+	if (m_logicalDevice == VK_NULL_HANDLE)
+		return;
+
+	// frees the command buffers
+	for (Pool& pool : m_pools)
+		vkDestroyCommandPool(m_logicalDevice, pool.commandPool, nullptr);
+	m_pools.clear();
+
+	m_jobSystem = nullptr;
+	m_logicalDevice = VK_NULL_HANDLE;
+}
+
+void SVKCommandRecorder::Record(
+	VkRenderPass renderPass,
+	const std::vector<Pass>& passes,
+	uint32_t drawCount,
+	const RecordFunction& record,
+	std::vector<std::vector<VkCommandBuffer>>& commandBuffers
+) {
+	// enough chunks per pass to keep the threads busy when there are few passes
+	uint32_t threadCount = m_jobSystem->GetActiveThreadCount();
+	uint32_t passCount = static_cast<uint32_t>(passes.size());
+	uint32_t chunkCount = std::max((threadCount + passCount - 1) / std::max(passCount, 1u), 1u);
+	chunkCount = std::max(std::min(chunkCount, drawCount / g_minDrawsPerChunk), 1u);
+	uint32_t chunkDrawCount = (drawCount + chunkCount - 1) / chunkCount;
+
+	m_chunks.clear();
+	for (uint32_t pass = 0; pass < passCount; ++pass) {
+		for (uint32_t firstDraw = 0; firstDraw < drawCount; firstDraw += chunkDrawCount)
+			m_chunks.push_back({ pass, firstDraw, std::min(chunkDrawCount, drawCount - firstDraw) });
+	}
+	m_chunkCommandBuffers.assign(m_chunks.size(), VK_NULL_HANDLE);
+
+	// a single chunk is recorded by the caller without waking a thread; the command buffers of a failed
+	// recording return to their pools with the next reset
+	m_jobSystem->ParallelFor(static_cast<uint32_t>(m_chunks.size()), 1, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; ++i)
+			m_chunkCommandBuffers[i] = RecordChunk(renderPass, passes[m_chunks[i].pass], m_chunks[i], record);
+	});
+
+	commandBuffers.assign(passCount, {});
+	for (size_t i = 0; i < m_chunks.size(); ++i)
+		commandBuffers[m_chunks[i].pass].push_back(m_chunkCommandBuffers[i]);
+}
+
+void SVKCommandRecorder::ResetFrame(uint32_t frame) {
+	// one reset per pool returns all command buffers of the frame to the initial state
+	for (uint32_t thread = 0; thread < m_threadCount; ++thread) {
+		Pool& pool = m_pools[frame * m_threadCount + thread];
+		if (pool.usedCount == 0)
+			continue;
+
+		vkCheckResult(vkResetCommandPool(m_logicalDevice, pool.commandPool, 0), "Reset Recorder CommandPool");
+		pool.usedCount = 0;
+	}
+}
+
+VkCommandBuffer SVKCommandRecorder::RecordChunk(VkRenderPass renderPass, const Pass& pass, const Chunk& chunk, const RecordFunction& record) {
+	// only the calling thread uses its pools
+	Pool& pool = m_pools[pass.frame * m_threadCount + m_jobSystem->GetThreadIndex()];
+	if (pool.usedCount == pool.commandBuffers.size()) {
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = pool.commandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocInfo.commandBufferCount = 1;
+
+		VkCommandBuffer allocated;
+		vkCheckResult(vkAllocateCommandBuffers(m_logicalDevice, &allocInfo, &allocated), "Allocate Secondary CommandBuffer");
+		pool.commandBuffers.push_back(allocated);
+	}
+	VkCommandBuffer commandBuffer = pool.commandBuffers[pool.usedCount++];
+
+	VkCommandBufferInheritanceInfo inheritanceInfo{};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = renderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = pass.frameBuffer;
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	vkCheckResult(vkBeginCommandBuffer(commandBuffer, &beginInfo), "Begin Secondary CommandBuffer");
+	record(commandBuffer, pass, chunk.firstDraw, chunk.drawCount);
+	vkCheckResult(vkEndCommandBuffer(commandBuffer), "End Secondary CommandBuffer");
+	return commandBuffer;
+}
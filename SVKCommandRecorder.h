@@ -0,0 +1,72 @@
+#pragma once
+
+#include "common.h"
+
+#include <functional>
+
+#include "SVKJobSystem.h"
+
+// Records the draws of render passes as jobs of the job system. Every job
+// system thread owns one command pool per frame in flight, so recording never
+// synchronizes on a pool; each pass is split into chunks of consecutive draws
+// and every chunk becomes a secondary command buffer that continues the render
+// pass. The caller begins the pass with
+// VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS and executes the chunks of a
+// pass in order with vkCmdExecuteCommands.
+//
+// Record() returns when all chunks are done. Once the submission of a frame has
+// finished, ResetFrame() resets all pools of the frame at once; their command
+// buffers are kept and reused by the next recording of the frame.
+class SVKCommandRecorder
+{
+public:
+	struct Pass {
+		uint32_t slot;		// passed through to the record function
+		uint32_t frame;		// selects the command pools
+		VkFramebuffer frameBuffer;
+	};
+
+	// records draws [firstDraw, firstDraw + drawCount) of the pass; called concurrently for different chunks
+	typedef std::function<void(VkCommandBuffer commandBuffer, const Pass& pass, uint32_t firstDraw, uint32_t drawCount)> RecordFunction;
+
+	static const uint32_t g_minDrawsPerChunk;
+
+public:
+	SVKCommandRecorder();
+
+	void Initialize(VkDevice logicalDevice, uint32_t queueFamilyIndex, SVKJobSystem& jobSystem, uint32_t frameCount);
+	void Cleanup();
+
+	void Record(
+		VkRenderPass renderPass,
+		const std::vector<Pass>& passes,
+		uint32_t drawCount,
+		const RecordFunction& record,
+		std::vector<std::vector<VkCommandBuffer>>& commandBuffers
+	);
+	void ResetFrame(uint32_t frame);
+
+protected:
+	struct Pool {
+		VkCommandPool commandPool;
+		std::vector<VkCommandBuffer> commandBuffers;
+		uint32_t usedCount;	// command buffers recorded since the last reset
+	};
+
+	struct Chunk {
+		uint32_t pass;
+		uint32_t firstDraw;
+		uint32_t drawCount;
+	};
+
+	VkCommandBuffer RecordChunk(VkRenderPass renderPass, const Pass& pass, const Chunk& chunk, const RecordFunction& record);
+
+protected:
+	VkDevice m_logicalDevice;
+	SVKJobSystem* m_jobSystem;
+	uint32_t m_threadCount;
+	uint32_t m_frameCount;
+	std::vector<Pool> m_pools;	// [frame * threadCount + thread]
+	std::vector<Chunk> m_chunks;
+	std::vector<VkCommandBuffer> m_chunkCommandBuffers;
+};
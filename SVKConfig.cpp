@@ -1,5 +1,281 @@
 #include "SVKConfig.h"
+#include "SVKCheckpoint.h"
 
-SVKConfig::SVKConfig(int argc, char** argv) {
+static uint32_t ParseUInt(const std::string& name, const std::string& value) {
+	try {
+		size_t pos = 0;
+		unsigned long result = std::stoul(value, &pos);
+		if (pos == value.size())
+			return static_cast<uint32_t>(result);
+	}
+	catch (const std::exception&) {
+	}
+
+	std::stringstream ss;
+	ss << "Invalid value for '" << name << "': '" << value << '\'';
+	throw std::runtime_error(ss.str());
+}
+
+static float ParseFloat(const std::string& name, const std::string& value) {
+	try {
+		size_t pos = 0;
+		float result = std::stof(value, &pos);
+		if (pos == value.size())
+			return result;
+	}
+	catch (const std::exception&) {
+	}
+
+	std::stringstream ss;
+	ss << "Invalid value for '" << name << "': '" << value << '\'';
+	throw std::runtime_error(ss.str());
+}
+
+// *********************************************************************************
+
+const uint32_t SVKConfig::g_maxFramesInFlight = 8;
+
+// every possible step count per frame has its own pre-recorded command buffers
+const uint32_t SVKConfig::g_maxSubsteps = 16;
+
+SVKConfig::SVKConfig(int argc, char** argv) :
+	m_headless(false),
+	m_frameCount(0),
+	m_framesInFlight(2),
+	m_particleCount(0),
+	m_barnesHut(false),
+	m_theta(0.5f),
+	m_asyncCompute(true),
+	m_tune(false),
+	m_nbodyCpu(false),
+	m_nbodyValidate(false),
+	m_threadCount(0),
+	m_threadSweep(false),
+	m_simulationRate(60.0f),
+	m_maxSubsteps(4),
+	m_frameRate(0.0f),
+	m_instanceCount(0),
+	m_instanceCulling("none"),
+	m_stepCount(1000),
+	m_stepsPerSubmit(16),
+	m_snapshotInterval(100),
+	m_snapshotEncoding("raw"),
+	m_benchmark(false),
+	m_warmupFrameCount(100)
+{
 	m_appDir = std::filesystem::path(argv[0]).parent_path();
-}
\ No newline at end of file
+	m_pipelineCachePath = m_appDir / "pipeline.cache";
+	m_tuningCachePath = m_appDir / "tuning.cache";
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		std::string value;
+
+		size_t eqPos = arg.find('=');
+		if (eqPos != std::string::npos) {
+			value = arg.substr(eqPos + 1);
+			arg = arg.substr(0, eqPos);
+		}
+
+		auto nextValue = [&]() -> const std::string& {
+			if (eqPos == std::string::npos) {
+				if (i + 1 >= argc) {
+					std::stringstream ss;
+					ss << "Missing value for '" << arg << '\'';
+					throw std::runtime_error(ss.str());
+				}
+				value = argv[++i];
+			}
+			return value;
+		};
+
+		if (arg == "--headless")
+			m_headless = true;
+		else if (arg == "--frames")
+			m_frameCount = ParseUInt(arg, nextValue());
+		else if (arg == "--device")
+			m_deviceName = nextValue();
+		else if (arg == "--frames-in-flight")
+			m_framesInFlight = ParseUInt(arg, nextValue());
+		else if (arg == "--pipeline-cache")
+			m_pipelineCachePath = nextValue();
+		else if (arg == "--particles")
+			m_particleCount = ParseUInt(arg, nextValue());
+		else if (arg == "--nbody-mode") {
+			const std::string& mode = nextValue();
+			if (mode != "brute" && mode != "barnes-hut") {
+				std::stringstream ss;
+				ss << "Invalid value for '" << arg << "': '" << mode << "' (brute or barnes-hut)";
+				throw std::runtime_error(ss.str());
+			}
+			m_barnesHut = mode == "barnes-hut";
+		}
+		else if (arg == "--theta")
+			m_theta = ParseFloat(arg, nextValue());
+		else if (arg == "--no-async-compute")
+			m_asyncCompute = false;
+		else if (arg == "--tune")
+			m_tune = true;
+		else if (arg == "--tuning-cache")
+			m_tuningCachePath = nextValue();
+		else if (arg == "--nbody-cpu")
+			m_nbodyCpu = true;
+		else if (arg == "--nbody-validate")
+			m_nbodyValidate = true;
+		else if (arg == "--threads")
+			m_threadCount = ParseUInt(arg, nextValue());
+		else if (arg == "--thread-sweep")
+			m_threadSweep = true;
+		else if (arg == "--sim-rate")
+			m_simulationRate = ParseFloat(arg, nextValue());
+		else if (arg == "--max-substeps")
+			m_maxSubsteps = ParseUInt(arg, nextValue());
+		else if (arg == "--frame-rate")
+			m_frameRate = ParseFloat(arg, nextValue());
+		else if (arg == "--checkpoint")
+			m_checkpointPath = nextValue();
+		else if (arg == "--restore")
+			m_restorePath = nextValue();
+		else if (arg == "--instances")
+			m_instanceCount = ParseUInt(arg, nextValue());
+		else if (arg == "--culling") {
+			const std::string& culling = nextValue();
+			if (culling != "none" && culling != "cpu" && culling != "gpu") {
+				std::stringstream ss;
+				ss << "Invalid value for '" << arg << "': '" << culling << "' (none, cpu or gpu)";
+				throw std::runtime_error(ss.str());
+			}
+			m_instanceCulling = culling;
+		}
+		else if (arg == "--batch") {
+			m_batchOutput = nextValue();
+			m_headless = true;
+		}
+		else if (arg == "--steps")
+			m_stepCount = ParseUInt(arg, nextValue());
+		else if (arg == "--steps-per-submit")
+			m_stepsPerSubmit = ParseUInt(arg, nextValue());
+		else if (arg == "--snapshot-interval")
+			m_snapshotInterval = ParseUInt(arg, nextValue());
+		else if (arg == "--snapshot-encoding") {
+			const std::string& encoding = nextValue();
+			if (encoding != "raw" && encoding != "quantized" && encoding != "delta") {
+				std::stringstream ss;
+				ss << "Invalid value for '" << arg << "': '" << encoding << "' (raw, quantized or delta)";
+				throw std::runtime_error(ss.str());
+			}
+			m_snapshotEncoding = encoding;
+		}
+		else if (arg == "--benchmark")
+			m_benchmark = true;
+		else if (arg == "--warmup")
+			m_warmupFrameCount = ParseUInt(arg, nextValue());
+		else if (arg == "--bench-output")
+			m_benchmarkOutput = nextValue();
+		else {
+			std::stringstream ss;
+			ss << "Unknown argument: '" << arg << '\'';
+			throw std::runtime_error(ss.str());
+		}
+	}
+
+	if (m_framesInFlight == 0 || m_framesInFlight > g_maxFramesInFlight) {
+		std::stringstream ss;
+		ss << "'--frames-in-flight' must be between 1 and " << g_maxFramesInFlight;
+		throw std::runtime_error(ss.str());
+	}
+
+	if (!(m_theta >= 0.0f)) {
+		std::stringstream ss;
+		ss << "'--theta' must not be negative";
+		throw std::runtime_error(ss.str());
+	}
+
+	if (!(m_simulationRate > 0.0f)) {
+		std::stringstream ss;
+		ss << "'--sim-rate' must be positive";
+		throw std::runtime_error(ss.str());
+	}
+
+	if (m_maxSubsteps == 0 || m_maxSubsteps > g_maxSubsteps) {
+		std::stringstream ss;
+		ss << "'--max-substeps' must be between 1 and " << g_maxSubsteps;
+		throw std::runtime_error(ss.str());
+	}
+
+	if (!(m_frameRate >= 0.0f)) {
+		std::stringstream ss;
+		ss << "'--frame-rate' must not be negative";
+		throw std::runtime_error(ss.str());
+	}
+
+	if (!m_restorePath.empty()) {
+		// the reference solutions start from generated particles
+		if (m_nbodyCpu || m_nbodyValidate) {
+			std::stringstream ss;
+			ss << "'--restore' cannot be combined with '" << (m_nbodyCpu ? "--nbody-cpu" : "--nbody-validate") << '\'';
+			throw std::runtime_error(ss.str());
+		}
+
+		SVKCheckpoint::Header header = SVKCheckpoint::ReadHeader(m_restorePath);
+		if (m_particleCount != 0 && m_particleCount != header.particleCount) {
+			std::stringstream ss;
+			ss << "'--particles' " << m_particleCount << " differs from the " << header.particleCount << " particles in '" << m_restorePath.string() << '\'';
+			throw std::runtime_error(ss.str());
+		}
+		m_particleCount = header.particleCount;
+	}
+
+	if ((m_nbodyCpu || m_nbodyValidate) && m_particleCount == 0) {
+		std::stringstream ss;
+		ss << "'" << (m_nbodyCpu ? "--nbody-cpu" : "--nbody-validate") << "' requires '--particles'";
+		throw std::runtime_error(ss.str());
+	}
+
+	if (m_instanceCulling != "none" && m_instanceCount == 0)
+		throw std::runtime_error("'--culling' requires '--instances'");
+
+	if (!m_batchOutput.empty()) {
+		if (m_particleCount == 0)
+			throw std::runtime_error("'--batch' requires '--particles' or '--restore'");
+		if (m_stepsPerSubmit == 0)
+			throw std::runtime_error("'--steps-per-submit' must be at least 1");
+	}
+
+	if ((m_headless || m_benchmark || m_nbodyCpu) && m_frameCount == 0)
+		m_frameCount = 1000;
+}
+
+void SVKConfig::PrintUsage(std::ostream& os) {
+	os << "Usage: StudyVulkan [options]" << std::endl;
+	os << "\t--headless            render offscreen without window and swapchain" << std::endl;
+	os << "\t--frames <n>          stop after n frames (headless and benchmark default: 1000)" << std::endl;
+	os << "\t--device <name|uuid>  use the physical device whose name contains <name> or whose UUID matches" << std::endl;
+	os << "\t--frames-in-flight <n> frames the CPU may run ahead of the GPU (1-" << g_maxFramesInFlight << ", default: 2)" << std::endl;
+	os << "\t--pipeline-cache <file> loaded at startup, saved at exit (default: pipeline.cache next to the executable; empty disables)" << std::endl;
+	os << "\t--particles <n>       simulate n bodies on the GPU each frame (default: 0, disabled)" << std::endl;
+	os << "\t--nbody-mode <mode>   brute (O(N^2) test.comp) or barnes-hut (GPU octree, O(N log N)) (default: brute)" << std::endl;
+	os << "\t--theta <f>           Barnes-Hut opening angle, 0 is exact (default: 0.5)" << std::endl;
+	os << "\t--no-async-compute    simulate on the graphics queue even if the device has a compute-only queue family" << std::endl;
+	os << "\t--tune                re-run the N-body kernel tuner even if the tuning cache has a result" << std::endl;
+	os << "\t--tuning-cache <file> best kernel variants per device (default: tuning.cache next to the executable; empty disables)" << std::endl;
+	os << "\t--nbody-cpu           run the N-body simulation on the CPU only, without Vulkan" << std::endl;
+	os << "\t--nbody-validate      fixed time step; compare the GPU particles against the CPU reference at exit (Barnes-Hut with theta 0)" << std::endl;
+	os << "\t--threads <n>         job system threads for startup, update, recording and the CPU N-body (default: 0, one per hardware thread)" << std::endl;
+	os << "\t--thread-sweep        with --benchmark, also measure 1, 2, 4, ... job threads (frameMs/instancesMs/recordMs.<n>; nbodyMs.<n> with --nbody-cpu)" << std::endl;
+	os << "\t--sim-rate <hz>       fixed simulation steps per second, independent of the frame rate (default: 60)" << std::endl;
+	os << "\t--max-substeps <n>    simulation steps per frame at most, slower frames drop time (1-" << g_maxSubsteps << ", default: 4)" << std::endl;
+	os << "\t--frame-rate <hz>     advance the simulation clock by 1/hz per frame instead of the wall clock (default: 0, wall clock)" << std::endl;
+	os << "\t--checkpoint <file>   save the N-body state to <file> at exit" << std::endl;
+	os << "\t--restore <file>      continue the N-body simulation from a checkpoint; implies its --particles" << std::endl;
+	os << "\t--instances <n>       draw n quads with one instanced draw, offsets streamed each frame (default: 0, disabled)" << std::endl;
+	os << "\t--culling <mode>      frustum culling of the instances: none, cpu (compacted per chunk, one draw each) or gpu (compute pass and indirect draw; with --benchmark after a cpu pass for comparison) (default: none)" << std::endl;
+	os << "\t--batch <file>        simulate without rendering and stream snapshots to <file>; requires --particles or --restore" << std::endl;
+	os << "\t--steps <n>           batch simulation steps (default: 1000)" << std::endl;
+	os << "\t--steps-per-submit <k> batch steps recorded into one submission (default: 16)" << std::endl;
+	os << "\t--snapshot-interval <m> batch steps between snapshots, 0 writes only the first and last (default: 100)" << std::endl;
+	os << "\t--snapshot-encoding <e> raw (float32), quantized (16 bit per component) or delta (varint differences) (default: raw)" << std::endl;
+	os << "\t--benchmark           record per-frame timings for --warmup + --frames frames" << std::endl;
+	os << "\t--warmup <n>          frames excluded from benchmark statistics (default: 100)" << std::endl;
+	os << "\t--bench-output <file> write benchmark statistics and raw series (.json or .csv)" << std::endl;
+}
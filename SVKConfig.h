@@ -7,7 +7,44 @@ class SVKConfig
 public:
 	SVKConfig(int argc, char** argv);
 
+	static void PrintUsage(std::ostream& os);
+
 public:
+	static const uint32_t g_maxFramesInFlight;
+	static const uint32_t g_maxSubsteps;
+
 	std::filesystem::path m_appDir;
-};
 
+	bool m_headless;
+	uint32_t m_frameCount;
+	std::string m_deviceName;
+	uint32_t m_framesInFlight;
+	std::filesystem::path m_pipelineCachePath;
+	uint32_t m_particleCount;
+	bool m_barnesHut;
+	float m_theta;
+	bool m_asyncCompute;
+	bool m_tune;
+	std::filesystem::path m_tuningCachePath;
+	bool m_nbodyCpu;
+	bool m_nbodyValidate;
+	uint32_t m_threadCount;
+	bool m_threadSweep;
+	float m_simulationRate;
+	uint32_t m_maxSubsteps;
+	float m_frameRate;
+	std::filesystem::path m_checkpointPath;
+	std::filesystem::path m_restorePath;
+	uint32_t m_instanceCount;
+	std::string m_instanceCulling;
+
+	std::filesystem::path m_batchOutput;
+	uint32_t m_stepCount;
+	uint32_t m_stepsPerSubmit;
+	uint32_t m_snapshotInterval;
+	std::string m_snapshotEncoding;
+
+	bool m_benchmark;
+	uint32_t m_warmupFrameCount;
+	std::filesystem::path m_benchmarkOutput;
+};
@@ -0,0 +1,93 @@
+#include "SVKFixedTimestep.h"
+
+#include <cmath>
+
+SVKFixedTimestep::SVKFixedTimestep() :
+	m_stepTime(1.0 / 60.0),
+	m_maxStepCount(1),
+	m_frameTime(0.0),
+	m_frozen(false),
+	m_started(false),
+	m_accumulator(0.0),
+	m_frameStepCount(0),
+	m_stepCount(0),
+	m_droppedStepCount(0)
+{
+}
+
+void SVKFixedTimestep::Initialize(double stepTime, uint32_t maxStepCount, double frameTime) {
+	m_stepTime = stepTime;
+	m_maxStepCount = maxStepCount;
+	m_frameTime = frameTime;
+	m_frozen = false;
+	m_started = false;
+	m_accumulator = 0.0;
+	m_frameStepCount = 0;
+	m_stepCount = 0;
+	m_droppedStepCount = 0;
+}
+
+uint32_t SVKFixedTimestep::Advance() {
+	auto currTm = std::chrono::high_resolution_clock::now();
+	if (m_frozen) {
+		// the clock restarts with every frozen frame, the first frame after the freeze does not catch up on it
+		m_prevTm = currTm;
+		m_started = true;
+		m_frameStepCount = 0;
+		return 0;
+	}
+
+	double elapsed = m_frameTime;
+	if (m_frameTime <= 0.0) {
+		// the first frame has no predecessor and starts the clock
+		elapsed = m_started ? std::chrono::duration<double>(currTm - m_prevTm).count() : 0.0;
+		m_prevTm = currTm;
+	}
+	m_started = true;
+	m_accumulator += elapsed;
+
+	// a fixed frame time that is a multiple of the step time must not lose a step to rounding
+	double steps = std::floor(m_accumulator / m_stepTime + 1e-6);
+	m_frameStepCount = static_cast<uint32_t>(std::min(steps, static_cast<double>(m_maxStepCount)));
+	m_accumulator = std::max(m_accumulator - m_frameStepCount * m_stepTime, 0.0);
+	if (m_accumulator >= m_stepTime) {
+		uint64_t droppedSteps = static_cast<uint64_t>(m_accumulator / m_stepTime);
+		m_droppedStepCount += droppedSteps;
+		m_accumulator -= droppedSteps * m_stepTime;
+	}
+
+	m_stepCount += m_frameStepCount;
+	return m_frameStepCount;
+}
+
+void SVKFixedTimestep::SetFrozen(bool frozen) {
+	m_frozen = frozen;
+}
+
+double SVKFixedTimestep::GetStepTime() const {
+	return m_stepTime;
+}
+
+uint32_t SVKFixedTimestep::GetMaxStepCount() const {
+	return m_maxStepCount;
+}
+
+uint32_t SVKFixedTimestep::GetFrameStepCount() const {
+	return m_frameStepCount;
+}
+
+uint64_t SVKFixedTimestep::GetStepCount() const {
+	return m_stepCount;
+}
+
+uint64_t SVKFixedTimestep::GetDroppedStepCount() const {
+	return m_droppedStepCount;
+}
+
+float SVKFixedTimestep::GetInterpolation() const {
+	return static_cast<float>(std::min(m_accumulator / m_stepTime, 1.0));
+}
+
+double SVKFixedTimestep::GetTime() const {
+	return (static_cast<double>(m_stepCount) + GetInterpolation()) * m_stepTime;
+}
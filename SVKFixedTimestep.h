@@ -0,0 +1,46 @@
+#pragma once
+
+#include "common.h"
+
+// Fixed timestep scheduler: each frame adds its duration to an accumulator and
+// runs as many whole simulation steps as fit; the remainder becomes the
+// interpolation factor between the last two simulation states. The simulation
+// only ever sees the fixed step, so its results depend on the number of steps
+// but not on the frame rate.
+//
+// The frame duration is measured on the wall clock, or fixed with a frame time
+// (reproducible headless runs). Frames that would need more than maxStepCount
+// steps drop the excess time, so a slow simulation slows down instead of
+// falling further behind every frame.
+class SVKFixedTimestep
+{
+public:
+	SVKFixedTimestep();
+
+	void Initialize(double stepTime, uint32_t maxStepCount, double frameTime);
+
+	uint32_t Advance();
+	// a frozen timestep runs no steps and keeps the interpolation, so frames show the same simulation state
+	void SetFrozen(bool frozen);
+
+	double GetStepTime() const;
+	uint32_t GetMaxStepCount() const;
+	uint32_t GetFrameStepCount() const;
+	uint64_t GetStepCount() const;
+	uint64_t GetDroppedStepCount() const;
+	float GetInterpolation() const;
+	double GetTime() const;
+
+protected:
+	double m_stepTime;
+	uint32_t m_maxStepCount;
+	double m_frameTime;
+
+	bool m_frozen;
+	bool m_started;
+	std::chrono::high_resolution_clock::time_point m_prevTm;
+	double m_accumulator;
+	uint32_t m_frameStepCount;
+	uint64_t m_stepCount;
+	uint64_t m_droppedStepCount;
+};
@@ -0,0 +1,145 @@
+#include "SVKGpuProfiler.h"
+
+SVKGpuProfiler::SVKGpuProfiler() :
+	m_logicalDevice(VK_NULL_HANDLE),
+	m_queryPool(VK_NULL_HANDLE),
+	m_timestampPeriod(0.0),
+	m_timestampMask(0),
+	m_maxScopeCount(0)
+{
+}
+
+void SVKGpuProfiler::Initialize(
+	VkPhysicalDevice physicalDevice,
+	VkDevice logicalDevice,
+	uint32_t queueFamilyIndex,
+	uint32_t slotCount,
+	uint32_t maxScopeCount
+) {
+	m_logicalDevice = logicalDevice;
+	m_maxScopeCount = maxScopeCount;
+
+	VkPhysicalDeviceProperties physicalDeviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+	uint32_t timestampValidBits = queueFamilies[queueFamilyIndex].timestampValidBits;
+	if (timestampValidBits == 0 || physicalDeviceProperties.limits.timestampPeriod == 0.0f) {
+		std::cerr << "GPU profiler: timestamps are not supported by the queue family" << std::endl;
+		return;
+	}
+
+	m_timestampPeriod = physicalDeviceProperties.limits.timestampPeriod;
+	m_timestampMask = timestampValidBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << timestampValidBits) - 1;
+
+	VkQueryPoolCreateInfo queryPoolInfo{};
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = slotCount * maxScopeCount * 2;
+
+	vkCheckResult(vkCreateQueryPool(m_logicalDevice, &queryPoolInfo, nullptr, &m_queryPool), "Create Timestamp QueryPool");
+
+	m_slots.assign(slotCount, Slot{ {}, false });
+	m_queryResults.resize(static_cast<size_t>(maxScopeCount) * 2 * 2);
+}
+
+void SVKGpuProfiler::Cleanup() {
+	if (m_queryPool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(m_logicalDevice, m_queryPool, nullptr);
+		m_queryPool = VK_NULL_HANDLE;
+	}
+	m_slots.clear();
+	m_queryResults.clear();
+	m_logicalDevice = VK_NULL_HANDLE;
+}
+
+bool SVKGpuProfiler::IsSupported() const {
+	return m_queryPool != VK_NULL_HANDLE;
+}
+
+void SVKGpuProfiler::BeginFrame(VkCommandBuffer commandBuffer, uint32_t slot) {
+	if (!IsSupported())
+		return;
+
+	m_slots[slot].scopeNames.clear();
+	m_slots[slot].submitted = false;
+	vkCmdResetQueryPool(commandBuffer, m_queryPool, slot * m_maxScopeCount * 2, m_maxScopeCount * 2);
+}
+
+uint32_t SVKGpuProfiler::BeginScope(VkCommandBuffer commandBuffer, uint32_t slot, const char* name, VkPipelineStageFlagBits stage) {
+	if (!IsSupported())
+		return 0;
+
+	std::lock_guard<std::mutex> lock(m_scopeMutex);
+	std::vector<std::string>& scopeNames = m_slots[slot].scopeNames;
+	if (scopeNames.size() >= m_maxScopeCount)
+		throw std::runtime_error("GPU profiler: too many scopes in a frame");
+
+	uint32_t scope = static_cast<uint32_t>(scopeNames.size());
+	scopeNames.push_back(name);
+	vkCmdWriteTimestamp(commandBuffer, stage, m_queryPool, (slot * m_maxScopeCount + scope) * 2);
+	return scope;
+}
+
+void SVKGpuProfiler::EndScope(VkCommandBuffer commandBuffer, uint32_t slot, uint32_t scope, VkPipelineStageFlagBits stage) {
+	if (!IsSupported())
+		return;
+
+	vkCmdWriteTimestamp(commandBuffer, stage, m_queryPool, (slot * m_maxScopeCount + scope) * 2 + 1);
+}
+
+void SVKGpuProfiler::MarkSubmitted(uint32_t slot) {
+	if (!IsSupported())
+		return;
+
+	m_slots[slot].submitted = true;
+}
+
+bool SVKGpuProfiler::Resolve(uint32_t slot, std::vector<std::pair<std::string, double>>& results) {
+	results.clear();
+	if (!IsSupported() || !m_slots[slot].submitted || m_slots[slot].scopeNames.empty())
+		return false;
+
+	// value and availability for every query, never blocks
+	uint32_t queryCount = static_cast<uint32_t>(m_slots[slot].scopeNames.size()) * 2;
+	VkResult result = vkGetQueryPoolResults(
+		m_logicalDevice,
+		m_queryPool,
+		slot * m_maxScopeCount * 2,
+		queryCount,
+		queryCount * 2 * sizeof(uint64_t),
+		m_queryResults.data(),
+		2 * sizeof(uint64_t),
+		VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
+	);
+	if (result != VK_SUCCESS && result != VK_NOT_READY)
+		vkCheckResult(result, "Get Timestamp Query Results");
+
+	for (uint32_t i = 0; i < queryCount; ++i)
+		if (m_queryResults[i * 2 + 1] == 0)
+			return false;
+
+	m_slots[slot].submitted = false;
+
+	for (size_t scope = 0; scope < m_slots[slot].scopeNames.size(); ++scope) {
+		uint64_t begin = m_queryResults[scope * 4];
+		uint64_t end = m_queryResults[scope * 4 + 2];
+		uint64_t ticks = (end - begin) & m_timestampMask;
+		results.emplace_back(m_slots[slot].scopeNames[scope], static_cast<double>(ticks) * m_timestampPeriod / 1000000.0);
+	}
+
+	return true;
+}
+
+void SVKGpuProfiler::Report(uint32_t slot, SVKBenchmark& benchmark) {
+	std::vector<std::pair<std::string, double>> results;
+	if (!Resolve(slot, results))
+		return;
+
+	for (const std::pair<std::string, double>& result : results)
+		benchmark.Record("gpu." + result.first, result.second);
+}
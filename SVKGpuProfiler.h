@@ -0,0 +1,52 @@
+#pragma once
+
+#include "common.h"
+
+#include "SVKBenchmark.h"
+
+#include <mutex>
+
+// Timestamp query based GPU timings. Each slot owns a range of queries that is
+// reset and written by one command buffer; results are read back without
+// waiting once the owner knows the command buffer has finished executing.
+// Secondary command buffers of one slot may open scopes on several threads.
+class SVKGpuProfiler
+{
+protected:
+	struct Slot {
+		std::vector<std::string> scopeNames;
+		bool submitted;
+	};
+
+public:
+	SVKGpuProfiler();
+
+	void Initialize(
+		VkPhysicalDevice physicalDevice,
+		VkDevice logicalDevice,
+		uint32_t queueFamilyIndex,
+		uint32_t slotCount,
+		uint32_t maxScopeCount
+	);
+	void Cleanup();
+
+	bool IsSupported() const;
+
+	void BeginFrame(VkCommandBuffer commandBuffer, uint32_t slot);
+	uint32_t BeginScope(VkCommandBuffer commandBuffer, uint32_t slot, const char* name, VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+	void EndScope(VkCommandBuffer commandBuffer, uint32_t slot, uint32_t scope, VkPipelineStageFlagBits stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+	void MarkSubmitted(uint32_t slot);
+
+	bool Resolve(uint32_t slot, std::vector<std::pair<std::string, double>>& results);
+	void Report(uint32_t slot, SVKBenchmark& benchmark);
+
+protected:
+	VkDevice m_logicalDevice;
+	VkQueryPool m_queryPool;
+	double m_timestampPeriod;
+	uint64_t m_timestampMask;
+	uint32_t m_maxScopeCount;
+	std::vector<Slot> m_slots;
+	std::mutex m_scopeMutex;
+	std::vector<uint64_t> m_queryResults;
+};
@@ -0,0 +1,627 @@
+#include "SVKInstanceRenderer.h"
+
+#include <cmath>
+
+// a few thousand instances per job, less does not pay for the job overhead
+const uint32_t SVKInstanceRenderer::g_minInstancesPerJob = 4096;
+
+// CPU culling records one draw per chunk with a visible instance
+const uint32_t SVKInstanceRenderer::g_cullChunkSize = 4096;
+
+// local_size_x of instance_cull.comp
+const uint32_t SVKInstanceRenderer::g_cullWorkGroupSize = 256;
+
+// the grid covers about what the camera at (2, 2, 2) sees of the z = 0 plane
+const float SVKInstanceRenderer::g_gridExtent = 1.5f;
+const float SVKInstanceRenderer::g_waveHeight = 0.1f;
+const float SVKInstanceRenderer::g_waveSpeed = 2.0f;
+
+static const char* g_cullingNames[] = { "none", "cpu", "gpu" };
+
+// inward facing planes of the clip volume (0 <= z <= w), normalized so the distance of a sphere center can be compared
+// with its radius
+static void ExtractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]) {
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; ++i)
+		rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+	planes[0] = rows[3] + rows[0];
+	planes[1] = rows[3] - rows[0];
+	planes[2] = rows[3] + rows[1];
+	planes[3] = rows[3] - rows[1];
+	planes[4] = rows[2];
+	planes[5] = rows[3] - rows[2];
+	for (int i = 0; i < 6; ++i)
+		planes[i] /= std::sqrt(planes[i].x * planes[i].x + planes[i].y * planes[i].y + planes[i].z * planes[i].z);
+}
+
+// the same test as instance_cull.comp
+static bool IsSphereVisible(const glm::vec4 planes[6], float x, float y, float z, float radius) {
+	for (int i = 0; i < 6; ++i) {
+		if (planes[i].x * x + planes[i].y * y + planes[i].z * z + planes[i].w <= -radius)
+			return false;
+	}
+	return true;
+}
+
+// *********************************************************************************
+
+SVKInstanceRenderer::SVKInstanceRenderer() :
+	m_logicalDevice(VK_NULL_HANDLE),
+	m_memoryAllocator(nullptr),
+	m_pipelineCache(nullptr),
+	m_meshBinding{},
+	m_meshRadius(0.0f),
+	m_frameCount(0),
+	m_instanceCount(0),
+	m_culling(Culling::None),
+	m_scale(0.0f),
+	m_frustumPlanes{},
+	m_offsetBuffer(VK_NULL_HANDLE),
+	m_offsetAllocation{},
+	m_colorBuffer(VK_NULL_HANDLE),
+	m_colorAllocation{},
+	m_pipeline(VK_NULL_HANDLE),
+	m_visibleColorBuffer(VK_NULL_HANDLE),
+	m_visibleColorAllocation{},
+	m_culledOffsetBuffer(VK_NULL_HANDLE),
+	m_culledOffsetAllocation{},
+	m_culledColorBuffer(VK_NULL_HANDLE),
+	m_culledColorAllocation{},
+	m_indirectBuffer(VK_NULL_HANDLE),
+	m_indirectAllocation{},
+	m_cullDescriptorSetLayout(VK_NULL_HANDLE),
+	m_cullDescriptorPool(VK_NULL_HANDLE),
+	m_cullDescriptorSet(VK_NULL_HANDLE),
+	m_cullPipelineLayout(VK_NULL_HANDLE),
+	m_cullPipeline(VK_NULL_HANDLE)
+{
+}
+
+void SVKInstanceRenderer::Initialize(
+	VkDevice logicalDevice,
+	SVKMemoryAllocator& memoryAllocator,
+	SVKUploadContext& uploadContext,
+	SVKPipelineCache& pipelineCache,
+	const std::filesystem::path& shaderDir,
+	VkRenderPass renderPass,
+	VkPipelineLayout pipelineLayout,
+	const VkVertexInputBindingDescription& meshBinding,
+	const std::vector<VkVertexInputAttributeDescription>& meshAttributes,
+	float meshRadius,
+	uint32_t frameCount,
+	uint32_t instanceCount,
+	Culling culling
+) {
+	m_instanceCount = instanceCount;
+	if (!IsEnabled())
+		return;
+
+	m_logicalDevice = logicalDevice;
+	m_memoryAllocator = &memoryAllocator;
+	m_pipelineCache = &pipelineCache;
+	m_shaderDir = shaderDir;
+	m_meshBinding = meshBinding;
+	m_meshAttributes = meshAttributes;
+	m_meshRadius = meshRadius;
+	m_frameCount = frameCount;
+	m_culling = culling;
+
+	CreateInstances(uploadContext);
+	CreatePipeline(renderPass, pipelineLayout);
+	if (m_culling == Culling::Gpu)
+		CreateCullPipeline();
+}
+
+void SVKInstanceRenderer::Cleanup() {
+	if (m_logicalDevice == VK_NULL_HANDLE)
+		return;
+
+	DestroyPipeline();
+
+	if (m_cullPipeline != VK_NULL_HANDLE) {
+		vkDestroyPipeline(m_logicalDevice, m_cullPipeline, nullptr);
+		m_cullPipeline = VK_NULL_HANDLE;
+		vkDestroyPipelineLayout(m_logicalDevice, m_cullPipelineLayout, nullptr);
+		m_cullPipelineLayout = VK_NULL_HANDLE;
+		vkDestroyDescriptorPool(m_logicalDevice, m_cullDescriptorPool, nullptr);
+		m_cullDescriptorPool = VK_NULL_HANDLE;
+		m_cullDescriptorSet = VK_NULL_HANDLE;
+		vkDestroyDescriptorSetLayout(m_logicalDevice, m_cullDescriptorSetLayout, nullptr);
+		m_cullDescriptorSetLayout = VK_NULL_HANDLE;
+	}
+
+	DestroyBuffer(m_offsetBuffer, m_offsetAllocation);
+	DestroyBuffer(m_colorBuffer, m_colorAllocation);
+	DestroyBuffer(m_visibleColorBuffer, m_visibleColorAllocation);
+	DestroyBuffer(m_culledOffsetBuffer, m_culledOffsetAllocation);
+	DestroyBuffer(m_culledColorBuffer, m_culledColorAllocation);
+	DestroyBuffer(m_indirectBuffer, m_indirectAllocation);
+
+	m_baseX.clear();
+	m_baseY.clear();
+	m_phases.clear();
+	m_colors.clear();
+	m_chunkVisibleCounts.clear();
+
+	m_logicalDevice = VK_NULL_HANDLE;
+}
+
+void SVKInstanceRenderer::CreatePipeline(VkRenderPass renderPass, VkPipelineLayout pipelineLayout) {
+	if (!IsEnabled())
+		return;
+
+	VkShaderModule shaderVertModule = CreateShaderModule("instance.vert.spv");
+	VkShaderModule shaderFragModule = CreateShaderModule("shader.frag.spv");
+
+	VkPipelineShaderStageCreateInfo shaderStages[2]{};
+	shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	shaderStages[0].module = shaderVertModule;
+	shaderStages[0].pName = "main";
+	shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	shaderStages[1].module = shaderFragModule;
+	shaderStages[1].pName = "main";
+
+	// the mesh advances per vertex, the instance streams once per instance
+	std::vector<VkVertexInputBindingDescription> bindings(3);
+	bindings[0] = m_meshBinding;
+	bindings[1].binding = 1;
+	bindings[1].stride = sizeof(OffsetScale);
+	bindings[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+	bindings[2].binding = 2;
+	bindings[2].stride = sizeof(uint32_t);
+	bindings[2].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+	std::vector<VkVertexInputAttributeDescription> attributes = m_meshAttributes;
+	VkVertexInputAttributeDescription offsetAttribute{};
+	offsetAttribute.binding = 1;
+	offsetAttribute.location = 2;
+	offsetAttribute.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+	offsetAttribute.offset = 0;
+	attributes.push_back(offsetAttribute);
+	VkVertexInputAttributeDescription colorAttribute{};
+	colorAttribute.binding = 2;
+	colorAttribute.location = 3;
+	colorAttribute.format = VK_FORMAT_R8G8B8A8_UNORM;
+	colorAttribute.offset = 0;
+	attributes.push_back(colorAttribute);
+
+	VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindings.size());
+	vertexInputInfo.pVertexBindingDescriptions = bindings.data();
+	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributes.size());
+	vertexInputInfo.pVertexAttributeDescriptions = attributes.data();
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+	VkPipelineViewportStateCreateInfo viewportState{};
+	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportState.viewportCount = 1;
+	viewportState.scissorCount = 1;
+
+	VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+	VkPipelineDynamicStateCreateInfo dynamicState{};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = 2;
+	dynamicState.pDynamicStates = dynamicStates;
+
+	VkPipelineRasterizationStateCreateInfo rasterizer{};
+	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizer.depthClampEnable = VK_FALSE;
+	rasterizer.rasterizerDiscardEnable = VK_FALSE;
+	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizer.lineWidth = 1.0f;
+	rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+	rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+	VkPipelineMultisampleStateCreateInfo multisampling{};
+	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+	multisampling.minSampleShading = 1.0f;
+
+	VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+	colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	colorBlendAttachment.blendEnable = VK_FALSE;
+
+	VkPipelineColorBlendStateCreateInfo colorBlending{};
+	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlending.logicOpEnable = VK_FALSE;
+	colorBlending.attachmentCount = 1;
+	colorBlending.pAttachments = &colorBlendAttachment;
+
+	VkGraphicsPipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineInfo.stageCount = 2;
+	pipelineInfo.pStages = shaderStages;
+	pipelineInfo.pVertexInputState = &vertexInputInfo;
+	pipelineInfo.pInputAssemblyState = &inputAssembly;
+	pipelineInfo.pViewportState = &viewportState;
+	pipelineInfo.pRasterizationState = &rasterizer;
+	pipelineInfo.pMultisampleState = &multisampling;
+	pipelineInfo.pColorBlendState = &colorBlending;
+	pipelineInfo.pDynamicState = &dynamicState;
+	pipelineInfo.layout = pipelineLayout;
+	pipelineInfo.renderPass = renderPass;
+	pipelineInfo.subpass = 0;
+	pipelineInfo.basePipelineIndex = -1;
+
+	auto startTm = std::chrono::high_resolution_clock::now();
+	vkCheckResult(vkCreateGraphicsPipelines(m_logicalDevice, m_pipelineCache->Get(), 1, &pipelineInfo, nullptr, &m_pipeline), "Create Instance Pipeline");
+	std::chrono::duration<double, std::milli> createTm = std::chrono::high_resolution_clock::now() - startTm;
+	m_pipelineCache->RecordCreation("instances", createTm.count());
+
+	vkDestroyShaderModule(m_logicalDevice, shaderVertModule, nullptr);
+	vkDestroyShaderModule(m_logicalDevice, shaderFragModule, nullptr);
+}
+
+void SVKInstanceRenderer::DestroyPipeline() {
+	if (m_pipeline == VK_NULL_HANDLE)
+		return;
+
+	vkDestroyPipeline(m_logicalDevice, m_pipeline, nullptr);
+	m_pipeline = VK_NULL_HANDLE;
+}
+
+bool SVKInstanceRenderer::IsEnabled() const {
+	return m_instanceCount != 0;
+}
+
+uint32_t SVKInstanceRenderer::GetInstanceCount() const {
+	return m_instanceCount;
+}
+
+SVKInstanceRenderer::Culling SVKInstanceRenderer::GetCulling() const {
+	return m_culling;
+}
+
+uint32_t SVKInstanceRenderer::GetVisibleCount() const {
+	uint32_t visibleCount = 0;
+	for (uint32_t chunkVisibleCount : m_chunkVisibleCounts)
+		visibleCount += chunkVisibleCount;
+	return visibleCount;
+}
+
+uint32_t SVKInstanceRenderer::GetDrawCount() const {
+	if (m_culling != Culling::Cpu)
+		return IsEnabled() ? 1 : 0;
+
+	return static_cast<uint32_t>(std::count_if(m_chunkVisibleCounts.begin(), m_chunkVisibleCounts.end(), [](uint32_t count) { return count > 0; }));
+}
+
+bool SVKInstanceRenderer::GetCulling(const std::string& name, Culling& culling) {
+	for (size_t i = 0; i < sizeof(g_cullingNames) / sizeof(g_cullingNames[0]); ++i) {
+		if (name == g_cullingNames[i]) {
+			culling = static_cast<Culling>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* SVKInstanceRenderer::GetCullingName(Culling culling) {
+	return g_cullingNames[static_cast<size_t>(culling)];
+}
+
+void SVKInstanceRenderer::Update(uint32_t frame, float time, const glm::mat4& viewProjection, SVKJobSystem& jobSystem) {
+	if (!IsEnabled())
+		return;
+
+	ExtractFrustumPlanes(viewProjection, m_frustumPlanes);
+
+	// sequential writes only: the memory is likely write-combined and must not be read
+	OffsetScale* offsets = static_cast<OffsetScale*>(m_offsetAllocation.mappedData) + static_cast<size_t>(frame) * m_instanceCount;
+	const float* baseX = m_baseX.data();
+	const float* baseY = m_baseY.data();
+	const float* phases = m_phases.data();
+	float scale = m_scale;
+	float wavePhase = time * g_waveSpeed;
+
+	if (m_culling != Culling::Cpu) {
+		jobSystem.ParallelFor(m_instanceCount, g_minInstancesPerJob, [=](uint32_t begin, uint32_t end) {
+			for (uint32_t i = begin; i < end; ++i)
+				offsets[i] = { baseX[i], baseY[i], g_waveHeight * std::sin(wavePhase + phases[i]), scale };
+		});
+		return;
+	}
+
+	// the visible instances of a chunk are packed at the start of the chunk, so the chunks need no prefix sum and
+	// each one is drawn with its own first instance
+	uint32_t* visibleColors = static_cast<uint32_t*>(m_visibleColorAllocation.mappedData) + static_cast<size_t>(frame) * m_instanceCount;
+	const uint32_t* colors = m_colors.data();
+	uint32_t* chunkVisibleCounts = m_chunkVisibleCounts.data();
+	const glm::vec4* planes = m_frustumPlanes;
+	float radius = m_meshRadius * m_scale;
+	uint32_t instanceCount = m_instanceCount;
+
+	jobSystem.ParallelFor(static_cast<uint32_t>(m_chunkVisibleCounts.size()), 1, [=](uint32_t beginChunk, uint32_t endChunk) {
+		for (uint32_t chunk = beginChunk; chunk < endChunk; ++chunk) {
+			uint32_t begin = chunk * g_cullChunkSize;
+			uint32_t end = std::min(begin + g_cullChunkSize, instanceCount);
+			uint32_t visible = begin;
+			for (uint32_t i = begin; i < end; ++i) {
+				float z = g_waveHeight * std::sin(wavePhase + phases[i]);
+				if (!IsSphereVisible(planes, baseX[i], baseY[i], z, radius))
+					continue;
+
+				offsets[visible] = { baseX[i], baseY[i], z, scale };
+				visibleColors[visible] = colors[i];
+				++visible;
+			}
+			chunkVisibleCounts[chunk] = visible - begin;
+		}
+	});
+}
+
+void SVKInstanceRenderer::RecordCull(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t indexCount) {
+	if (m_culling != Culling::Gpu)
+		return;
+
+	// the shader counts the visible instances into instanceCount
+	VkDrawIndexedIndirectCommand command{};
+	command.indexCount = indexCount;
+	VkDeviceSize commandOffset = static_cast<VkDeviceSize>(frame) * sizeof(VkDrawIndexedIndirectCommand);
+	vkCmdUpdateBuffer(commandBuffer, m_indirectBuffer, commandOffset, sizeof(command), &command);
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	CullConstants constants{};
+	std::copy(m_frustumPlanes, m_frustumPlanes + 6, constants.planes);
+	constants.instanceCount = m_instanceCount;
+	constants.inputBase = frame * m_instanceCount;
+	constants.outputBase = frame * m_instanceCount;
+	constants.commandIndex = frame;
+	constants.boundingRadius = m_meshRadius;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_cullPipelineLayout, 0, 1, &m_cullDescriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, m_cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+	vkCmdDispatch(commandBuffer, (m_instanceCount + g_cullWorkGroupSize - 1) / g_cullWorkGroupSize, 1, 1);
+
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void SVKInstanceRenderer::RecordDraw(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t indexCount) {
+	if (!IsEnabled())
+		return;
+
+	VkDeviceSize offsetRegion = static_cast<VkDeviceSize>(frame) * m_instanceCount * sizeof(OffsetScale);
+	VkDeviceSize colorRegion = static_cast<VkDeviceSize>(frame) * m_instanceCount * sizeof(uint32_t);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline);
+
+	if (m_culling == Culling::Gpu) {
+		VkBuffer instanceBuffers[] = { m_culledOffsetBuffer, m_culledColorBuffer };
+		VkDeviceSize offsets[] = { offsetRegion, colorRegion };
+		vkCmdBindVertexBuffers(commandBuffer, 1, 2, instanceBuffers, offsets);
+		vkCmdDrawIndexedIndirect(commandBuffer, m_indirectBuffer, static_cast<VkDeviceSize>(frame) * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+	}
+	else if (m_culling == Culling::Cpu) {
+		VkBuffer instanceBuffers[] = { m_offsetBuffer, m_visibleColorBuffer };
+		VkDeviceSize offsets[] = { offsetRegion, colorRegion };
+		vkCmdBindVertexBuffers(commandBuffer, 1, 2, instanceBuffers, offsets);
+		for (size_t chunk = 0; chunk < m_chunkVisibleCounts.size(); ++chunk) {
+			if (m_chunkVisibleCounts[chunk] > 0)
+				vkCmdDrawIndexed(commandBuffer, indexCount, m_chunkVisibleCounts[chunk], 0, 0, static_cast<uint32_t>(chunk) * g_cullChunkSize);
+		}
+	}
+	else {
+		VkBuffer instanceBuffers[] = { m_offsetBuffer, m_colorBuffer };
+		VkDeviceSize offsets[] = { offsetRegion, 0 };
+		vkCmdBindVertexBuffers(commandBuffer, 1, 2, instanceBuffers, offsets);
+		vkCmdDrawIndexed(commandBuffer, indexCount, m_instanceCount, 0, 0, 0);
+	}
+}
+
+void SVKInstanceRenderer::CreateInstances(SVKUploadContext& uploadContext) {
+	// a square grid in the z = 0 plane, the wave travels along the diagonal
+	uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(m_instanceCount))));
+	float spacing = 2.0f * g_gridExtent / side;
+	m_scale = 0.8f * spacing;
+
+	m_baseX.resize(m_instanceCount);
+	m_baseY.resize(m_instanceCount);
+	m_phases.resize(m_instanceCount);
+	m_colors.resize(m_instanceCount);
+	for (uint32_t i = 0; i < m_instanceCount; ++i) {
+		float u = (i % side + 0.5f) / side;
+		float v = (i / side + 0.5f) / side;
+		m_baseX[i] = (2.0f * u - 1.0f) * g_gridExtent;
+		m_baseY[i] = (2.0f * v - 1.0f) * g_gridExtent;
+		m_phases[i] = (u + v) * 8.0f;
+
+		uint32_t r = static_cast<uint32_t>(255.0f * u);
+		uint32_t g = static_cast<uint32_t>(255.0f * v);
+		uint32_t b = static_cast<uint32_t>(255.0f * (1.0f - 0.5f * (u + v)));
+		m_colors[i] = r | (g << 8) | (b << 16) | (255u << 24);
+	}
+
+	VkDeviceSize offsetSize = sizeof(OffsetScale) * static_cast<VkDeviceSize>(m_instanceCount);
+	VkDeviceSize colorSize = sizeof(uint32_t) * static_cast<VkDeviceSize>(m_instanceCount);
+
+	// with GPU culling the streams are read by the cull shader instead of the vertex input
+	VkBufferUsageFlags streamUsage = m_culling == Culling::Gpu ? VK_BUFFER_USAGE_STORAGE_BUFFER_BIT : VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	m_colorBuffer = CreateBuffer(
+		colorSize,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | streamUsage,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		m_colorAllocation
+	);
+	if (m_culling == Culling::Gpu)
+		uploadContext.UploadBuffer(m_colorBuffer, m_colors.data(), colorSize, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	else
+		uploadContext.UploadBuffer(m_colorBuffer, m_colors.data(), colorSize, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+
+	// read by the GPU straight from host memory, once per frame
+	m_offsetBuffer = CreateBuffer(
+		offsetSize * m_frameCount,
+		streamUsage,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		m_offsetAllocation
+	);
+
+	if (m_culling == Culling::Cpu) {
+		// the colors only need to be kept on the CPU for the compaction
+		m_visibleColorBuffer = CreateBuffer(
+			colorSize * m_frameCount,
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			m_visibleColorAllocation
+		);
+		m_chunkVisibleCounts.assign((m_instanceCount + g_cullChunkSize - 1) / g_cullChunkSize, 0);
+	}
+	else {
+		m_colors.clear();
+		m_colors.shrink_to_fit();
+	}
+
+	if (m_culling == Culling::Gpu) {
+		m_culledOffsetBuffer = CreateBuffer(offsetSize * m_frameCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_culledOffsetAllocation);
+		m_culledColorBuffer = CreateBuffer(colorSize * m_frameCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_culledColorAllocation);
+		m_indirectBuffer = CreateBuffer(
+			sizeof(VkDrawIndexedIndirectCommand) * static_cast<VkDeviceSize>(m_frameCount),
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			m_indirectAllocation
+		);
+	}
+}
+
+void SVKInstanceRenderer::CreateCullPipeline() {
+	VkBuffer buffers[5] = { m_offsetBuffer, m_colorBuffer, m_culledOffsetBuffer, m_culledColorBuffer, m_indirectBuffer };
+
+	VkDescriptorSetLayoutBinding bindings[5]{};
+	for (uint32_t i = 0; i < 5; ++i) {
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = 5;
+	layoutInfo.pBindings = bindings;
+
+	vkCheckResult(vkCreateDescriptorSetLayout(m_logicalDevice, &layoutInfo, nullptr, &m_cullDescriptorSetLayout), "Create Cull DescriptorSetLayout");
+
+	VkDescriptorPoolSize poolSize{};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = 5;
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	poolInfo.maxSets = 1;
+
+	vkCheckResult(vkCreateDescriptorPool(m_logicalDevice, &poolInfo, nullptr, &m_cullDescriptorPool), "Create Cull DescriptorPool");
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = m_cullDescriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &m_cullDescriptorSetLayout;
+
+	vkCheckResult(vkAllocateDescriptorSets(m_logicalDevice, &allocInfo, &m_cullDescriptorSet), "Allocate Cull DescriptorSet");
+
+	// whole buffers, the frame's regions are selected by the push constants
+	VkDescriptorBufferInfo bufferInfos[5]{};
+	VkWriteDescriptorSet descriptorWrites[5]{};
+	for (uint32_t i = 0; i < 5; ++i) {
+		bufferInfos[i].buffer = buffers[i];
+		bufferInfos[i].offset = 0;
+		bufferInfos[i].range = VK_WHOLE_SIZE;
+
+		descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[i].dstSet = m_cullDescriptorSet;
+		descriptorWrites[i].dstBinding = i;
+		descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[i].descriptorCount = 1;
+		descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+	}
+	vkUpdateDescriptorSets(m_logicalDevice, 5, descriptorWrites, 0, nullptr);
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(CullConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &m_cullDescriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	vkCheckResult(vkCreatePipelineLayout(m_logicalDevice, &pipelineLayoutInfo, nullptr, &m_cullPipelineLayout), "Create Cull PipelineLayout");
+
+	VkShaderModule shaderModule = CreateShaderModule("instance_cull.comp.spv");
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = shaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = m_cullPipelineLayout;
+
+	auto startTm = std::chrono::high_resolution_clock::now();
+	vkCheckResult(vkCreateComputePipelines(m_logicalDevice, m_pipelineCache->Get(), 1, &pipelineInfo, nullptr, &m_cullPipeline), "Create Cull Pipeline");
+	std::chrono::duration<double, std::milli> createTm = std::chrono::high_resolution_clock::now() - startTm;
+	m_pipelineCache->RecordCreation("instanceCull", createTm.count());
+
+	vkDestroyShaderModule(m_logicalDevice, shaderModule, nullptr);
+}
+
+VkBuffer SVKInstanceRenderer::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, SVKMemoryAllocator::Allocation& allocation) {
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkBuffer buffer;
+	vkCheckResult(vkCreateBuffer(m_logicalDevice, &bufferInfo, nullptr, &buffer), "Create Instance Buffer");
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(m_logicalDevice, buffer, &memRequirements);
+
+	allocation = m_memoryAllocator->Allocate(memRequirements, properties, SVKMemoryAllocator::Strategy::General, false);
+	vkCheckResult(vkBindBufferMemory(m_logicalDevice, buffer, allocation.memory, allocation.offset), "Bind Instance Buffer Memory");
+	return buffer;
+}
+
+void SVKInstanceRenderer::DestroyBuffer(VkBuffer& buffer, SVKMemoryAllocator::Allocation& allocation) {
+	if (buffer == VK_NULL_HANDLE)
+		return;
+
+	vkDestroyBuffer(m_logicalDevice, buffer, nullptr);
+	buffer = VK_NULL_HANDLE;
+	m_memoryAllocator->Free(allocation);
+}
+
+VkShaderModule SVKInstanceRenderer::CreateShaderModule(const char* shaderName) {
+	std::vector<char> code = ReadFile((m_shaderDir / shaderName).string());
+
+	VkShaderModuleCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	createInfo.codeSize = code.size();
+	createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+
+	VkShaderModule shaderModule;
+	vkCheckResult(vkCreateShaderModule(m_logicalDevice, &createInfo, nullptr, &shaderModule), "Create Instance ShaderModule");
+	return shaderModule;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include "common.h"
+
+#include "SVKMemoryAllocator.h"
+#include "SVKUploadContext.h"
+#include "SVKPipelineCache.h"
+#include "SVKJobSystem.h"
+
+// Draws many copies of a mesh in a single instanced draw. Besides the mesh at
+// vertex binding 0, every per-instance attribute has a stream of its own
+// (structure of arrays): the offsets and scales at binding 1 change every
+// frame and are written by the job system into a host-visible buffer with one
+// region per frame in flight, the colors at binding 2 never change and live in
+// device local memory. The mesh, the index buffer and the descriptor set of
+// the application pipeline layout are bound by the caller.
+//
+// Instances outside the view frustum can be culled:
+//  Cpu - the update compacts the visible instances of each chunk into the
+//        frame's streams (colors included) and every chunk with a visible
+//        instance becomes a draw, so the recording grows with the view.
+//  Gpu - RecordCull() resets the frame's indirect command and dispatches
+//        instance_cull.comp, which compacts the visible instances into device
+//        local streams and counts them in the command. The recording is one
+//        dispatch and one indirect draw whatever is visible.
+class SVKInstanceRenderer
+{
+public:
+	enum class Culling {
+		None,
+		Cpu,
+		Gpu
+	};
+
+	// per-instance stream at binding 1
+	struct OffsetScale {
+		float x, y, z;
+		float scale;
+	};
+
+	// push constants of instance_cull.comp
+	struct CullConstants {
+		glm::vec4 planes[6];
+		uint32_t instanceCount;
+		uint32_t inputBase;
+		uint32_t outputBase;
+		uint32_t commandIndex;
+		float boundingRadius;
+	};
+
+	static const uint32_t g_minInstancesPerJob;
+	static const uint32_t g_cullChunkSize;
+	static const uint32_t g_cullWorkGroupSize;
+	static const float g_gridExtent;
+	static const float g_waveHeight;
+	static const float g_waveSpeed;
+
+public:
+	SVKInstanceRenderer();
+
+	void Initialize(
+		VkDevice logicalDevice,
+		SVKMemoryAllocator& memoryAllocator,
+		SVKUploadContext& uploadContext,
+		SVKPipelineCache& pipelineCache,
+		const std::filesystem::path& shaderDir,
+		VkRenderPass renderPass,
+		VkPipelineLayout pipelineLayout,
+		const VkVertexInputBindingDescription& meshBinding,
+		const std::vector<VkVertexInputAttributeDescription>& meshAttributes,
+		float meshRadius,
+		uint32_t frameCount,
+		uint32_t instanceCount,
+		Culling culling
+	);
+	void Cleanup();
+
+	// the pipeline depends on the render pass and the application pipeline layout and is rebuilt with them
+	void CreatePipeline(VkRenderPass renderPass, VkPipelineLayout pipelineLayout);
+	void DestroyPipeline();
+
+	bool IsEnabled() const;
+	uint32_t GetInstanceCount() const;
+	Culling GetCulling() const;
+	// of the last update with CPU culling
+	uint32_t GetVisibleCount() const;
+	uint32_t GetDrawCount() const;
+
+	static bool GetCulling(const std::string& name, Culling& culling);
+	static const char* GetCullingName(Culling culling);
+
+	// writes the offsets of the frame's region; the frame's previous submission must have finished. With CPU
+	// culling the draws depend on it, so it runs before the frame is recorded
+	void Update(uint32_t frame, float time, const glm::mat4& viewProjection, SVKJobSystem& jobSystem);
+	// GPU culling: outside the render pass, before the draw
+	void RecordCull(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t indexCount);
+	void RecordDraw(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t indexCount);
+
+protected:
+	void CreateInstances(SVKUploadContext& uploadContext);
+	void CreateCullPipeline();
+	VkBuffer CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, SVKMemoryAllocator::Allocation& allocation);
+	void DestroyBuffer(VkBuffer& buffer, SVKMemoryAllocator::Allocation& allocation);
+	VkShaderModule CreateShaderModule(const char* shaderName);
+
+protected:
+	VkDevice m_logicalDevice;
+	SVKMemoryAllocator* m_memoryAllocator;
+	SVKPipelineCache* m_pipelineCache;
+	std::filesystem::path m_shaderDir;
+	VkVertexInputBindingDescription m_meshBinding;
+	std::vector<VkVertexInputAttributeDescription> m_meshAttributes;	// locations 0 and 1 of instance.vert
+	float m_meshRadius;
+	uint32_t m_frameCount;
+	uint32_t m_instanceCount;
+	Culling m_culling;
+
+	// animation input, one array per component so the update loop streams through them
+	std::vector<float> m_baseX;
+	std::vector<float> m_baseY;
+	std::vector<float> m_phases;
+	std::vector<uint32_t> m_colors;
+	float m_scale;
+	glm::vec4 m_frustumPlanes[6];
+
+	VkBuffer m_offsetBuffer;
+	SVKMemoryAllocator::Allocation m_offsetAllocation;
+	VkBuffer m_colorBuffer;
+	SVKMemoryAllocator::Allocation m_colorAllocation;
+	VkPipeline m_pipeline;
+
+	// CPU culling: the frame's visible colors, compacted like the offsets
+	VkBuffer m_visibleColorBuffer;
+	SVKMemoryAllocator::Allocation m_visibleColorAllocation;
+	std::vector<uint32_t> m_chunkVisibleCounts;
+
+	// GPU culling
+	VkBuffer m_culledOffsetBuffer;
+	SVKMemoryAllocator::Allocation m_culledOffsetAllocation;
+	VkBuffer m_culledColorBuffer;
+	SVKMemoryAllocator::Allocation m_culledColorAllocation;
+	VkBuffer m_indirectBuffer;	// one VkDrawIndexedIndirectCommand per frame in flight
+	SVKMemoryAllocator::Allocation m_indirectAllocation;
+	VkDescriptorSetLayout m_cullDescriptorSetLayout;
+	VkDescriptorPool m_cullDescriptorPool;
+	VkDescriptorSet m_cullDescriptorSet;
+	VkPipelineLayout m_cullPipelineLayout;
+	VkPipeline m_cullPipeline;
+};
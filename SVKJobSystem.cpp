@@ -0,0 +1,244 @@
+#include "SVKJobSystem.h"
+
+// more ranges than threads, so threads that finish early steal the rest of a slow one
+static const uint32_t g_rangesPerThread = 4;
+
+static thread_local const SVKJobSystem* g_currentJobSystem = nullptr;
+static thread_local uint32_t g_currentThreadIndex = 0;
+
+SVKJobSystem::Counter::Counter() :
+	m_pendingCount(0)
+{
+}
+
+bool SVKJobSystem::Counter::IsDone() const {
+	return m_pendingCount == 0;
+}
+
+// *********************************************************************************
+
+SVKJobSystem::SVKJobSystem() :
+	m_threadCount(0),
+	m_activeThreadCount(0),
+	m_queuedCount(0),
+	m_closing(false)
+{
+}
+
+SVKJobSystem::~SVKJobSystem() {
+	Cleanup();
+}
+
+void SVKJobSystem::Initialize(uint32_t threadCount) {
+	m_threadCount = threadCount > 0 ? threadCount : std::max(std::thread::hardware_concurrency(), 1u);
+	m_activeThreadCount = m_threadCount;
+	m_queuedCount = 0;
+	m_closing = false;
+
+	m_queues.clear();
+	for (uint32_t thread = 0; thread < m_threadCount; ++thread)
+		m_queues.push_back(std::make_unique<Queue>());
+
+	g_currentJobSystem = this;
+	g_currentThreadIndex = 0;
+	for (uint32_t thread = 1; thread < m_threadCount; ++thread)
+		m_workers.emplace_back(&SVKJobSystem::WorkerMain, this, thread);
+}
+
+void SVKJobSystem::Cleanup() {
+	if (m_threadCount == 0)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closing = true;
+	}
+	m_workAvailable.notify_all();
+	m_activeCountChanged.notify_all();
+	for (std::thread& worker : m_workers)
+		worker.join();
+	m_workers.clear();
+	m_queues.clear();
+
+	if (g_currentJobSystem == this)
+		g_currentJobSystem = nullptr;
+	m_threadCount = 0;
+}
+
+uint32_t SVKJobSystem::GetThreadCount() const {
+	return m_threadCount;
+}
+
+void SVKJobSystem::SetActiveThreadCount(uint32_t threadCount) {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_activeThreadCount = std::max(std::min(threadCount, m_threadCount), 1u);
+	}
+	m_workAvailable.notify_all();
+	m_activeCountChanged.notify_all();
+}
+
+uint32_t SVKJobSystem::GetActiveThreadCount() const {
+	return m_activeThreadCount;
+}
+
+uint32_t SVKJobSystem::GetThreadIndex() const {
+	return g_currentJobSystem == this ? g_currentThreadIndex : 0;
+}
+
+void SVKJobSystem::Run(Job job, Counter* counter, Counter* dependency) {
+	if (counter)
+		++counter->m_pendingCount;
+
+	if (dependency) {
+		std::lock_guard<std::mutex> lock(dependency->m_mutex);
+		if (dependency->m_pendingCount > 0) {
+			dependency->m_dependents.emplace_back(std::move(job), counter);
+			return;
+		}
+	}
+
+	Schedule({ std::move(job), counter });
+}
+
+void SVKJobSystem::Wait(Counter& counter) {
+	uint32_t thread = GetThreadIndex();
+	while (counter.m_pendingCount > 0) {
+		Task task;
+		if (Pop(thread, task) || Steal(thread, task))
+			Execute(task);
+		else
+			std::this_thread::yield();
+	}
+
+	// the last job releases the mutex after the count reached zero; the counter may be destroyed once this returns
+	std::lock_guard<std::mutex> lock(counter.m_mutex);
+	if (counter.m_error) {
+		std::exception_ptr error = counter.m_error;
+		counter.m_error = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+void SVKJobSystem::ParallelFor(uint32_t count, uint32_t minRangeSize, const RangeJob& job) {
+	if (count == 0)
+		return;
+
+	uint32_t rangeCount = std::min(GetActiveThreadCount() * g_rangesPerThread, count / std::max(minRangeSize, 1u));
+	if (GetActiveThreadCount() <= 1 || rangeCount <= 1) {
+		job(0, count);
+		return;
+	}
+
+	uint32_t rangeSize = (count + rangeCount - 1) / rangeCount;
+	Counter counter;
+	for (uint32_t begin = rangeSize; begin < count; begin += rangeSize) {
+		uint32_t end = std::min(begin + rangeSize, count);
+		Run([&job, begin, end]() { job(begin, end); }, &counter);
+	}
+
+	// the calling thread takes the first range, then helps with the others
+	Run([&job, rangeSize]() { job(0, rangeSize); }, &counter);
+	Wait(counter);
+}
+
+void SVKJobSystem::WorkerMain(uint32_t thread) {
+	g_currentJobSystem = this;
+	g_currentThreadIndex = thread;
+
+	for (;;) {
+		Task task;
+		if (thread < m_activeThreadCount && (Pop(thread, task) || Steal(thread, task))) {
+			Execute(task);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (thread < m_activeThreadCount)
+			m_workAvailable.wait(lock, [this, thread]() { return m_closing || thread >= m_activeThreadCount || m_queuedCount > 0; });
+		else
+			m_activeCountChanged.wait(lock, [this, thread]() { return m_closing || thread < m_activeThreadCount; });
+		if (m_closing)
+			return;
+	}
+}
+
+void SVKJobSystem::Schedule(Task task) {
+	if (m_queues.empty()) {
+		// not initialized, run on the caller
+		Execute(task);
+		return;
+	}
+	Push(GetThreadIndex(), std::move(task));
+}
+
+void SVKJobSystem::Push(uint32_t thread, Task task) {
+	{
+		// counted under the mutex, so a worker going to sleep cannot miss it, and before the task is visible, so
+		// the Pop() or Steal() that takes it can never decrement the count below zero
+		std::lock_guard<std::mutex> lock(m_mutex);
+		++m_queuedCount;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_queues[thread]->mutex);
+		m_queues[thread]->tasks.push_back(std::move(task));
+	}
+	// only active workers wait for this one, so a single wake-up cannot get lost on a parked worker
+	m_workAvailable.notify_one();
+}
+
+bool SVKJobSystem::Pop(uint32_t thread, Task& task) {
+	Queue& queue = *m_queues[thread];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.tasks.empty())
+		return false;
+
+	task = std::move(queue.tasks.back());
+	queue.tasks.pop_back();
+	--m_queuedCount;
+	return true;
+}
+
+bool SVKJobSystem::Steal(uint32_t thread, Task& task) {
+	for (uint32_t i = 1; i < m_threadCount; ++i) {
+		Queue& queue = *m_queues[(thread + i) % m_threadCount];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty())
+			continue;
+
+		task = std::move(queue.tasks.front());
+		queue.tasks.pop_front();
+		--m_queuedCount;
+		return true;
+	}
+	return false;
+}
+
+void SVKJobSystem::Execute(Task& task) {
+	try {
+		task.job();
+	}
+	catch (...) {
+		if (!task.counter) {
+			// nobody waits for the job, so nobody could handle its failure
+			std::cerr << "Job system: a job without counter failed" << std::endl;
+			std::terminate();
+		}
+		std::lock_guard<std::mutex> lock(task.counter->m_mutex);
+		if (!task.counter->m_error)
+			task.counter->m_error = std::current_exception();
+	}
+
+	if (!task.counter)
+		return;
+
+	std::vector<std::pair<Job, Counter*>> dependents;
+	{
+		std::lock_guard<std::mutex> lock(task.counter->m_mutex);
+		if (--task.counter->m_pendingCount == 0)
+			dependents.swap(task.counter->m_dependents);
+	}
+	// their counters were incremented when they were held back
+	for (std::pair<Job, Counter*>& dependent : dependents)
+		Schedule({ std::move(dependent.first), dependent.second });
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "common.h"
+
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <exception>
+
+// Work-stealing job scheduler. Every thread owns a deque: it pushes and pops its
+// own jobs at the back (newest first, still warm in its cache) while idle
+// threads steal the oldest jobs from the front of the others. The thread that
+// calls Initialize() is thread 0 and runs jobs while it waits, the remaining
+// threads are workers.
+//
+// Jobs are grouped with counters: Run() increments the counter, the job
+// decrements it when it is done, Wait() runs jobs until it reaches zero. A job
+// queued with a dependency is held back until that counter reaches zero, which
+// chains jobs without blocking a thread.
+class SVKJobSystem
+{
+public:
+	typedef std::function<void()> Job;
+	typedef std::function<void(uint32_t begin, uint32_t end)> RangeJob;
+
+	class Counter
+	{
+	public:
+		Counter();
+
+		bool IsDone() const;
+
+	protected:
+		friend class SVKJobSystem;
+
+		std::atomic<uint32_t> m_pendingCount;
+		std::mutex m_mutex;
+		std::vector<std::pair<Job, Counter*>> m_dependents;	// queued once the counter reaches zero
+		std::exception_ptr m_error;
+	};
+
+public:
+	SVKJobSystem();
+	~SVKJobSystem();
+
+	void Initialize(uint32_t threadCount);
+	void Cleanup();
+
+	uint32_t GetThreadCount() const;
+	void SetActiveThreadCount(uint32_t threadCount);
+	uint32_t GetActiveThreadCount() const;
+	// index of the calling thread, below GetThreadCount(); threads outside the system count as thread 0
+	uint32_t GetThreadIndex() const;
+
+	void Run(Job job, Counter* counter = nullptr, Counter* dependency = nullptr);
+	// rethrows the first exception of the counter's jobs
+	void Wait(Counter& counter);
+	// splits [0, count) into ranges of at least minRangeSize and waits for all of them
+	void ParallelFor(uint32_t count, uint32_t minRangeSize, const RangeJob& job);
+
+protected:
+	struct Task {
+		Job job;
+		Counter* counter;
+	};
+
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	void WorkerMain(uint32_t thread);
+	void Schedule(Task task);
+	void Push(uint32_t thread, Task task);
+	bool Pop(uint32_t thread, Task& task);
+	bool Steal(uint32_t thread, Task& task);
+	void Execute(Task& task);
+
+protected:
+	uint32_t m_threadCount;
+	std::atomic<uint32_t> m_activeThreadCount;
+	std::vector<std::unique_ptr<Queue>> m_queues;
+	std::vector<std::thread> m_workers;
+
+	std::mutex m_mutex;
+	std::condition_variable m_workAvailable;		// active workers wait here for queued jobs
+	std::condition_variable m_activeCountChanged;	// workers parked by SetActiveThreadCount() wait here
+	std::atomic<uint32_t> m_queuedCount;
+	bool m_closing;
+};
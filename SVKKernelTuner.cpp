@@ -0,0 +1,257 @@
+#include "SVKKernelTuner.h"
+
+const uint32_t SVKKernelTuner::g_repeatCount = 5;
+
+SVKKernelTuner::SVKKernelTuner() :
+	m_logicalDevice(VK_NULL_HANDLE),
+	m_queue(VK_NULL_HANDLE),
+	m_commandPool(VK_NULL_HANDLE),
+	m_commandBuffer(VK_NULL_HANDLE),
+	m_queryPool(VK_NULL_HANDLE),
+	m_fence(VK_NULL_HANDLE),
+	m_timestampPeriod(0.0),
+	m_timestampMask(0),
+	m_dirty(false)
+{
+}
+
+void SVKKernelTuner::Initialize(
+	VkPhysicalDevice physicalDevice,
+	VkDevice logicalDevice,
+	uint32_t queueFamilyIndex,
+	VkQueue queue,
+	const std::filesystem::path& cachePath
+) {
+	m_logicalDevice = logicalDevice;
+	m_queue = queue;
+	m_cachePath = cachePath;
+	m_dirty = false;
+
+	VkPhysicalDeviceProperties physicalDeviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+
+	// a new driver may change the best variant, so its version is part of the key
+	std::stringstream ss;
+	ss << std::hex << physicalDeviceProperties.vendorID << ':' << physicalDeviceProperties.deviceID << ':' << physicalDeviceProperties.driverVersion;
+	m_deviceKey = ss.str();
+
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+	uint32_t timestampValidBits = queueFamilies[queueFamilyIndex].timestampValidBits;
+	if (timestampValidBits != 0 && physicalDeviceProperties.limits.timestampPeriod != 0.0f) {
+		m_timestampPeriod = physicalDeviceProperties.limits.timestampPeriod;
+		m_timestampMask = timestampValidBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << timestampValidBits) - 1;
+
+		VkQueryPoolCreateInfo queryPoolInfo{};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = 2;
+
+		vkCheckResult(vkCreateQueryPool(m_logicalDevice, &queryPoolInfo, nullptr, &m_queryPool), "Create Tuner QueryPool");
+	}
+	else
+		std::cerr << "Kernel tuner: timestamps are not supported, timing on the CPU" << std::endl;
+
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	poolInfo.queueFamilyIndex = queueFamilyIndex;
+
+	vkCheckResult(vkCreateCommandPool(m_logicalDevice, &poolInfo, nullptr, &m_commandPool), "Create Tuner CommandPool");
+
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = m_commandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = 1;
+
+	vkCheckResult(vkAllocateCommandBuffers(m_logicalDevice, &allocInfo, &m_commandBuffer), "Allocate Tuner CommandBuffer");
+
+	VkFenceCreateInfo fenceInfo{};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+	vkCheckResult(vkCreateFence(m_logicalDevice, &fenceInfo, nullptr, &m_fence), "Create Tuner Fence");
+
+	Load();
+}
+
+void SVKKernelTuner::Save() {
+	if (!m_dirty || m_cachePath.empty())
+		return;
+
+	std::filesystem::path tempPath = m_cachePath;
+	tempPath += ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::trunc);
+		file << "# device kernel sizeBucket shader workGroupSize tileSize ms" << std::endl;
+		for (const auto& [key, entry] : m_entries)
+			file << key << ' ' << entry.variant.shader << ' ' << entry.variant.workGroupSize << ' ' << entry.variant.tileSize << ' ' << entry.milliseconds << std::endl;
+		if (!file) {
+			std::cerr << "Kernel tuner: failed to write '" << tempPath.string() << '\'' << std::endl;
+			return;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, m_cachePath, error);
+	if (error) {
+		std::cerr << "Kernel tuner: failed to replace '" << m_cachePath.string() << "': " << error.message() << std::endl;
+		std::filesystem::remove(tempPath, error);
+		return;
+	}
+	m_dirty = false;
+}
+
+void SVKKernelTuner::Cleanup() {
+	if (m_logicalDevice == VK_NULL_HANDLE)
+		return;
+
+	Save();
+
+	vkDestroyFence(m_logicalDevice, m_fence, nullptr);
+	m_fence = VK_NULL_HANDLE;
+	vkDestroyCommandPool(m_logicalDevice, m_commandPool, nullptr);
+	m_commandPool = VK_NULL_HANDLE;
+	m_commandBuffer = VK_NULL_HANDLE;
+	if (m_queryPool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(m_logicalDevice, m_queryPool, nullptr);
+		m_queryPool = VK_NULL_HANDLE;
+	}
+
+	m_entries.clear();
+	m_queue = VK_NULL_HANDLE;
+	m_logicalDevice = VK_NULL_HANDLE;
+}
+
+bool SVKKernelTuner::Lookup(const std::string& kernel, uint32_t problemSize, Variant& variant) const {
+	auto it = m_entries.find(GetKey(kernel, problemSize));
+	if (it == m_entries.end())
+		return false;
+
+	variant = it->second.variant;
+	return true;
+}
+
+size_t SVKKernelTuner::Tune(const std::string& kernel, uint32_t problemSize, const std::vector<Variant>& variants, const RecordFunction& record, const ValidateFunction& validate) {
+	if (variants.empty())
+		throw std::runtime_error("Kernel tuner: no variants to tune");
+
+	std::cerr << "Kernel tuner: " << kernel << " (" << problemSize << "), " << variants.size() << " variants" << std::endl;
+
+	std::vector<double> times(variants.size());
+	std::vector<size_t> order(variants.size());
+	for (size_t i = 0; i < variants.size(); ++i) {
+		times[i] = Measure(i, record);
+		order[i] = i;
+		std::cerr << "\tshader " << variants[i].shader << ", workGroupSize " << variants[i].workGroupSize << ", tileSize " << variants[i].tileSize << ": " << times[i] << " ms" << std::endl;
+	}
+
+	// fastest first; the first candidate that validates wins
+	std::stable_sort(order.begin(), order.end(), [&times](size_t a, size_t b) { return times[a] < times[b]; });
+	for (size_t i : order) {
+		if (validate && !validate(i)) {
+			std::cerr << "\tshader " << variants[i].shader << ", workGroupSize " << variants[i].workGroupSize << ", tileSize " << variants[i].tileSize << ": rejected, wrong output" << std::endl;
+			continue;
+		}
+
+		m_entries[GetKey(kernel, problemSize)] = Entry{ variants[i], times[i] };
+		m_dirty = true;
+		return i;
+	}
+
+	std::stringstream ss;
+	ss << "Kernel tuner: no variant of " << kernel << " produced the expected output";
+	throw std::runtime_error(ss.str());
+}
+
+void SVKKernelTuner::Submit(const SubmitFunction& record) {
+	vkCheckResult(vkResetCommandBuffer(m_commandBuffer, 0), "Reset Tuner CommandBuffer");
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkCheckResult(vkBeginCommandBuffer(m_commandBuffer, &beginInfo), "Begin Tuner Commands");
+	record(m_commandBuffer);
+	vkCheckResult(vkEndCommandBuffer(m_commandBuffer), "End Tuner Commands");
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &m_commandBuffer;
+
+	vkCheckResult(vkQueueSubmit(m_queue, 1, &submitInfo, m_fence), "Submit Tuner Commands");
+	vkCheckResult(vkWaitForFences(m_logicalDevice, 1, &m_fence, VK_TRUE, UINT64_MAX), "Wait Tuner Fence");
+	vkCheckResult(vkResetFences(m_logicalDevice, 1, &m_fence), "Reset Tuner Fence");
+}
+
+std::string SVKKernelTuner::GetKey(const std::string& kernel, uint32_t problemSize) const {
+	// variants are compared per power of two bucket of the problem size
+	uint32_t bucket = 0;
+	while (bucket < 32 && (uint64_t(1) << bucket) < problemSize)
+		++bucket;
+
+	std::stringstream ss;
+	ss << m_deviceKey << ' ' << kernel << ' ' << bucket;
+	return ss.str();
+}
+
+double SVKKernelTuner::Measure(size_t variantIndex, const RecordFunction& record) {
+	// the first run warms up caches and clocks; the median of the rest is kept
+	std::vector<double> samples;
+	for (uint32_t run = 0; run <= g_repeatCount; ++run) {
+		auto startTm = std::chrono::high_resolution_clock::now();
+		Submit([&](VkCommandBuffer commandBuffer) {
+			if (m_queryPool != VK_NULL_HANDLE) {
+				vkCmdResetQueryPool(commandBuffer, m_queryPool, 0, 2);
+				vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_queryPool, 0);
+			}
+			record(commandBuffer, variantIndex);
+			if (m_queryPool != VK_NULL_HANDLE)
+				vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool, 1);
+		});
+		std::chrono::duration<double, std::milli> cpuTm = std::chrono::high_resolution_clock::now() - startTm;
+
+		double milliseconds = cpuTm.count();
+		if (m_queryPool != VK_NULL_HANDLE) {
+			uint64_t timestamps[2] = {};
+			vkCheckResult(vkGetQueryPoolResults(m_logicalDevice, m_queryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT), "Get Tuner Timestamps");
+			milliseconds = static_cast<double>((timestamps[1] - timestamps[0]) & m_timestampMask) * m_timestampPeriod / 1e6;
+		}
+
+		if (run > 0)
+			samples.push_back(milliseconds);
+	}
+
+	std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+	return samples[samples.size() / 2];
+}
+
+void SVKKernelTuner::Load() {
+	m_entries.clear();
+	if (m_cachePath.empty())
+		return;
+
+	std::ifstream file(m_cachePath);
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		std::istringstream ls(line);
+		std::string device, kernel;
+		uint32_t bucket = 0;
+		Entry entry{};
+		if (!(ls >> device >> kernel >> bucket >> entry.variant.shader >> entry.variant.workGroupSize >> entry.variant.tileSize >> entry.milliseconds)) {
+			std::cerr << "Kernel tuner: ignoring malformed line in '" << m_cachePath.string() << "': " << line << std::endl;
+			continue;
+		}
+
+		std::stringstream key;
+		key << device << ' ' << kernel << ' ' << bucket;
+		m_entries[key.str()] = entry;
+	}
+}
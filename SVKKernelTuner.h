@@ -0,0 +1,72 @@
+#pragma once
+
+#include "common.h"
+
+#include <functional>
+
+// Picks the fastest variant of a compute kernel on the current device. Each
+// candidate (shader, workgroup size, tile size) is recorded by the caller, run a few
+// times and timed with timestamp queries; the fastest candidate that passes the
+// caller's validation wins and is kept in a text cache keyed by device, driver
+// version, kernel and problem size bucket, so a machine only tunes once per
+// driver.
+class SVKKernelTuner
+{
+public:
+	struct Variant {
+		uint32_t shader;	// index into the caller's list of alternative shaders
+		uint32_t workGroupSize;
+		uint32_t tileSize;
+	};
+
+	// records one run of the given candidate into the command buffer
+	typedef std::function<void(VkCommandBuffer commandBuffer, size_t variantIndex)> RecordFunction;
+	// checks the output of the given candidate; a fast kernel with a wrong result must not win
+	typedef std::function<bool(size_t variantIndex)> ValidateFunction;
+	typedef std::function<void(VkCommandBuffer commandBuffer)> SubmitFunction;
+
+	static const uint32_t g_repeatCount;
+
+public:
+	SVKKernelTuner();
+
+	void Initialize(
+		VkPhysicalDevice physicalDevice,
+		VkDevice logicalDevice,
+		uint32_t queueFamilyIndex,
+		VkQueue queue,
+		const std::filesystem::path& cachePath
+	);
+	void Save();
+	void Cleanup();
+
+	bool Lookup(const std::string& kernel, uint32_t problemSize, Variant& variant) const;
+	size_t Tune(const std::string& kernel, uint32_t problemSize, const std::vector<Variant>& variants, const RecordFunction& record, const ValidateFunction& validate = nullptr);
+	// records into the tuner's command buffer, submits on its queue and waits
+	void Submit(const SubmitFunction& record);
+
+protected:
+	struct Entry {
+		Variant variant;
+		double milliseconds;
+	};
+
+	std::string GetKey(const std::string& kernel, uint32_t problemSize) const;
+	double Measure(size_t variantIndex, const RecordFunction& record);
+	void Load();
+
+protected:
+	VkDevice m_logicalDevice;
+	VkQueue m_queue;
+	VkCommandPool m_commandPool;
+	VkCommandBuffer m_commandBuffer;
+	VkQueryPool m_queryPool;
+	VkFence m_fence;
+	double m_timestampPeriod;
+	uint64_t m_timestampMask;
+
+	std::string m_deviceKey;
+	std::filesystem::path m_cachePath;
+	std::map<std::string, Entry> m_entries;
+	bool m_dirty;
+};
@@ -0,0 +1,406 @@
+#include "SVKMemoryAllocator.h"
+
+static VkDeviceSize NextPowerOfTwo(VkDeviceSize value) {
+	VkDeviceSize result = 1;
+	while (result < value)
+		result <<= 1;
+	return result;
+}
+
+static uint32_t Log2(VkDeviceSize value) {
+	uint32_t result = 0;
+	while (value > 1) {
+		value >>= 1;
+		++result;
+	}
+	return result;
+}
+
+static VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment) {
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+// *********************************************************************************
+
+const VkDeviceSize SVKMemoryAllocator::g_defaultBlockSize = 64ull * 1024 * 1024;
+const VkDeviceSize SVKMemoryAllocator::g_minAllocationSize = 256;
+
+uint32_t SVKMemoryAllocator::GetPoolKey(uint32_t memoryTypeIndex, Strategy strategy, bool optimalTiling) {
+	return (memoryTypeIndex << 2) | (strategy == Strategy::Linear ? 2u : 0u) | (optimalTiling ? 1u : 0u);
+}
+
+// *********************************************************************************
+
+SVKMemoryAllocator::SVKMemoryAllocator() :
+	m_logicalDevice(VK_NULL_HANDLE),
+	m_memoryProperties{},
+	m_bufferImageGranularity(1),
+	m_nonCoherentAtomSize(1),
+	m_maxMemoryAllocationCount(0),
+	m_blockSize(g_defaultBlockSize),
+	m_deviceMemoryCount(0),
+	m_dedicatedCount(0),
+	m_dedicatedBytes(0)
+{
+}
+
+void SVKMemoryAllocator::Initialize(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkDeviceSize blockSize) {
+	m_logicalDevice = logicalDevice;
+	m_blockSize = NextPowerOfTwo(std::max(blockSize, g_minAllocationSize));
+
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &m_memoryProperties);
+
+	VkPhysicalDeviceProperties physicalDeviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+	m_bufferImageGranularity = physicalDeviceProperties.limits.bufferImageGranularity;
+	m_nonCoherentAtomSize = physicalDeviceProperties.limits.nonCoherentAtomSize;
+	m_maxMemoryAllocationCount = physicalDeviceProperties.limits.maxMemoryAllocationCount;
+}
+
+void SVKMemoryAllocator::Cleanup() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (auto& [poolKey, pool] : m_pools)
+		for (std::unique_ptr<Block>& block : pool.blocks)
+			if (block) {
+				if (!block->allocations.empty())
+					std::cerr << "Memory allocator: " << block->allocations.size() << " allocation(s) leaked in memory type " << pool.memoryTypeIndex << std::endl;
+				DestroyBlock(*block);
+			}
+	m_pools.clear();
+
+	if (m_dedicatedCount != 0)
+		std::cerr << "Memory allocator: " << m_dedicatedCount << " dedicated allocation(s) leaked" << std::endl;
+
+	m_logicalDevice = VK_NULL_HANDLE;
+}
+
+SVKMemoryAllocator::Allocation SVKMemoryAllocator::Allocate(
+	const VkMemoryRequirements& memRequirements,
+	VkMemoryPropertyFlags properties,
+	Strategy strategy,
+	bool optimalTiling,
+	void* userData
+) {
+	uint32_t memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// linear and optimal resources only share a block when the device does not care
+	if (m_bufferImageGranularity <= 1)
+		optimalTiling = false;
+
+	uint32_t poolKey = GetPoolKey(memoryTypeIndex, strategy, optimalTiling);
+	Pool& pool = m_pools[poolKey];
+	if (pool.blocks.empty() && pool.blockSize == 0) {
+		VkDeviceSize heapSize = m_memoryProperties.memoryHeaps[m_memoryProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+		pool.strategy = strategy;
+		pool.memoryTypeIndex = memoryTypeIndex;
+		// small heaps (e.g. host visible device local) get smaller blocks
+		pool.blockSize = m_blockSize;
+		while (pool.blockSize > g_minAllocationSize && pool.blockSize > heapSize / 8)
+			pool.blockSize >>= 1;
+	}
+
+	// requests that would take most of a block get their own device memory
+	if (memRequirements.size > pool.blockSize / 2) {
+		Allocation allocation{};
+		AllocateDeviceMemory(memoryTypeIndex, memRequirements.size, allocation.memory, allocation.mappedData);
+		allocation.offset = 0;
+		allocation.size = memRequirements.size;
+		allocation.poolKey = poolKey;
+		allocation.dedicated = true;
+
+		++m_dedicatedCount;
+		m_dedicatedBytes += memRequirements.size;
+		return allocation;
+	}
+
+	VkDeviceSize offset = 0;
+	for (uint32_t i = 0; i < pool.blocks.size(); ++i)
+		if (pool.blocks[i] && AllocateFromBlock(*pool.blocks[i], strategy, memRequirements.size, memRequirements.alignment, userData, offset))
+			return MakeAllocation(pool, poolKey, i, offset, memRequirements.size);
+
+	uint32_t blockIndex = CreateBlock(pool);
+	if (!AllocateFromBlock(*pool.blocks[blockIndex], strategy, memRequirements.size, memRequirements.alignment, userData, offset))
+		throw std::runtime_error("Memory allocator: allocation does not fit into a new block");
+
+	return MakeAllocation(pool, poolKey, blockIndex, offset, memRequirements.size);
+}
+
+void SVKMemoryAllocator::Free(Allocation& allocation) {
+	if (allocation.memory == VK_NULL_HANDLE)
+		return;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (allocation.dedicated) {
+		vkFreeMemory(m_logicalDevice, allocation.memory, nullptr);
+		--m_deviceMemoryCount;
+		--m_dedicatedCount;
+		m_dedicatedBytes -= allocation.size;
+	}
+	else {
+		Pool& pool = m_pools.at(allocation.poolKey);
+		FreeFromBlock(*pool.blocks[allocation.blockIndex], pool.strategy, allocation.offset);
+	}
+
+	allocation = Allocation{};
+}
+
+void SVKMemoryAllocator::FlushAllocation(const Allocation& allocation, VkDeviceSize offset, VkDeviceSize size) {
+	VkMappedMemoryRange range = GetMappedRange(allocation, offset, size);
+	vkCheckResult(vkFlushMappedMemoryRanges(m_logicalDevice, 1, &range), "Flush Mapped Memory");
+}
+
+void SVKMemoryAllocator::InvalidateAllocation(const Allocation& allocation, VkDeviceSize offset, VkDeviceSize size) {
+	VkMappedMemoryRange range = GetMappedRange(allocation, offset, size);
+	vkCheckResult(vkInvalidateMappedMemoryRanges(m_logicalDevice, 1, &range), "Invalidate Mapped Memory");
+}
+
+uint32_t SVKMemoryAllocator::FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
+	for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; ++i)
+		if ((typeFilter & (1 << i)) && (m_memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+			return i;
+
+	throw std::runtime_error("No suitable memory type found");
+}
+
+void SVKMemoryAllocator::Defragment(const MoveCallback& moveCallback) {
+	struct Candidate {
+		VkDeviceSize offset;
+		LiveAllocation live;
+	};
+
+	for (auto& [poolKey, pool] : m_pools) {
+		if (pool.strategy != Strategy::General)
+			continue;
+
+		// empty the least used block into the others
+		std::unique_lock<std::mutex> lock(m_mutex);
+		uint32_t sourceIndex = UINT32_MAX;
+		uint32_t liveBlockCount = 0;
+		for (uint32_t i = 0; i < pool.blocks.size(); ++i)
+			if (pool.blocks[i] && pool.blocks[i]->usedBytes != 0) {
+				++liveBlockCount;
+				if (sourceIndex == UINT32_MAX || pool.blocks[i]->usedBytes < pool.blocks[sourceIndex]->usedBytes)
+					sourceIndex = i;
+			}
+		if (liveBlockCount < 2)
+			continue;
+
+		std::vector<Candidate> candidates;
+		for (const auto& [offset, live] : pool.blocks[sourceIndex]->allocations)
+			candidates.push_back({ offset, live });
+
+		for (const Candidate& candidate : candidates) {
+			VkDeviceSize newOffset = 0;
+			uint32_t targetIndex = UINT32_MAX;
+			for (uint32_t i = 0; i < pool.blocks.size() && targetIndex == UINT32_MAX; ++i)
+				if (i != sourceIndex && pool.blocks[i] && pool.blocks[i]->usedBytes != 0
+					&& AllocateFromBlock(*pool.blocks[i], pool.strategy, candidate.live.size, g_minAllocationSize << candidate.live.order, candidate.live.userData, newOffset))
+					targetIndex = i;
+			if (targetIndex == UINT32_MAX)
+				continue;
+
+			Allocation oldAllocation = MakeAllocation(pool, poolKey, sourceIndex, candidate.offset, candidate.live.size);
+			Allocation newAllocation = MakeAllocation(pool, poolKey, targetIndex, newOffset, candidate.live.size);
+
+			// the owner recreates its resource, so do not hold the lock while it runs
+			lock.unlock();
+			bool moved = moveCallback(candidate.live.userData, oldAllocation, newAllocation);
+			lock.lock();
+
+			if (moved)
+				FreeFromBlock(*pool.blocks[sourceIndex], pool.strategy, candidate.offset);
+			else
+				FreeFromBlock(*pool.blocks[targetIndex], pool.strategy, newOffset);
+		}
+	}
+
+	ReleaseEmptyBlocks();
+}
+
+void SVKMemoryAllocator::ReleaseEmptyBlocks() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (auto& [poolKey, pool] : m_pools)
+		for (std::unique_ptr<Block>& block : pool.blocks)
+			if (block && block->usedBytes == 0) {
+				DestroyBlock(*block);
+				block.reset();
+			}
+}
+
+SVKMemoryAllocator::Statistics SVKMemoryAllocator::GetStatistics() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	Statistics statistics{};
+	statistics.deviceMemoryCount = m_deviceMemoryCount;
+	statistics.allocationCount = m_dedicatedCount;
+	statistics.reservedBytes = m_dedicatedBytes;
+	statistics.usedBytes = m_dedicatedBytes;
+
+	for (const auto& [poolKey, pool] : m_pools)
+		for (const std::unique_ptr<Block>& block : pool.blocks)
+			if (block) {
+				statistics.allocationCount += static_cast<uint32_t>(block->allocations.size());
+				statistics.reservedBytes += block->size;
+				statistics.usedBytes += block->usedBytes;
+			}
+
+	return statistics;
+}
+
+void SVKMemoryAllocator::PrintStatistics(std::ostream& os) const {
+	Statistics statistics = GetStatistics();
+
+	os << "Memory allocator: " << statistics.allocationCount << " allocation(s) in "
+		<< statistics.deviceMemoryCount << " device memory object(s) (limit " << m_maxMemoryAllocationCount << "); "
+		<< "used " << (statistics.usedBytes >> 10) << " KiB of " << (statistics.reservedBytes >> 10) << " KiB reserved" << std::endl;
+}
+
+void SVKMemoryAllocator::AllocateDeviceMemory(uint32_t memoryTypeIndex, VkDeviceSize size, VkDeviceMemory& memory, void*& mappedData) {
+	if (m_maxMemoryAllocationCount != 0 && m_deviceMemoryCount >= m_maxMemoryAllocationCount)
+		throw std::runtime_error("Memory allocator: maxMemoryAllocationCount reached");
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+	vkCheckResult(vkAllocateMemory(m_logicalDevice, &allocInfo, nullptr, &memory), "Allocate Memory");
+	++m_deviceMemoryCount;
+
+	mappedData = nullptr;
+	if (m_memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		vkCheckResult(vkMapMemory(m_logicalDevice, memory, 0, VK_WHOLE_SIZE, 0, &mappedData), "Map Memory");
+}
+
+uint32_t SVKMemoryAllocator::CreateBlock(Pool& pool) {
+	std::unique_ptr<Block> block = std::make_unique<Block>();
+	block->size = pool.blockSize;
+	block->usedBytes = 0;
+	block->linearOffset = 0;
+	AllocateDeviceMemory(pool.memoryTypeIndex, pool.blockSize, block->memory, block->mappedData);
+
+	if (pool.strategy == Strategy::General) {
+		block->maxOrder = Log2(pool.blockSize / g_minAllocationSize);
+		block->freeLists.resize(block->maxOrder + 1);
+		block->freeLists[block->maxOrder].insert(0);
+	}
+
+	for (uint32_t i = 0; i < pool.blocks.size(); ++i)
+		if (!pool.blocks[i]) {
+			pool.blocks[i] = std::move(block);
+			return i;
+		}
+	pool.blocks.push_back(std::move(block));
+	return static_cast<uint32_t>(pool.blocks.size() - 1);
+}
+
+void SVKMemoryAllocator::DestroyBlock(Block& block) {
+	// freeing mapped memory implicitly unmaps it
+	vkFreeMemory(m_logicalDevice, block.memory, nullptr);
+	block.memory = VK_NULL_HANDLE;
+	block.mappedData = nullptr;
+	--m_deviceMemoryCount;
+}
+
+bool SVKMemoryAllocator::AllocateFromBlock(Block& block, Strategy strategy, VkDeviceSize size, VkDeviceSize alignment, void* userData, VkDeviceSize& offset) {
+	if (strategy == Strategy::Linear) {
+		VkDeviceSize alignedOffset = AlignUp(block.linearOffset, std::max(alignment, m_nonCoherentAtomSize));
+		if (alignedOffset + size > block.size)
+			return false;
+
+		offset = alignedOffset;
+		block.linearOffset = alignedOffset + size;
+		block.usedBytes += size;
+		block.allocations[offset] = { size, 0, userData };
+		return true;
+	}
+
+	// buddy blocks are aligned to their own size, so alignment only raises the order
+	VkDeviceSize blockSize = NextPowerOfTwo(std::max({ size, alignment, g_minAllocationSize }));
+	uint32_t order = Log2(blockSize / g_minAllocationSize);
+	if (order > block.maxOrder)
+		return false;
+
+	uint32_t freeOrder = order;
+	while (freeOrder <= block.maxOrder && block.freeLists[freeOrder].empty())
+		++freeOrder;
+	if (freeOrder > block.maxOrder)
+		return false;
+
+	VkDeviceSize freeOffset = *block.freeLists[freeOrder].begin();
+	block.freeLists[freeOrder].erase(block.freeLists[freeOrder].begin());
+	while (freeOrder > order) {
+		--freeOrder;
+		block.freeLists[freeOrder].insert(freeOffset + (g_minAllocationSize << freeOrder));
+	}
+
+	offset = freeOffset;
+	block.usedBytes += blockSize;
+	block.allocations[offset] = { size, order, userData };
+	return true;
+}
+
+void SVKMemoryAllocator::FreeFromBlock(Block& block, Strategy strategy, VkDeviceSize offset) {
+	auto it = block.allocations.find(offset);
+	if (it == block.allocations.end())
+		throw std::runtime_error("Memory allocator: freeing unknown allocation");
+
+	if (strategy == Strategy::Linear) {
+		block.usedBytes -= it->second.size;
+		block.allocations.erase(it);
+		if (block.allocations.empty())
+			block.linearOffset = 0;
+		return;
+	}
+
+	uint32_t order = it->second.order;
+	block.usedBytes -= g_minAllocationSize << order;
+	block.allocations.erase(it);
+
+	while (order < block.maxOrder) {
+		VkDeviceSize buddy = offset ^ (g_minAllocationSize << order);
+		auto buddyIt = block.freeLists[order].find(buddy);
+		if (buddyIt == block.freeLists[order].end())
+			break;
+
+		block.freeLists[order].erase(buddyIt);
+		offset = std::min(offset, buddy);
+		++order;
+	}
+	block.freeLists[order].insert(offset);
+}
+
+SVKMemoryAllocator::Allocation SVKMemoryAllocator::MakeAllocation(const Pool& pool, uint32_t poolKey, uint32_t blockIndex, VkDeviceSize offset, VkDeviceSize size) const {
+	const Block& block = *pool.blocks[blockIndex];
+
+	Allocation allocation{};
+	allocation.memory = block.memory;
+	allocation.offset = offset;
+	allocation.size = size;
+	allocation.mappedData = block.mappedData != nullptr ? static_cast<char*>(block.mappedData) + offset : nullptr;
+	allocation.poolKey = poolKey;
+	allocation.blockIndex = blockIndex;
+	allocation.dedicated = false;
+	return allocation;
+}
+
+VkMappedMemoryRange SVKMemoryAllocator::GetMappedRange(const Allocation& allocation, VkDeviceSize offset, VkDeviceSize size) const {
+	VkDeviceSize begin = allocation.offset + offset;
+	VkDeviceSize end = size == VK_WHOLE_SIZE ? allocation.offset + allocation.size : begin + size;
+
+	// ranges must be multiples of nonCoherentAtomSize; sub-allocations are atom aligned inside their block
+	VkMappedMemoryRange range{};
+	range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+	range.memory = allocation.memory;
+	range.offset = begin / m_nonCoherentAtomSize * m_nonCoherentAtomSize;
+	if (allocation.dedicated && end >= allocation.size)
+		range.size = VK_WHOLE_SIZE;
+	else
+		range.size = AlignUp(end, m_nonCoherentAtomSize) - range.offset;
+	return range;
+}
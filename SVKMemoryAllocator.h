@@ -0,0 +1,127 @@
+#pragma once
+
+#include "common.h"
+
+#include <memory>
+#include <mutex>
+#include <functional>
+
+// Sub-allocates buffers and images from large VkDeviceMemory blocks instead of
+// calling vkAllocateMemory per resource. Long-lived resources use a buddy
+// allocator, transient ones (staging) a linear allocator that rewinds once all
+// of its allocations are freed. Host visible blocks are mapped persistently.
+class SVKMemoryAllocator
+{
+public:
+	enum class Strategy {
+		General,
+		Linear
+	};
+
+	struct Allocation {
+		VkDeviceMemory memory;
+		VkDeviceSize offset;
+		VkDeviceSize size;
+		void* mappedData;
+		uint32_t poolKey;
+		uint32_t blockIndex;
+		bool dedicated;
+	};
+
+	struct Statistics {
+		uint32_t deviceMemoryCount;
+		uint32_t allocationCount;
+		VkDeviceSize reservedBytes;
+		VkDeviceSize usedBytes;
+	};
+
+	// Called by Defragment for every allocation it wants to move: the owner must
+	// recreate its resource at newAllocation, copy the contents and return true,
+	// or return false to keep the resource where it is.
+	typedef std::function<bool(void* userData, const Allocation& oldAllocation, const Allocation& newAllocation)> MoveCallback;
+
+	static const VkDeviceSize g_defaultBlockSize;
+	static const VkDeviceSize g_minAllocationSize;
+
+protected:
+	struct LiveAllocation {
+		VkDeviceSize size;
+		uint32_t order;
+		void* userData;
+	};
+
+	struct Block {
+		VkDeviceMemory memory;
+		void* mappedData;
+		VkDeviceSize size;
+		VkDeviceSize usedBytes;
+
+		// Strategy::General: buddy free lists indexed by order
+		uint32_t maxOrder;
+		std::vector<std::set<VkDeviceSize>> freeLists;
+		std::map<VkDeviceSize, LiveAllocation> allocations;
+
+		// Strategy::Linear
+		VkDeviceSize linearOffset;
+	};
+
+	struct Pool {
+		Strategy strategy;
+		uint32_t memoryTypeIndex;
+		VkDeviceSize blockSize;
+		std::vector<std::unique_ptr<Block>> blocks;
+	};
+
+	static uint32_t GetPoolKey(uint32_t memoryTypeIndex, Strategy strategy, bool optimalTiling);
+
+public:
+	SVKMemoryAllocator();
+
+	void Initialize(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, VkDeviceSize blockSize);
+	void Cleanup();
+
+	Allocation Allocate(
+		const VkMemoryRequirements& memRequirements,
+		VkMemoryPropertyFlags properties,
+		Strategy strategy,
+		bool optimalTiling,
+		void* userData = nullptr
+	);
+	void Free(Allocation& allocation);
+
+	void FlushAllocation(const Allocation& allocation, VkDeviceSize offset, VkDeviceSize size);
+	void InvalidateAllocation(const Allocation& allocation, VkDeviceSize offset, VkDeviceSize size);
+
+	uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+
+	void Defragment(const MoveCallback& moveCallback);
+	void ReleaseEmptyBlocks();
+
+	Statistics GetStatistics() const;
+	void PrintStatistics(std::ostream& os) const;
+
+protected:
+	void AllocateDeviceMemory(uint32_t memoryTypeIndex, VkDeviceSize size, VkDeviceMemory& memory, void*& mappedData);
+	uint32_t CreateBlock(Pool& pool);
+	void DestroyBlock(Block& block);
+
+	bool AllocateFromBlock(Block& block, Strategy strategy, VkDeviceSize size, VkDeviceSize alignment, void* userData, VkDeviceSize& offset);
+	void FreeFromBlock(Block& block, Strategy strategy, VkDeviceSize offset);
+	Allocation MakeAllocation(const Pool& pool, uint32_t poolKey, uint32_t blockIndex, VkDeviceSize offset, VkDeviceSize size) const;
+
+	VkMappedMemoryRange GetMappedRange(const Allocation& allocation, VkDeviceSize offset, VkDeviceSize size) const;
+
+protected:
+	VkDevice m_logicalDevice;
+	VkPhysicalDeviceMemoryProperties m_memoryProperties;
+	VkDeviceSize m_bufferImageGranularity;
+	VkDeviceSize m_nonCoherentAtomSize;
+	uint32_t m_maxMemoryAllocationCount;
+	VkDeviceSize m_blockSize;
+
+	mutable std::mutex m_mutex;
+	std::map<uint32_t, Pool> m_pools;
+	uint32_t m_deviceMemoryCount;
+	uint32_t m_dedicatedCount;
+	VkDeviceSize m_dedicatedBytes;
+};
@@ -0,0 +1,1061 @@
+#include "SVKNBody.h"
+#include "SVKCheckpoint.h"
+
+#include <random>
+#include <glm/glm.hpp>
+
+const uint32_t SVKNBody::g_workGroupSize = 256;
+const float SVKNBody::g_timeScale = 0.05f;
+const float SVKNBody::g_fixedDeltaT = g_timeScale / 60.0f;
+
+// tile (SHARED_DATA_SIZE) and workgroup size of test.comp until the kernel tuner picks better ones
+const SVKNBody::KernelConstants SVKNBody::g_defaultKernelConstants = { 256, 0.002f, 0.75f, 0.0075f, 0.5f, 256 };
+
+// the force kernel is tuned on a prefix of the particles, a full O(N^2) pass per run would take seconds at 1M
+const uint32_t SVKNBody::g_maxTuningParticleCount = 65536;
+
+// largest velocity change difference to the reference kernel, relative to the largest change, a tuned kernel may show
+static const float g_validationTolerance = 1e-3f;
+
+// async compute double buffers what the graphics queue draws
+const uint32_t SVKNBody::g_renderBufferCount = 2;
+
+static const char* g_forceKernelName = "nbody.force";
+
+// alternative force kernels, selected by SVKKernelTuner::Variant::shader
+static const uint32_t g_sharedMemoryShader = 0;
+static const uint32_t g_subgroupShader = 1;
+static const char* g_forceShaderFiles[] = { "test.comp.spv", "nbody_subgroup.comp.spv" };
+static const char* g_forceShaderNames[] = { "shared", "subgroup" };
+
+// sizeof(Node) in bh_build.comp (std430)
+static const VkDeviceSize g_barnesHutNodeSize = 64;
+
+static void ComputeBarrier(VkCommandBuffer commandBuffer) {
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+// release (on the source family) or acquire (on the destination family) half of a queue family ownership transfer
+static void OwnershipBarrier(
+	VkCommandBuffer commandBuffer,
+	VkBuffer buffer,
+	uint32_t srcFamilyIndex,
+	uint32_t dstFamilyIndex,
+	VkPipelineStageFlags srcStageMask,
+	VkAccessFlags srcAccessMask,
+	VkPipelineStageFlags dstStageMask,
+	VkAccessFlags dstAccessMask
+) {
+	VkBufferMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = srcAccessMask;
+	barrier.dstAccessMask = dstAccessMask;
+	barrier.srcQueueFamilyIndex = srcFamilyIndex;
+	barrier.dstQueueFamilyIndex = dstFamilyIndex;
+	barrier.buffer = buffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+// *********************************************************************************
+
+SVKNBody::SVKNBody() :
+	m_logicalDevice(VK_NULL_HANDLE),
+	m_memoryAllocator(nullptr),
+	m_pipelineCache(nullptr),
+	m_limits{},
+	m_subgroupSize(0),
+	m_forceShader(g_sharedMemoryShader),
+	m_particleCount(0),
+	m_paddedCount(0),
+	m_stepCount(0),
+	m_deltaT(g_fixedDeltaT),
+	m_mode(Mode::BruteForce),
+	m_kernelConstants(g_defaultKernelConstants),
+	m_particleBuffer(VK_NULL_HANDLE),
+	m_particleBufferAllocation{},
+	m_asyncCompute(false),
+	m_graphicsFamilyIndex(0),
+	m_computeFamilyIndex(0),
+	m_renderBuffers{ VK_NULL_HANDLE, VK_NULL_HANDLE },
+	m_renderBufferAllocations{},
+	m_boundsBuffer(VK_NULL_HANDLE),
+	m_boundsBufferAllocation{},
+	m_keyBuffer(VK_NULL_HANDLE),
+	m_keyBufferAllocation{},
+	m_valueBuffer(VK_NULL_HANDLE),
+	m_valueBufferAllocation{},
+	m_nodeBuffer(VK_NULL_HANDLE),
+	m_nodeBufferAllocation{},
+	m_counterBuffer(VK_NULL_HANDLE),
+	m_counterBufferAllocation{},
+	m_descriptorSetLayout(VK_NULL_HANDLE),
+	m_descriptorPool(VK_NULL_HANDLE),
+	m_descriptorSet(VK_NULL_HANDLE),
+	m_pipelineLayout(VK_NULL_HANDLE),
+	m_forcePipeline(VK_NULL_HANDLE),
+	m_integratePipeline(VK_NULL_HANDLE),
+	m_boundsPipeline(VK_NULL_HANDLE),
+	m_mortonPipeline(VK_NULL_HANDLE),
+	m_sortPipeline(VK_NULL_HANDLE),
+	m_buildPipeline(VK_NULL_HANDLE),
+	m_summarizePipeline(VK_NULL_HANDLE),
+	m_barnesHutPipeline(VK_NULL_HANDLE)
+{
+}
+
+void SVKNBody::Initialize(
+	VkPhysicalDevice physicalDevice,
+	VkDevice logicalDevice,
+	SVKMemoryAllocator& memoryAllocator,
+	SVKUploadContext& uploadContext,
+	SVKPipelineCache& pipelineCache,
+	const std::filesystem::path& shaderDir,
+	uint32_t particleCount,
+	Mode mode,
+	float theta,
+	uint32_t frameCount,
+	bool fullSubgroups,
+	const SVKCheckpoint* checkpoint
+) {
+	m_particleCount = particleCount;
+	m_stepCount = 0;
+	m_deltaT = g_fixedDeltaT;
+	m_mode = mode;
+	m_kernelConstants = g_defaultKernelConstants;
+	if (checkpoint != nullptr) {
+		// the tuner may still pick other tile and workgroup sizes, the physics stay those of the checkpoint
+		const SVKCheckpoint::Header& header = checkpoint->GetHeader();
+		m_particleCount = header.particleCount;
+		m_stepCount = header.stepCount;
+		m_deltaT = header.deltaT;
+		m_kernelConstants = header.kernelConstants;
+	}
+	m_kernelConstants.theta = theta;
+	if (!IsEnabled())
+		return;
+
+	m_logicalDevice = logicalDevice;
+	m_memoryAllocator = &memoryAllocator;
+	m_pipelineCache = &pipelineCache;
+	m_shaderDir = shaderDir;
+
+	VkPhysicalDeviceProperties physicalDeviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+	m_limits = physicalDeviceProperties.limits;
+
+	// a checkpoint written on another device may carry workgroup and tile sizes this one cannot run. They only
+	// affect speed, so the defaults replace them before the first pipeline and the tuner
+	if (checkpoint != nullptr) {
+		int32_t workGroupSize = m_kernelConstants.workGroupSize;
+		int32_t sharedDataSize = m_kernelConstants.sharedDataSize;
+		bool workGroupValid = workGroupSize > 0 && static_cast<uint32_t>(workGroupSize) <= m_limits.maxComputeWorkGroupSize[0]
+			&& static_cast<uint32_t>(workGroupSize) <= m_limits.maxComputeWorkGroupInvocations;
+		bool tileValid = sharedDataSize > 0 && static_cast<uint64_t>(sharedDataSize) * sizeof(glm::vec4) <= m_limits.maxComputeSharedMemorySize;
+		if (!workGroupValid || !tileValid) {
+			std::cerr << "N-body: checkpoint workGroupSize " << workGroupSize << ", tileSize " << sharedDataSize << " exceed the device limits, using "
+				<< g_defaultKernelConstants.workGroupSize << ", " << g_defaultKernelConstants.sharedDataSize << std::endl;
+			m_kernelConstants.workGroupSize = g_defaultKernelConstants.workGroupSize;
+			m_kernelConstants.sharedDataSize = g_defaultKernelConstants.sharedDataSize;
+		}
+	}
+
+	// the subgroup kernel needs shuffles in compute shaders and full subgroups of the reported size, which only
+	// VK_EXT_subgroup_size_control guarantees; otherwise only the shared memory kernel is tuned
+	VkPhysicalDeviceSubgroupProperties subgroupProperties{};
+	subgroupProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+
+	VkPhysicalDeviceProperties2 properties{};
+	properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	properties.pNext = &subgroupProperties;
+	vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+	bool subgroupSupported = (subgroupProperties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) != 0
+		&& (subgroupProperties.supportedOperations & VK_SUBGROUP_FEATURE_SHUFFLE_BIT) != 0;
+	m_subgroupSize = subgroupSupported && fullSubgroups ? subgroupProperties.subgroupSize : 0;
+	m_forceShader = g_sharedMemoryShader;
+
+	VkDeviceSize bufferSize = sizeof(Particle) * static_cast<VkDeviceSize>(m_particleCount);
+	CreateStorageBuffer("Particle", bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, m_particleBuffer, m_particleBufferAllocation);
+
+	// a restore copies straight from the mapped checkpoint into staging memory
+	std::vector<Particle> particles;
+	if (checkpoint == nullptr)
+		particles = GenerateParticles(m_particleCount);
+	uploadContext.UploadBuffer(
+		m_particleBuffer,
+		checkpoint != nullptr ? checkpoint->GetParticles() : particles.data(),
+		bufferSize,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+	);
+
+	m_uniformRing.Initialize(physicalDevice, m_logicalDevice, memoryAllocator, frameCount, sizeof(Params));
+
+	if (m_mode == Mode::BarnesHut)
+		CreateBarnesHutBuffers();
+
+	CreateDescriptors();
+	m_integratePipeline = CreatePipeline("nbody_integrate.comp.spv", "nbody.integrate", nullptr);
+	if (m_mode == Mode::BarnesHut) {
+		m_boundsPipeline = CreatePipeline("bh_bounds.comp.spv", "nbody.bh.bounds", nullptr);
+		m_mortonPipeline = CreatePipeline("bh_morton.comp.spv", "nbody.bh.morton", nullptr);
+		m_sortPipeline = CreatePipeline("bh_sort.comp.spv", "nbody.bh.sort", nullptr);
+		m_buildPipeline = CreatePipeline("bh_build.comp.spv", "nbody.bh.build", nullptr);
+		m_summarizePipeline = CreatePipeline("bh_summarize.comp.spv", "nbody.bh.summarize", nullptr);
+		m_barnesHutPipeline = CreatePipeline("bh_force.comp.spv", "nbody.bh.force", &m_kernelConstants);
+	}
+	else
+		m_forcePipeline = CreateForcePipeline(m_forceShader, g_forceKernelName, m_kernelConstants);
+}
+
+void SVKNBody::Tune(SVKKernelTuner& kernelTuner, bool force) {
+	if (!IsEnabled() || m_mode != Mode::BruteForce)
+		return;
+
+	uint32_t tuningCount = std::min(m_particleCount, g_maxTuningParticleCount);
+	SVKKernelTuner::Variant best{};
+	bool cached = !force && kernelTuner.Lookup(g_forceKernelName, m_particleCount, best);
+	if (cached && best.shader >= std::size(g_forceShaderFiles)) {
+		std::cerr << "N-body: cached force kernel has unknown shader " << best.shader << ", retuning" << std::endl;
+		cached = false;
+	}
+	// the cache is a text file that may come from another device or an older build; only a variant this device
+	// would tune itself is used, which also keeps the workgroup and tile sizes non-zero and within the limits
+	std::vector<SVKKernelTuner::Variant> variants = GetTuningVariants();
+	if (cached && std::none_of(variants.begin(), variants.end(), [&best](const SVKKernelTuner::Variant& variant) {
+		return variant.shader == best.shader && variant.workGroupSize == best.workGroupSize && variant.tileSize == best.tileSize;
+	})) {
+		std::cerr << "N-body: cached force kernel (shader " << best.shader << ", workGroupSize " << best.workGroupSize << ", tileSize " << best.tileSize
+			<< ") is not a candidate on this device, retuning" << std::endl;
+		cached = false;
+	}
+	// a cached winner is checked like a fresh one, the cache may predate a driver that breaks it
+	if (cached && !ValidateForceKernel(kernelTuner, best, tuningCount))
+		cached = false;
+
+	if (!cached) {
+		std::vector<VkPipeline> pipelines;
+		for (const SVKKernelTuner::Variant& variant : variants) {
+			KernelConstants kernelConstants = m_kernelConstants;
+			kernelConstants.workGroupSize = static_cast<int32_t>(variant.workGroupSize);
+			kernelConstants.sharedDataSize = static_cast<int32_t>(variant.tileSize);
+			pipelines.push_back(CreateForcePipeline(variant.shader, "nbody.force.tuning", kernelConstants));
+		}
+
+		// a zero time step leaves the uploaded particles untouched
+		Params params{};
+		params.deltaT = 0.0f;
+		params.particleCount = static_cast<int32_t>(tuningCount);
+		m_uniformRing.BeginRegion(0);
+		m_uniformRing.Push(&params, sizeof(params));
+		uint32_t uniformOffset = m_uniformRing.GetRegionOffset(0);
+
+		size_t bestIndex = kernelTuner.Tune(g_forceKernelName, m_particleCount, variants, [&](VkCommandBuffer commandBuffer, size_t variantIndex) {
+			uint32_t workGroupSize = variants[variantIndex].workGroupSize;
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &m_descriptorSet, 1, &uniformOffset);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines[variantIndex]);
+			vkCmdDispatch(commandBuffer, (tuningCount + workGroupSize - 1) / workGroupSize, 1, 1);
+		}, [&](size_t variantIndex) {
+			return ValidateForceKernel(kernelTuner, variants[variantIndex], tuningCount);
+		});
+		best = variants[bestIndex];
+
+		for (VkPipeline pipeline : pipelines)
+			vkDestroyPipeline(m_logicalDevice, pipeline, nullptr);
+	}
+
+	if (best.shader == m_forceShader && best.workGroupSize == static_cast<uint32_t>(m_kernelConstants.workGroupSize) && best.tileSize == static_cast<uint32_t>(m_kernelConstants.sharedDataSize))
+		return;
+
+	m_forceShader = best.shader;
+	m_kernelConstants.workGroupSize = static_cast<int32_t>(best.workGroupSize);
+	m_kernelConstants.sharedDataSize = static_cast<int32_t>(best.tileSize);
+	vkDestroyPipeline(m_logicalDevice, m_forcePipeline, nullptr);
+	m_forcePipeline = CreateForcePipeline(m_forceShader, g_forceKernelName, m_kernelConstants);
+}
+
+void SVKNBody::EnableAsyncCompute(
+	uint32_t graphicsFamilyIndex,
+	VkCommandPool graphicsCommandPool,
+	VkQueue graphicsQueue,
+	uint32_t computeFamilyIndex,
+	VkCommandPool computeCommandPool,
+	VkQueue computeQueue
+) {
+	if (!IsEnabled() || graphicsFamilyIndex == computeFamilyIndex)
+		return;
+
+	m_asyncCompute = true;
+	m_graphicsFamilyIndex = graphicsFamilyIndex;
+	m_computeFamilyIndex = computeFamilyIndex;
+
+	VkDeviceSize bufferSize = sizeof(Particle) * static_cast<VkDeviceSize>(m_particleCount);
+	for (uint32_t i = 0; i < g_renderBufferCount; ++i)
+		CreateStorageBuffer("Render", bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, m_renderBuffers[i], m_renderBufferAllocations[i]);
+
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = 1;
+
+	VkCommandBuffer graphicsCommandBuffer;
+	allocInfo.commandPool = graphicsCommandPool;
+	vkCheckResult(vkAllocateCommandBuffers(m_logicalDevice, &allocInfo, &graphicsCommandBuffer), "Allocate N-body Handoff CommandBuffer");
+
+	VkCommandBuffer computeCommandBuffer;
+	allocInfo.commandPool = computeCommandPool;
+	vkCheckResult(vkAllocateCommandBuffers(m_logicalDevice, &allocInfo, &computeCommandBuffer), "Allocate N-body Handoff CommandBuffer");
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	// seed both render buffers with the uploaded (and tuned on) state, then hand the state to the compute family.
+	// The frames start from the steady state: buffer 0 released by the graphics family as if drawn by the frame
+	// before step 0, buffer 1 released by the compute family as if written by the step before frame 0
+	vkCheckResult(vkBeginCommandBuffer(graphicsCommandBuffer, &beginInfo), "Begin N-body Handoff Commands");
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	vkCmdPipelineBarrier(graphicsCommandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	VkBufferCopy copyRegion{};
+	copyRegion.size = bufferSize;
+	for (uint32_t i = 0; i < g_renderBufferCount; ++i)
+		vkCmdCopyBuffer(graphicsCommandBuffer, m_particleBuffer, m_renderBuffers[i], 1, &copyRegion);
+
+	OwnershipBarrier(graphicsCommandBuffer, m_particleBuffer, m_graphicsFamilyIndex, m_computeFamilyIndex, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+	for (uint32_t i = 0; i < g_renderBufferCount; ++i)
+		OwnershipBarrier(graphicsCommandBuffer, m_renderBuffers[i], m_graphicsFamilyIndex, m_computeFamilyIndex, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+
+	vkCheckResult(vkEndCommandBuffer(graphicsCommandBuffer), "End N-body Handoff Commands");
+
+	vkCheckResult(vkBeginCommandBuffer(computeCommandBuffer, &beginInfo), "Begin N-body Handoff Commands");
+
+	OwnershipBarrier(computeCommandBuffer, m_particleBuffer, m_graphicsFamilyIndex, m_computeFamilyIndex, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	OwnershipBarrier(computeCommandBuffer, m_renderBuffers[1], m_graphicsFamilyIndex, m_computeFamilyIndex, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, 0);
+	OwnershipBarrier(computeCommandBuffer, m_renderBuffers[1], m_computeFamilyIndex, m_graphicsFamilyIndex, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+
+	vkCheckResult(vkEndCommandBuffer(computeCommandBuffer), "End N-body Handoff Commands");
+
+	VkSemaphoreCreateInfo semaphoreInfo{};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+	VkSemaphore semaphore;
+	vkCheckResult(vkCreateSemaphore(m_logicalDevice, &semaphoreInfo, nullptr, &semaphore), "Create N-body Handoff Semaphore");
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &graphicsCommandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &semaphore;
+	vkCheckResult(vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE), "Submit N-body Release");
+
+	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+	submitInfo.waitSemaphoreCount = 1;
+	submitInfo.pWaitSemaphores = &semaphore;
+	submitInfo.pWaitDstStageMask = &waitStage;
+	submitInfo.pCommandBuffers = &computeCommandBuffer;
+	submitInfo.signalSemaphoreCount = 0;
+	submitInfo.pSignalSemaphores = nullptr;
+	vkCheckResult(vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE), "Submit N-body Acquire");
+	vkCheckResult(vkQueueWaitIdle(computeQueue), "Wait N-body Handoff");
+
+	vkDestroySemaphore(m_logicalDevice, semaphore, nullptr);
+	vkFreeCommandBuffers(m_logicalDevice, computeCommandPool, 1, &computeCommandBuffer);
+	vkFreeCommandBuffers(m_logicalDevice, graphicsCommandPool, 1, &graphicsCommandBuffer);
+}
+
+void SVKNBody::Cleanup() {
+	if (m_logicalDevice == VK_NULL_HANDLE)
+		return;
+
+	for (VkPipeline* pipeline : { &m_integratePipeline, &m_forcePipeline, &m_boundsPipeline, &m_mortonPipeline, &m_sortPipeline, &m_buildPipeline, &m_summarizePipeline, &m_barnesHutPipeline }) {
+		vkDestroyPipeline(m_logicalDevice, *pipeline, nullptr);
+		*pipeline = VK_NULL_HANDLE;
+	}
+	vkDestroyPipelineLayout(m_logicalDevice, m_pipelineLayout, nullptr);
+	m_pipelineLayout = VK_NULL_HANDLE;
+
+	vkDestroyDescriptorPool(m_logicalDevice, m_descriptorPool, nullptr);
+	m_descriptorPool = VK_NULL_HANDLE;
+	m_descriptorSet = VK_NULL_HANDLE;
+	vkDestroyDescriptorSetLayout(m_logicalDevice, m_descriptorSetLayout, nullptr);
+	m_descriptorSetLayout = VK_NULL_HANDLE;
+
+	m_uniformRing.Cleanup();
+
+	std::pair<VkBuffer*, SVKMemoryAllocator::Allocation*> buffers[] = {
+		{ &m_renderBuffers[1], &m_renderBufferAllocations[1] },
+		{ &m_renderBuffers[0], &m_renderBufferAllocations[0] },
+		{ &m_counterBuffer, &m_counterBufferAllocation },
+		{ &m_nodeBuffer, &m_nodeBufferAllocation },
+		{ &m_valueBuffer, &m_valueBufferAllocation },
+		{ &m_keyBuffer, &m_keyBufferAllocation },
+		{ &m_boundsBuffer, &m_boundsBufferAllocation },
+		{ &m_particleBuffer, &m_particleBufferAllocation },
+	};
+	for (auto& buffer : buffers) {
+		if (*buffer.first == VK_NULL_HANDLE)
+			continue;
+		vkDestroyBuffer(m_logicalDevice, *buffer.first, nullptr);
+		*buffer.first = VK_NULL_HANDLE;
+		m_memoryAllocator->Free(*buffer.second);
+	}
+
+	m_asyncCompute = false;
+	m_logicalDevice = VK_NULL_HANDLE;
+}
+
+bool SVKNBody::IsEnabled() const {
+	return m_particleCount != 0;
+}
+
+SVKNBody::Mode SVKNBody::GetMode() const {
+	return m_mode;
+}
+
+uint32_t SVKNBody::GetParticleCount() const {
+	return m_particleCount;
+}
+
+VkBuffer SVKNBody::GetParticleBuffer() const {
+	return m_particleBuffer;
+}
+
+bool SVKNBody::IsAsyncCompute() const {
+	return m_asyncCompute;
+}
+
+VkBuffer SVKNBody::GetRenderBuffer(uint32_t renderIndex) const {
+	return m_asyncCompute ? m_renderBuffers[renderIndex] : m_particleBuffer;
+}
+
+const SVKNBody::KernelConstants& SVKNBody::GetKernelConstants() const {
+	return m_kernelConstants;
+}
+
+double SVKNBody::GetInteractionsPerStep() const {
+	return static_cast<double>(m_particleCount) * static_cast<double>(m_particleCount);
+}
+
+const char* SVKNBody::GetForceShaderName() const {
+	return m_mode == Mode::BarnesHut ? "barnes-hut" : g_forceShaderNames[m_forceShader];
+}
+
+uint32_t SVKNBody::GetStepCount() const {
+	return m_stepCount;
+}
+
+float SVKNBody::GetDeltaT() const {
+	return m_deltaT;
+}
+
+void SVKNBody::Update(uint32_t frame, float deltaT, uint32_t stepCount) {
+	if (!IsEnabled())
+		return;
+
+	Params params{};
+	params.deltaT = deltaT;
+	params.particleCount = static_cast<int32_t>(m_particleCount);
+
+	m_uniformRing.BeginRegion(frame);
+	m_uniformRing.Push(&params, sizeof(params));
+	m_deltaT = deltaT;
+
+	// every update is followed by the submission of stepCount steps that share the parameters
+	m_stepCount += stepCount;
+}
+
+void SVKNBody::RecordDispatch(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t stepCount) {
+	if (!IsEnabled() || stepCount == 0)
+		return;
+
+	// the particle renderer of the previous frame reads the positions this step overwrites
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	for (uint32_t step = 0; step < stepCount; ++step) {
+		if (step > 0)
+			ComputeBarrier(commandBuffer);
+		RecordStep(commandBuffer, frame);
+	}
+
+	// make the new state visible to the next step and to the particle renderer
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void SVKNBody::RecordSteps(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t stepCount) {
+	if (!IsEnabled() || stepCount == 0)
+		return;
+
+	// the readback of the previous submission copies the state the first step overwrites
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	for (uint32_t step = 0; step < stepCount; ++step) {
+		if (step > 0)
+			ComputeBarrier(commandBuffer);
+		RecordStep(commandBuffer, frame);
+	}
+}
+
+void SVKNBody::RecordReadback(VkCommandBuffer commandBuffer, VkBuffer buffer) {
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	VkBufferCopy copyRegion{};
+	copyRegion.size = sizeof(Particle) * static_cast<VkDeviceSize>(m_particleCount);
+	vkCmdCopyBuffer(commandBuffer, m_particleBuffer, buffer, 1, &copyRegion);
+
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void SVKNBody::RecordAsyncDispatch(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t renderIndex, uint32_t stepCount) {
+	if (!m_asyncCompute)
+		return;
+
+	VkBuffer renderBuffer = m_renderBuffers[renderIndex];
+
+	// the frame that drew this buffer released it; the submission waits for that frame at the transfer stage
+	OwnershipBarrier(commandBuffer, renderBuffer, m_graphicsFamilyIndex, m_computeFamilyIndex, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+	// without a step the render buffer still receives the current state, the frames alternate buffers regardless
+	for (uint32_t step = 0; step < stepCount; ++step) {
+		if (step > 0)
+			ComputeBarrier(commandBuffer);
+		RecordStep(commandBuffer, frame);
+	}
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	VkBufferCopy copyRegion{};
+	copyRegion.size = sizeof(Particle) * static_cast<VkDeviceSize>(m_particleCount);
+	vkCmdCopyBuffer(commandBuffer, m_particleBuffer, renderBuffer, 1, &copyRegion);
+
+	OwnershipBarrier(commandBuffer, renderBuffer, m_computeFamilyIndex, m_graphicsFamilyIndex, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+
+	// the next step overwrites the state the copy reads and must see this step's writes
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void SVKNBody::RecordRenderAcquire(VkCommandBuffer commandBuffer, uint32_t renderIndex) {
+	if (!m_asyncCompute)
+		return;
+
+	// the submission waits for the step that wrote this buffer at the vertex shader stage
+	OwnershipBarrier(commandBuffer, m_renderBuffers[renderIndex], m_computeFamilyIndex, m_graphicsFamilyIndex, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+}
+
+void SVKNBody::RecordRenderRelease(VkCommandBuffer commandBuffer, uint32_t renderIndex) {
+	if (!m_asyncCompute)
+		return;
+
+	OwnershipBarrier(commandBuffer, m_renderBuffers[renderIndex], m_graphicsFamilyIndex, m_computeFamilyIndex, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+}
+
+void SVKNBody::RecordStep(VkCommandBuffer commandBuffer, uint32_t frame) {
+	uint32_t groupCount = (m_particleCount + g_workGroupSize - 1) / g_workGroupSize;
+	uint32_t uniformOffset = m_uniformRing.GetRegionOffset(frame);
+
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &m_descriptorSet, 1, &uniformOffset);
+
+	if (m_mode == Mode::BarnesHut)
+		RecordBarnesHut(commandBuffer);
+	else {
+		uint32_t workGroupSize = static_cast<uint32_t>(m_kernelConstants.workGroupSize);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_forcePipeline);
+		vkCmdDispatch(commandBuffer, (m_particleCount + workGroupSize - 1) / workGroupSize, 1, 1);
+	}
+
+	// integration writes the positions the force pass is still reading
+	ComputeBarrier(commandBuffer);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_integratePipeline);
+	vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+}
+
+void SVKNBody::RecordBarnesHut(VkCommandBuffer commandBuffer) {
+	uint32_t groupCount = (m_particleCount + g_workGroupSize - 1) / g_workGroupSize;
+	uint32_t paddedGroupCount = (m_paddedCount + g_workGroupSize - 1) / g_workGroupSize;
+
+	// the previous step may still read the bounds and counters that are cleared here
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	vkCmdFillBuffer(commandBuffer, m_boundsBuffer, 0, 4 * sizeof(uint32_t), 0xFFFFFFFF);
+	vkCmdFillBuffer(commandBuffer, m_boundsBuffer, 4 * sizeof(uint32_t), 4 * sizeof(uint32_t), 0);
+	vkCmdFillBuffer(commandBuffer, m_counterBuffer, 0, VK_WHOLE_SIZE, 0);
+
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	SortConstants sortConstants{};
+	sortConstants.paddedCount = m_paddedCount;
+	vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(sortConstants), &sortConstants);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_boundsPipeline);
+	vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+	ComputeBarrier(commandBuffer);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_mortonPipeline);
+	vkCmdDispatch(commandBuffer, paddedGroupCount, 1, 1);
+	ComputeBarrier(commandBuffer);
+
+	// bitonic sort: log2(n) * (log2(n) + 1) / 2 compare-exchange passes over the padded keys
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_sortPipeline);
+	for (uint32_t block = 2; block <= m_paddedCount; block <<= 1) {
+		for (uint32_t stride = block >> 1; stride > 0; stride >>= 1) {
+			sortConstants.sortBlock = block;
+			sortConstants.sortStride = stride;
+			vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(sortConstants), &sortConstants);
+			vkCmdDispatch(commandBuffer, paddedGroupCount, 1, 1);
+			ComputeBarrier(commandBuffer);
+		}
+	}
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_buildPipeline);
+	vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+	ComputeBarrier(commandBuffer);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_summarizePipeline);
+	vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+	ComputeBarrier(commandBuffer);
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_barnesHutPipeline);
+	vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+}
+
+void SVKNBody::ReadParticles(VkCommandPool commandPool, VkQueue queue, std::vector<Particle>& particles) {
+	particles.clear();
+	if (!IsEnabled())
+		return;
+
+	VkDeviceSize bufferSize = sizeof(Particle) * static_cast<VkDeviceSize>(m_particleCount);
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = bufferSize;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkBuffer readbackBuffer;
+	vkCheckResult(vkCreateBuffer(m_logicalDevice, &bufferInfo, nullptr, &readbackBuffer), "Create Readback Buffer");
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(m_logicalDevice, readbackBuffer, &memRequirements);
+
+	SVKMemoryAllocator::Allocation readbackAllocation = m_memoryAllocator->Allocate(memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, SVKMemoryAllocator::Strategy::Linear, false);
+	vkCheckResult(vkBindBufferMemory(m_logicalDevice, readbackBuffer, readbackAllocation.memory, readbackAllocation.offset), "Bind Readback Memory");
+
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandPool = commandPool;
+	allocInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+	vkCheckResult(vkAllocateCommandBuffers(m_logicalDevice, &allocInfo, &commandBuffer), "Allocate Readback CommandBuffer");
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkCheckResult(vkBeginCommandBuffer(commandBuffer, &beginInfo), "Begin Readback Commands");
+	RecordReadback(commandBuffer, readbackBuffer);
+	vkCheckResult(vkEndCommandBuffer(commandBuffer), "End Readback Commands");
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+
+	vkCheckResult(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE), "Submit Readback");
+	vkCheckResult(vkQueueWaitIdle(queue), "Wait Readback");
+
+	m_memoryAllocator->InvalidateAllocation(readbackAllocation, 0, bufferSize);
+	particles.resize(m_particleCount);
+	memcpy(particles.data(), readbackAllocation.mappedData, static_cast<size_t>(bufferSize));
+
+	vkFreeCommandBuffers(m_logicalDevice, commandPool, 1, &commandBuffer);
+	vkDestroyBuffer(m_logicalDevice, readbackBuffer, nullptr);
+	m_memoryAllocator->Free(readbackAllocation);
+}
+
+const char* SVKNBody::GetModeName(Mode mode) {
+	return mode == Mode::BarnesHut ? "barnes-hut" : "brute";
+}
+
+std::vector<SVKNBody::Particle> SVKNBody::GenerateParticles(uint32_t particleCount) {
+	// a few heavy attractors, each surrounded by a rotating cloud of light particles
+	static const glm::vec3 attractors[] = {
+		glm::vec3(5.0f, 0.0f, 0.0f),
+		glm::vec3(-5.0f, 0.0f, 0.0f),
+		glm::vec3(0.0f, 0.0f, 5.0f),
+		glm::vec3(0.0f, 0.0f, -5.0f),
+		glm::vec3(0.0f, 4.0f, 0.0f),
+		glm::vec3(0.0f, -8.0f, 0.0f),
+	};
+	const uint32_t attractorCount = static_cast<uint32_t>(sizeof(attractors) / sizeof(attractors[0]));
+
+	std::mt19937 generator(1234);
+	std::normal_distribution<float> normal(0.0f, 1.0f);
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+	std::vector<Particle> particles(particleCount);
+	uint32_t particlesPerAttractor = std::max(particleCount / attractorCount, 1u);
+	for (uint32_t i = 0; i < particleCount; ++i) {
+		uint32_t attractorIndex = std::min(i / particlesPerAttractor, attractorCount - 1);
+		const glm::vec3& attractor = attractors[attractorIndex];
+		Particle& particle = particles[i];
+
+		if (i % particlesPerAttractor == 0) {
+			particle.pos = glm::vec4(attractor * 1.5f, 90000.0f);
+			particle.vel = glm::vec4(0.0f);
+			continue;
+		}
+
+		glm::vec3 offset(normal(generator), normal(generator), normal(generator));
+		glm::vec3 position = attractor + offset * 0.75f;
+		glm::vec3 angular = glm::vec3(0.5f, 1.5f, 0.5f) * (attractorIndex % 2 == 0 ? 1.0f : -1.0f);
+		glm::vec3 velocity = glm::cross(position - attractor, angular) + glm::vec3(normal(generator), normal(generator), normal(generator)) * 0.025f;
+
+		particle.pos = glm::vec4(position, 75.0f + uniform(generator) * 75.0f);
+		particle.vel = glm::vec4(velocity, static_cast<float>(attractorIndex) / static_cast<float>(attractorCount));
+	}
+	return particles;
+}
+
+void SVKNBody::CreateStorageBuffer(const char* name, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, SVKMemoryAllocator::Allocation& allocation) {
+	if (size > m_limits.maxStorageBufferRange) {
+		std::stringstream ss;
+		ss << "N-body: " << name << " buffer of " << size << " bytes for " << m_particleCount << " particles exceeds maxStorageBufferRange (" << m_limits.maxStorageBufferRange << " bytes)";
+		throw std::runtime_error(ss.str());
+	}
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	vkCheckResult(vkCreateBuffer(m_logicalDevice, &bufferInfo, nullptr, &buffer), "Create N-body Buffer");
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(m_logicalDevice, buffer, &memRequirements);
+
+	allocation = m_memoryAllocator->Allocate(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, SVKMemoryAllocator::Strategy::General, false);
+	vkCheckResult(vkBindBufferMemory(m_logicalDevice, buffer, allocation.memory, allocation.offset), "Bind N-body Memory");
+}
+
+void SVKNBody::CreateBarnesHutBuffers() {
+	// the bitonic sort works on a power of two number of keys
+	m_paddedCount = 1;
+	while (m_paddedCount < m_particleCount)
+		m_paddedCount <<= 1;
+
+	VkDeviceSize internalNodeCount = std::max(m_particleCount, 2u) - 1;
+
+	CreateStorageBuffer("Bounds", 8 * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT, m_boundsBuffer, m_boundsBufferAllocation);
+	CreateStorageBuffer("Key", m_paddedCount * sizeof(uint32_t), 0, m_keyBuffer, m_keyBufferAllocation);
+	CreateStorageBuffer("Value", m_paddedCount * sizeof(uint32_t), 0, m_valueBuffer, m_valueBufferAllocation);
+	CreateStorageBuffer("Node", (internalNodeCount + m_particleCount) * g_barnesHutNodeSize, 0, m_nodeBuffer, m_nodeBufferAllocation);
+	CreateStorageBuffer("Counter", internalNodeCount * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT, m_counterBuffer, m_counterBufferAllocation);
+}
+
+void SVKNBody::CreateDescriptors() {
+	// binding 0 particles, 1 parameters; the Barnes-Hut mode adds 2 bounds, 3 keys, 4 values, 5 nodes and 6 counters
+	std::vector<VkBuffer> storageBuffers = { m_particleBuffer };
+	if (m_mode == Mode::BarnesHut)
+		storageBuffers.insert(storageBuffers.end(), { m_boundsBuffer, m_keyBuffer, m_valueBuffer, m_nodeBuffer, m_counterBuffer });
+	uint32_t bindingCount = static_cast<uint32_t>(storageBuffers.size()) + 1;
+
+	std::vector<VkDescriptorSetLayoutBinding> bindings(bindingCount);
+	for (uint32_t i = 0; i < bindingCount; ++i) {
+		bindings[i].binding = i;
+		bindings[i].descriptorType = i == 1 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = bindingCount;
+	layoutInfo.pBindings = bindings.data();
+
+	vkCheckResult(vkCreateDescriptorSetLayout(m_logicalDevice, &layoutInfo, nullptr, &m_descriptorSetLayout), "Create N-body DescriptorSetLayout");
+
+	VkDescriptorPoolSize poolSizes[2]{};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[0].descriptorCount = static_cast<uint32_t>(storageBuffers.size());
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	poolSizes[1].descriptorCount = 1;
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = 2;
+	poolInfo.pPoolSizes = poolSizes;
+	poolInfo.maxSets = 1;
+
+	vkCheckResult(vkCreateDescriptorPool(m_logicalDevice, &poolInfo, nullptr, &m_descriptorPool), "Create N-body DescriptorPool");
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = m_descriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &m_descriptorSetLayout;
+
+	vkCheckResult(vkAllocateDescriptorSets(m_logicalDevice, &allocInfo, &m_descriptorSet), "Allocate N-body DescriptorSet");
+
+	std::vector<VkDescriptorBufferInfo> bufferInfos(bindingCount);
+	for (uint32_t i = 0; i < bindingCount; ++i) {
+		bufferInfos[i].buffer = i == 1 ? m_uniformRing.GetBuffer() : storageBuffers[i == 0 ? 0 : i - 1];
+		bufferInfos[i].offset = 0;
+		bufferInfos[i].range = i == 1 ? sizeof(Params) : VK_WHOLE_SIZE;
+	}
+
+	std::vector<VkWriteDescriptorSet> descriptorWrites(bindingCount);
+	for (uint32_t i = 0; i < bindingCount; ++i) {
+		descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[i].dstSet = m_descriptorSet;
+		descriptorWrites[i].dstBinding = i;
+		descriptorWrites[i].descriptorType = bindings[i].descriptorType;
+		descriptorWrites[i].descriptorCount = 1;
+		descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+	}
+
+	vkUpdateDescriptorSets(m_logicalDevice, bindingCount, descriptorWrites.data(), 0, nullptr);
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(SortConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &m_descriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	vkCheckResult(vkCreatePipelineLayout(m_logicalDevice, &pipelineLayoutInfo, nullptr, &m_pipelineLayout), "Create N-body PipelineLayout");
+}
+
+std::vector<SVKKernelTuner::Variant> SVKNBody::GetTuningVariants() const {
+	std::vector<SVKKernelTuner::Variant> variants;
+	for (uint32_t workGroupSize = 64; workGroupSize <= 1024; workGroupSize <<= 1) {
+		if (workGroupSize > m_limits.maxComputeWorkGroupSize[0] || workGroupSize > m_limits.maxComputeWorkGroupInvocations)
+			continue;
+
+		// sharedData holds one vec4 per tile entry
+		for (uint32_t tileSize = workGroupSize; tileSize <= 4 * workGroupSize; tileSize <<= 1) {
+			if (tileSize * sizeof(glm::vec4) <= m_limits.maxComputeSharedMemorySize)
+				variants.push_back(SVKKernelTuner::Variant{ g_sharedMemoryShader, workGroupSize, tileSize });
+		}
+
+		// one tile per subgroup; the pipeline requires full subgroups, so the workgroup must be a multiple of them
+		if (m_subgroupSize != 0 && workGroupSize % m_subgroupSize == 0)
+			variants.push_back(SVKKernelTuner::Variant{ g_subgroupShader, workGroupSize, m_subgroupSize });
+	}
+	return variants;
+}
+
+bool SVKNBody::ValidateForceKernel(SVKKernelTuner& kernelTuner, const SVKKernelTuner::Variant& variant, uint32_t particleCount) {
+	// the reference is the smallest shared memory tile, which every device runs
+	KernelConstants referenceConstants = m_kernelConstants;
+	referenceConstants.workGroupSize = 64;
+	referenceConstants.sharedDataSize = 64;
+	KernelConstants kernelConstants = m_kernelConstants;
+	kernelConstants.workGroupSize = static_cast<int32_t>(variant.workGroupSize);
+	kernelConstants.sharedDataSize = static_cast<int32_t>(variant.tileSize);
+
+	VkPipeline referencePipeline = CreateForcePipeline(g_sharedMemoryShader, "nbody.force.validation", referenceConstants);
+	VkPipeline pipeline = CreateForcePipeline(variant.shader, "nbody.force.validation", kernelConstants);
+
+	// a unit time step turns the accelerations into velocity changes
+	Params params{};
+	params.deltaT = 1.0f;
+	params.particleCount = static_cast<int32_t>(particleCount);
+	m_uniformRing.BeginRegion(0);
+	m_uniformRing.Push(&params, sizeof(params));
+
+	std::vector<Particle> initial, expected, actual;
+	RunForceKernel(kernelTuner, VK_NULL_HANDLE, 0, particleCount, initial);
+	RunForceKernel(kernelTuner, referencePipeline, 64, particleCount, expected);
+	RunForceKernel(kernelTuner, pipeline, variant.workGroupSize, particleCount, actual);
+
+	vkDestroyPipeline(m_logicalDevice, pipeline, nullptr);
+	vkDestroyPipeline(m_logicalDevice, referencePipeline, nullptr);
+
+	// the summation order differs between kernels, so the error is measured against the largest change
+	float maxChange = 0.0f;
+	float maxError = 0.0f;
+	bool finite = true;
+	for (uint32_t i = 0; i < particleCount; ++i) {
+		float error = glm::length(glm::vec3(actual[i].vel - expected[i].vel));
+		finite = finite && std::isfinite(error);
+		maxChange = std::max(maxChange, glm::length(glm::vec3(expected[i].vel - initial[i].vel)));
+		maxError = std::max(maxError, error);
+	}
+	bool valid = finite && maxError <= g_validationTolerance * maxChange;
+	if (!valid)
+		std::cerr << "N-body: " << g_forceShaderNames[variant.shader] << " force kernel (workGroupSize " << variant.workGroupSize << ", tileSize " << variant.tileSize
+			<< ") differs from the reference by " << maxError << " (largest velocity change " << maxChange << ')' << std::endl;
+	return valid;
+}
+
+void SVKNBody::RunForceKernel(SVKKernelTuner& kernelTuner, VkPipeline pipeline, uint32_t workGroupSize, uint32_t particleCount, std::vector<Particle>& particles) {
+	// runs the kernel on the first particles, reads them back and restores them; without a pipeline only reads them
+	VkDeviceSize bufferSize = sizeof(Particle) * static_cast<VkDeviceSize>(particleCount);
+
+	VkBuffer backupBuffer;
+	SVKMemoryAllocator::Allocation backupAllocation;
+	CreateStorageBuffer("Validation", bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, backupBuffer, backupAllocation);
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = bufferSize;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkBuffer readbackBuffer;
+	vkCheckResult(vkCreateBuffer(m_logicalDevice, &bufferInfo, nullptr, &readbackBuffer), "Create Validation Readback Buffer");
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(m_logicalDevice, readbackBuffer, &memRequirements);
+
+	SVKMemoryAllocator::Allocation readbackAllocation = m_memoryAllocator->Allocate(memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, SVKMemoryAllocator::Strategy::Linear, false);
+	vkCheckResult(vkBindBufferMemory(m_logicalDevice, readbackBuffer, readbackAllocation.memory, readbackAllocation.offset), "Bind Validation Readback Memory");
+
+	uint32_t uniformOffset = m_uniformRing.GetRegionOffset(0);
+	kernelTuner.Submit([&](VkCommandBuffer commandBuffer) {
+		VkBufferCopy copyRegion{};
+		copyRegion.size = bufferSize;
+
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+		vkCmdCopyBuffer(commandBuffer, m_particleBuffer, backupBuffer, 1, &copyRegion);
+
+		if (pipeline != VK_NULL_HANDLE) {
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &m_descriptorSet, 1, &uniformOffset);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+			vkCmdDispatch(commandBuffer, (particleCount + workGroupSize - 1) / workGroupSize, 1, 1);
+
+			barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+		}
+		vkCmdCopyBuffer(commandBuffer, m_particleBuffer, readbackBuffer, 1, &copyRegion);
+
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+		vkCmdCopyBuffer(commandBuffer, backupBuffer, m_particleBuffer, 1, &copyRegion);
+
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	});
+
+	m_memoryAllocator->InvalidateAllocation(readbackAllocation, 0, bufferSize);
+	particles.resize(particleCount);
+	memcpy(particles.data(), readbackAllocation.mappedData, static_cast<size_t>(bufferSize));
+
+	vkDestroyBuffer(m_logicalDevice, readbackBuffer, nullptr);
+	m_memoryAllocator->Free(readbackAllocation);
+	vkDestroyBuffer(m_logicalDevice, backupBuffer, nullptr);
+	m_memoryAllocator->Free(backupAllocation);
+}
+
+VkPipeline SVKNBody::CreateForcePipeline(uint32_t shader, const char* name, const KernelConstants& kernelConstants) {
+	if (shader >= std::size(g_forceShaderFiles))
+		throw std::runtime_error("Unknown N-body force shader");
+
+	// nbody_subgroup.comp shuffles across gl_SubgroupSize invocations, every one of them must be there
+	VkPipelineShaderStageCreateFlags stageFlags = shader == g_subgroupShader ? VK_PIPELINE_SHADER_STAGE_CREATE_REQUIRE_FULL_SUBGROUPS_BIT_EXT : 0;
+	return CreatePipeline(g_forceShaderFiles[shader], name, &kernelConstants, stageFlags);
+}
+
+VkPipeline SVKNBody::CreatePipeline(const char* shaderName, const char* name, const KernelConstants* kernelConstants, VkPipelineShaderStageCreateFlags stageFlags) {
+	std::vector<char> code = ReadFile((m_shaderDir / shaderName).string());
+
+	VkShaderModuleCreateInfo moduleInfo{};
+	moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	moduleInfo.codeSize = code.size();
+	moduleInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+
+	VkShaderModule shaderModule;
+	vkCheckResult(vkCreateShaderModule(m_logicalDevice, &moduleInfo, nullptr, &shaderModule), "Create N-body ShaderModule");
+
+	VkSpecializationMapEntry mapEntries[6]{};
+	mapEntries[0] = { 0, offsetof(KernelConstants, sharedDataSize), sizeof(int32_t) };
+	mapEntries[1] = { 1, offsetof(KernelConstants, gravity), sizeof(float) };
+	mapEntries[2] = { 2, offsetof(KernelConstants, power), sizeof(float) };
+	mapEntries[3] = { 3, offsetof(KernelConstants, soften), sizeof(float) };
+	mapEntries[4] = { 4, offsetof(KernelConstants, theta), sizeof(float) };
+	mapEntries[5] = { 5, offsetof(KernelConstants, workGroupSize), sizeof(int32_t) };
+
+	VkSpecializationInfo specializationInfo{};
+	specializationInfo.mapEntryCount = 6;
+	specializationInfo.pMapEntries = mapEntries;
+	specializationInfo.dataSize = sizeof(KernelConstants);
+	specializationInfo.pData = kernelConstants;
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.flags = stageFlags;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = shaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.stage.pSpecializationInfo = kernelConstants != nullptr ? &specializationInfo : nullptr;
+	pipelineInfo.layout = m_pipelineLayout;
+
+	VkPipeline pipeline;
+	auto startTm = std::chrono::high_resolution_clock::now();
+	vkCheckResult(vkCreateComputePipelines(m_logicalDevice, m_pipelineCache->Get(), 1, &pipelineInfo, nullptr, &pipeline), "Create N-body Pipeline");
+	std::chrono::duration<double, std::milli> createTm = std::chrono::high_resolution_clock::now() - startTm;
+	m_pipelineCache->RecordCreation(name, createTm.count());
+
+	vkDestroyShaderModule(m_logicalDevice, shaderModule, nullptr);
+	return pipeline;
+}
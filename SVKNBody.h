@@ -0,0 +1,183 @@
+#pragma once
+
+#include "common.h"
+
+#include "SVKMemoryAllocator.h"
+#include "SVKUniformRing.h"
+#include "SVKUploadContext.h"
+#include "SVKPipelineCache.h"
+#include "SVKKernelTuner.h"
+
+class SVKCheckpoint;
+
+// GPU N-body simulation built on test.comp: a force pass that updates the
+// velocities from all pairwise interactions (O(N^2), tiled through shared
+// memory) followed by an integration pass that moves the positions. Particles
+// live in a device local storage buffer that never leaves the GPU.
+//
+// The Barnes-Hut mode replaces the force pass with an O(N log N) pipeline
+// that rebuilds a tree every step: bounds, Morton codes, bitonic sort, radix
+// tree build, centre of mass summaries and a traversal with opening angle theta.
+//
+// With async compute the steps run on a compute-only queue family: the state
+// buffer belongs to that family and each step copies its result into one of
+// two render buffers, which are handed to the graphics family and back with
+// queue family ownership transfers. Step k writes render buffer k % 2 while the
+// graphics queue draws step k - 1 from the other one.
+class SVKNBody
+{
+public:
+	enum class Mode {
+		BruteForce,
+		BarnesHut
+	};
+
+	// matches struct Particle in test.comp (std140)
+	struct Particle {
+		glm::vec4 pos;	// xyz position, w mass
+		glm::vec4 vel;	// xyz velocity, w gradient coordinate
+	};
+
+	// matches the UBO in test.comp
+	struct Params {
+		float deltaT;
+		int32_t particleCount;
+	};
+
+	// specialization constants 0..3 and 5 of test.comp, 1..4 of bh_force.comp
+	struct KernelConstants {
+		int32_t sharedDataSize;
+		float gravity;
+		float power;
+		float soften;
+		float theta;
+		int32_t workGroupSize;
+	};
+
+	// push constants of bh_morton.comp and bh_sort.comp
+	struct SortConstants {
+		uint32_t paddedCount;
+		uint32_t sortBlock;
+		uint32_t sortStride;
+	};
+
+	static const uint32_t g_workGroupSize;
+	static const float g_timeScale;
+	static const float g_fixedDeltaT;
+	static const KernelConstants g_defaultKernelConstants;
+	static const uint32_t g_maxTuningParticleCount;
+	static const uint32_t g_renderBufferCount;
+
+public:
+	SVKNBody();
+
+	void Initialize(
+		VkPhysicalDevice physicalDevice,
+		VkDevice logicalDevice,
+		SVKMemoryAllocator& memoryAllocator,
+		SVKUploadContext& uploadContext,
+		SVKPipelineCache& pipelineCache,
+		const std::filesystem::path& shaderDir,
+		uint32_t particleCount,
+		Mode mode,
+		float theta,
+		uint32_t frameCount,
+		bool fullSubgroups,
+		const SVKCheckpoint* checkpoint = nullptr
+	);
+	void Tune(SVKKernelTuner& kernelTuner, bool force);
+	void EnableAsyncCompute(
+		uint32_t graphicsFamilyIndex,
+		VkCommandPool graphicsCommandPool,
+		VkQueue graphicsQueue,
+		uint32_t computeFamilyIndex,
+		VkCommandPool computeCommandPool,
+		VkQueue computeQueue
+	);
+	void Cleanup();
+
+	bool IsEnabled() const;
+	Mode GetMode() const;
+	uint32_t GetParticleCount() const;
+	VkBuffer GetParticleBuffer() const;
+	bool IsAsyncCompute() const;
+	VkBuffer GetRenderBuffer(uint32_t renderIndex) const;
+	const KernelConstants& GetKernelConstants() const;
+	const char* GetForceShaderName() const;
+	double GetInteractionsPerStep() const;
+	uint32_t GetStepCount() const;
+	float GetDeltaT() const;
+
+	void Update(uint32_t frame, float deltaT, uint32_t stepCount = 1);
+	void RecordDispatch(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t stepCount);
+	void RecordSteps(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t stepCount);
+	void RecordReadback(VkCommandBuffer commandBuffer, VkBuffer buffer);
+	void RecordAsyncDispatch(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t renderIndex, uint32_t stepCount);
+	void RecordRenderAcquire(VkCommandBuffer commandBuffer, uint32_t renderIndex);
+	void RecordRenderRelease(VkCommandBuffer commandBuffer, uint32_t renderIndex);
+	void ReadParticles(VkCommandPool commandPool, VkQueue queue, std::vector<Particle>& particles);
+
+	static std::vector<Particle> GenerateParticles(uint32_t particleCount);
+	static const char* GetModeName(Mode mode);
+
+protected:
+	void CreateStorageBuffer(const char* name, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, SVKMemoryAllocator::Allocation& allocation);
+	void CreateBarnesHutBuffers();
+	void CreateDescriptors();
+	void RecordStep(VkCommandBuffer commandBuffer, uint32_t frame);
+	void RecordBarnesHut(VkCommandBuffer commandBuffer);
+	std::vector<SVKKernelTuner::Variant> GetTuningVariants() const;
+	bool ValidateForceKernel(SVKKernelTuner& kernelTuner, const SVKKernelTuner::Variant& variant, uint32_t particleCount);
+	void RunForceKernel(SVKKernelTuner& kernelTuner, VkPipeline pipeline, uint32_t workGroupSize, uint32_t particleCount, std::vector<Particle>& particles);
+	VkPipeline CreateForcePipeline(uint32_t shader, const char* name, const KernelConstants& kernelConstants);
+	VkPipeline CreatePipeline(const char* shaderName, const char* name, const KernelConstants* kernelConstants, VkPipelineShaderStageCreateFlags stageFlags = 0);
+
+protected:
+	VkDevice m_logicalDevice;
+	SVKMemoryAllocator* m_memoryAllocator;
+	SVKPipelineCache* m_pipelineCache;
+	std::filesystem::path m_shaderDir;
+	VkPhysicalDeviceLimits m_limits;
+	uint32_t m_subgroupSize;
+	uint32_t m_forceShader;
+	uint32_t m_particleCount;
+	uint32_t m_paddedCount;
+	uint32_t m_stepCount;
+	float m_deltaT;
+	Mode m_mode;
+	KernelConstants m_kernelConstants;
+
+	VkBuffer m_particleBuffer;
+	SVKMemoryAllocator::Allocation m_particleBufferAllocation;
+	SVKUniformRing m_uniformRing;
+
+	bool m_asyncCompute;
+	uint32_t m_graphicsFamilyIndex;
+	uint32_t m_computeFamilyIndex;
+	VkBuffer m_renderBuffers[2];
+	SVKMemoryAllocator::Allocation m_renderBufferAllocations[2];
+
+	VkBuffer m_boundsBuffer;
+	SVKMemoryAllocator::Allocation m_boundsBufferAllocation;
+	VkBuffer m_keyBuffer;
+	SVKMemoryAllocator::Allocation m_keyBufferAllocation;
+	VkBuffer m_valueBuffer;
+	SVKMemoryAllocator::Allocation m_valueBufferAllocation;
+	VkBuffer m_nodeBuffer;
+	SVKMemoryAllocator::Allocation m_nodeBufferAllocation;
+	VkBuffer m_counterBuffer;
+	SVKMemoryAllocator::Allocation m_counterBufferAllocation;
+
+	VkDescriptorSetLayout m_descriptorSetLayout;
+	VkDescriptorPool m_descriptorPool;
+	VkDescriptorSet m_descriptorSet;
+	VkPipelineLayout m_pipelineLayout;
+	VkPipeline m_forcePipeline;
+	VkPipeline m_integratePipeline;
+	VkPipeline m_boundsPipeline;
+	VkPipeline m_mortonPipeline;
+	VkPipeline m_sortPipeline;
+	VkPipeline m_buildPipeline;
+	VkPipeline m_summarizePipeline;
+	VkPipeline m_barnesHutPipeline;
+};
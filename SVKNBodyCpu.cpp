@@ -0,0 +1,314 @@
+#include "SVKNBodyCpu.h"
+
+#include <cmath>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include "SVKNBodyCpuAvx2.h"
+#define SVK_NBODY_AVX2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define SVK_NBODY_NEON
+#endif
+
+#include "SVKConfig.h"
+#include "SVKBenchmark.h"
+
+// the SIMD loops evaluate pow(d, -0.75) as rsqrt(d) * sqrt(rsqrt(d)); other
+// exponents take the scalar std::pow loop
+static const float g_fastPower = 0.75f;
+
+#if defined(SVK_NBODY_AVX2)
+const uint32_t SVKNBodyCpu::g_simdWidth = 8;
+#elif defined(SVK_NBODY_NEON)
+const uint32_t SVKNBodyCpu::g_simdWidth = 4;
+#else
+const uint32_t SVKNBodyCpu::g_simdWidth = 1;
+#endif
+
+#if defined(SVK_NBODY_AVX2)
+// the AVX2 loop is built into its own translation unit and only called when the CPU and the OS support it
+static bool IsAvx2Supported() {
+#if defined(_MSC_VER)
+	int registers[4];
+	__cpuid(registers, 0);
+	if (registers[0] < 7)
+		return false;
+
+	// AVX and OSXSAVE, then the OS must save the YMM registers (XCR0 bits 1 and 2)
+	__cpuid(registers, 1);
+	if ((registers[2] & (1 << 27)) == 0 || (registers[2] & (1 << 28)) == 0 || (_xgetbv(0) & 0x6) != 0x6)
+		return false;
+
+	__cpuidex(registers, 7, 0);
+	return (registers[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+static const bool g_avx2Supported = IsAvx2Supported();
+#endif
+
+// usual N-body convention: 3 sub, 6 mul/add for the distance, soften, pow (counted
+// as 4), mass divide and 6 mul/add for the accumulation
+const double SVKNBodyCpu::g_flopsPerInteraction = 20.0;
+const double SVKNBodyCpu::g_validationTolerance = 1e-3;
+
+// every particle interacts with all others, so even short ranges outweigh scheduling a job
+static const uint32_t g_minParticlesPerJob = 64;
+
+const char* SVKNBodyCpu::GetInstructionSet() {
+#if defined(SVK_NBODY_AVX2)
+	return g_avx2Supported ? "AVX2" : "scalar";
+#elif defined(SVK_NBODY_NEON)
+	return "NEON";
+#else
+	return "scalar";
+#endif
+}
+
+double SVKNBodyCpu::ComputeRelativeError(const std::vector<SVKNBody::Particle>& reference, const std::vector<SVKNBody::Particle>& particles) {
+	if (reference.size() != particles.size())
+		return std::numeric_limits<double>::infinity();
+
+	// largest position difference, relative to the extent of the reference cloud
+	double maxError = 0.0;
+	double maxExtent = 0.0;
+	for (size_t i = 0; i < reference.size(); ++i) {
+		glm::vec4 diff = particles[i].pos - reference[i].pos;
+		double error = std::sqrt(double(diff.x) * diff.x + double(diff.y) * diff.y + double(diff.z) * diff.z);
+		double extent = std::sqrt(double(reference[i].pos.x) * reference[i].pos.x + double(reference[i].pos.y) * reference[i].pos.y + double(reference[i].pos.z) * reference[i].pos.z);
+		if (!(error <= maxError))
+			maxError = error;
+		maxExtent = std::max(maxExtent, extent);
+	}
+	return maxExtent > 0.0 ? maxError / maxExtent : maxError;
+}
+
+void SVKNBodyCpu::RunBenchmark(const SVKConfig& config) {
+	SVKJobSystem jobSystem;
+	jobSystem.Initialize(config.m_threadCount);
+
+	SVKNBodyCpu simulation;
+	simulation.Initialize(SVKNBody::GenerateParticles(config.m_particleCount), SVKNBody::g_defaultKernelConstants, jobSystem);
+
+	SVKBenchmark benchmark;
+	uint32_t frameLimit = config.m_frameCount;
+	if (config.m_benchmark) {
+		benchmark.Configure(config.m_warmupFrameCount, config.m_frameCount);
+		benchmark.SetMetadata("device", std::string("CPU ") + GetInstructionSet());
+		benchmark.SetMetadata("threads", std::to_string(simulation.GetThreadCount()));
+		benchmark.SetMetadata("particles", std::to_string(simulation.GetParticleCount()));
+		frameLimit = benchmark.GetTotalFrameCount();
+	}
+
+	std::cerr << "N-body CPU: " << simulation.GetParticleCount() << " particles, " << simulation.GetThreadCount() << " threads, " << GetInstructionSet() << std::endl;
+
+	if (config.m_benchmark && config.m_threadSweep) {
+		// warmup and measured steps once per thread count; the regular run below uses all threads again
+		double singleThreadMs = 0.0;
+		for (uint32_t threadCount = 1; ; threadCount = std::min(threadCount * 2, jobSystem.GetThreadCount())) {
+			jobSystem.SetActiveThreadCount(threadCount);
+
+			SVKBenchmark sweep;
+			sweep.Configure(config.m_warmupFrameCount, config.m_frameCount);
+			for (uint32_t frame = 0; frame < sweep.GetTotalFrameCount(); ++frame) {
+				sweep.BeginFrame();
+				{
+					SVKBenchmark::ScopedTimer stepTimer(sweep, "cpu.nbody");
+					simulation.Step(SVKNBody::g_fixedDeltaT);
+				}
+				sweep.EndFrame();
+			}
+
+			SVKBenchmark::Statistics cpuNBody;
+			if (sweep.GetStatistics("cpu.nbody", cpuNBody)) {
+				if (threadCount == 1)
+					singleThreadMs = cpuNBody.p50;
+				std::cerr << "Thread sweep: " << threadCount << " threads, cpu.nbody p50 " << cpuNBody.p50 << " ms, speedup "
+					<< (cpuNBody.p50 > 0.0 ? singleThreadMs / cpuNBody.p50 : 0.0) << std::endl;
+				benchmark.SetMetadata("nbodyMs." + std::to_string(threadCount), std::to_string(cpuNBody.p50));
+			}
+			if (threadCount == jobSystem.GetThreadCount())
+				break;
+		}
+		jobSystem.SetActiveThreadCount(jobSystem.GetThreadCount());
+	}
+
+	auto startTm = std::chrono::high_resolution_clock::now();
+	for (uint32_t frame = 0; frame < frameLimit; ++frame) {
+		benchmark.BeginFrame();
+		{
+			SVKBenchmark::ScopedTimer stepTimer(benchmark, "cpu.nbody");
+			simulation.Step(SVKNBody::g_fixedDeltaT);
+		}
+		benchmark.EndFrame();
+	}
+	std::chrono::duration<double, std::milli> totalTm = std::chrono::high_resolution_clock::now() - startTm;
+
+	double stepMs = frameLimit > 0 ? totalTm.count() / frameLimit : 0.0;
+	SVKBenchmark::Statistics cpuNBody;
+	if (config.m_benchmark && benchmark.GetStatistics("cpu.nbody", cpuNBody))
+		stepMs = cpuNBody.p50;
+
+	if (stepMs > 0.0) {
+		double interactionsPerSecond = simulation.GetInteractionsPerStep() / (stepMs / 1000.0);
+		std::cerr << "N-body CPU: " << frameLimit << " steps, " << stepMs << " ms/step, " << (interactionsPerSecond / 1e9) << " G interactions/s, "
+			<< (interactionsPerSecond * g_flopsPerInteraction / 1e9) << " GFLOP/s" << std::endl;
+	}
+
+	if (config.m_benchmark) {
+		benchmark.PrintSummary(std::cerr);
+		if (!config.m_benchmarkOutput.empty()) {
+			benchmark.Write(config.m_benchmarkOutput);
+			std::cerr << "Benchmark written: " << config.m_benchmarkOutput.string() << std::endl;
+		}
+	}
+}
+
+// *********************************************************************************
+
+SVKNBodyCpu::SVKNBodyCpu() :
+	m_particleCount(0),
+	m_paddedCount(0),
+	m_jobSystem(nullptr),
+	m_kernelConstants(SVKNBody::g_defaultKernelConstants)
+{
+}
+
+void SVKNBodyCpu::Initialize(const std::vector<SVKNBody::Particle>& particles, const SVKNBody::KernelConstants& kernelConstants, SVKJobSystem& jobSystem) {
+	m_particleCount = static_cast<uint32_t>(particles.size());
+	m_paddedCount = (m_particleCount + g_simdWidth - 1) / g_simdWidth * g_simdWidth;
+	m_kernelConstants = kernelConstants;
+
+	m_jobSystem = &jobSystem;
+
+	// padding bodies sit at the origin without mass, like the zero fill of the last GPU tile
+	for (std::vector<float>* values : { &m_posX, &m_posY, &m_posZ, &m_mass, &m_velX, &m_velY, &m_velZ, &m_gradient })
+		values->assign(m_paddedCount, 0.0f);
+
+	for (uint32_t i = 0; i < m_particleCount; ++i) {
+		m_posX[i] = particles[i].pos.x;
+		m_posY[i] = particles[i].pos.y;
+		m_posZ[i] = particles[i].pos.z;
+		m_mass[i] = particles[i].pos.w;
+		m_velX[i] = particles[i].vel.x;
+		m_velY[i] = particles[i].vel.y;
+		m_velZ[i] = particles[i].vel.z;
+		m_gradient[i] = particles[i].vel.w;
+	}
+}
+
+uint32_t SVKNBodyCpu::GetParticleCount() const {
+	return m_particleCount;
+}
+
+uint32_t SVKNBodyCpu::GetThreadCount() const {
+	return m_jobSystem->GetActiveThreadCount();
+}
+
+double SVKNBodyCpu::GetInteractionsPerStep() const {
+	return static_cast<double>(m_particleCount) * static_cast<double>(m_particleCount);
+}
+
+void SVKNBodyCpu::Step(float deltaT) {
+	// velocities only depend on positions, so both GPU passes map onto two parallel loops
+	ParallelFor(m_particleCount, &SVKNBodyCpu::ComputeForces, deltaT);
+	ParallelFor(m_particleCount, &SVKNBodyCpu::Integrate, deltaT);
+}
+
+void SVKNBodyCpu::GetParticles(std::vector<SVKNBody::Particle>& particles) const {
+	particles.resize(m_particleCount);
+	for (uint32_t i = 0; i < m_particleCount; ++i) {
+		particles[i].pos = glm::vec4(m_posX[i], m_posY[i], m_posZ[i], m_mass[i]);
+		particles[i].vel = glm::vec4(m_velX[i], m_velY[i], m_velZ[i], m_gradient[i]);
+	}
+}
+
+void SVKNBodyCpu::ComputeForces(uint32_t begin, uint32_t end, float deltaT) {
+	const float soften = m_kernelConstants.soften;
+	const float power = m_kernelConstants.power;
+	const float* posX = m_posX.data();
+	const float* posY = m_posY.data();
+	const float* posZ = m_posZ.data();
+	const float* mass = m_mass.data();
+
+	for (uint32_t i = begin; i < end; ++i) {
+		float accX = 0.0f;
+		float accY = 0.0f;
+		float accZ = 0.0f;
+		uint32_t j = 0;
+
+#if defined(SVK_NBODY_AVX2)
+		if (power == g_fastPower && g_avx2Supported) {
+			float acceleration[3] = { 0.0f, 0.0f, 0.0f };
+			SVKNBodyAccumulateAvx2(posX, posY, posZ, mass, m_paddedCount, posX[i], posY[i], posZ[i], soften, acceleration);
+			accX = acceleration[0];
+			accY = acceleration[1];
+			accZ = acceleration[2];
+			j = m_paddedCount;
+		}
+#elif defined(SVK_NBODY_NEON)
+		if (power == g_fastPower) {
+			float32x4_t px = vdupq_n_f32(posX[i]);
+			float32x4_t py = vdupq_n_f32(posY[i]);
+			float32x4_t pz = vdupq_n_f32(posZ[i]);
+			float32x4_t soft = vdupq_n_f32(soften);
+			float32x4_t one = vdupq_n_f32(1.0f);
+			float32x4_t ax = vdupq_n_f32(0.0f);
+			float32x4_t ay = vdupq_n_f32(0.0f);
+			float32x4_t az = vdupq_n_f32(0.0f);
+			for (; j < m_paddedCount; j += g_simdWidth) {
+				float32x4_t dx = vsubq_f32(vld1q_f32(posX + j), px);
+				float32x4_t dy = vsubq_f32(vld1q_f32(posY + j), py);
+				float32x4_t dz = vsubq_f32(vld1q_f32(posZ + j), pz);
+				float32x4_t d2 = vaddq_f32(vfmaq_f32(vfmaq_f32(vmulq_f32(dx, dx), dy, dy), dz, dz), soft);
+				float32x4_t invSqrt = vdivq_f32(one, vsqrtq_f32(d2));
+				float32x4_t s = vmulq_f32(vld1q_f32(mass + j), vmulq_f32(invSqrt, vsqrtq_f32(invSqrt)));
+				ax = vfmaq_f32(ax, dx, s);
+				ay = vfmaq_f32(ay, dy, s);
+				az = vfmaq_f32(az, dz, s);
+			}
+			accX = vaddvq_f32(ax);
+			accY = vaddvq_f32(ay);
+			accZ = vaddvq_f32(az);
+		}
+#endif
+
+		for (; j < m_particleCount; ++j) {
+			float dx = posX[j] - posX[i];
+			float dy = posY[j] - posY[i];
+			float dz = posZ[j] - posZ[i];
+			float s = mass[j] / std::pow(dx * dx + dy * dy + dz * dz + soften, power);
+			accX += dx * s;
+			accY += dy * s;
+			accZ += dz * s;
+		}
+
+		float scale = deltaT * m_kernelConstants.gravity;
+		m_velX[i] += scale * accX;
+		m_velY[i] += scale * accY;
+		m_velZ[i] += scale * accZ;
+
+		m_gradient[i] += 0.1f * deltaT;
+		if (m_gradient[i] > 1.0f)
+			m_gradient[i] -= 1.0f;
+	}
+}
+
+void SVKNBodyCpu::Integrate(uint32_t begin, uint32_t end, float deltaT) {
+	for (uint32_t i = begin; i < end; ++i) {
+		m_posX[i] += deltaT * m_velX[i];
+		m_posY[i] += deltaT * m_velY[i];
+		m_posZ[i] += deltaT * m_velZ[i];
+	}
+}
+
+void SVKNBodyCpu::ParallelFor(uint32_t count, void (SVKNBodyCpu::*func)(uint32_t, uint32_t, float), float deltaT) {
+	m_jobSystem->ParallelFor(count, g_minParticlesPerJob, [this, func, deltaT](uint32_t begin, uint32_t end) {
+		(this->*func)(begin, end, deltaT);
+	});
+}
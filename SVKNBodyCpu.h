@@ -0,0 +1,59 @@
+#pragma once
+
+#include "common.h"
+
+#include "SVKNBody.h"
+#include "SVKJobSystem.h"
+
+class SVKConfig;
+
+// CPU reference of the test.comp force law plus the integration pass. Particles
+// are kept as structure of arrays, padded to the SIMD width with massless
+// bodies, so the inner loop over all other bodies runs AVX2 (x64, when CPUID
+// reports it) or NEON (AArch64) wide; the outer loop is split across the job system threads. Used to validate the
+// GPU state and as a baseline on machines without a usable GPU.
+class SVKNBodyCpu
+{
+public:
+	static const uint32_t g_simdWidth;
+	static const double g_flopsPerInteraction;
+	static const double g_validationTolerance;
+
+	static const char* GetInstructionSet();
+	static double ComputeRelativeError(const std::vector<SVKNBody::Particle>& reference, const std::vector<SVKNBody::Particle>& particles);
+
+	// simulates --particles bodies for --frames steps without Vulkan and reports the timings
+	static void RunBenchmark(const SVKConfig& config);
+
+public:
+	SVKNBodyCpu();
+
+	void Initialize(const std::vector<SVKNBody::Particle>& particles, const SVKNBody::KernelConstants& kernelConstants, SVKJobSystem& jobSystem);
+
+	uint32_t GetParticleCount() const;
+	uint32_t GetThreadCount() const;
+	double GetInteractionsPerStep() const;
+
+	void Step(float deltaT);
+	void GetParticles(std::vector<SVKNBody::Particle>& particles) const;
+
+protected:
+	void ComputeForces(uint32_t begin, uint32_t end, float deltaT);
+	void Integrate(uint32_t begin, uint32_t end, float deltaT);
+	void ParallelFor(uint32_t count, void (SVKNBodyCpu::*func)(uint32_t, uint32_t, float), float deltaT);
+
+protected:
+	uint32_t m_particleCount;
+	uint32_t m_paddedCount;
+	SVKJobSystem* m_jobSystem;
+	SVKNBody::KernelConstants m_kernelConstants;
+
+	std::vector<float> m_posX;
+	std::vector<float> m_posY;
+	std::vector<float> m_posZ;
+	std::vector<float> m_mass;
+	std::vector<float> m_velX;
+	std::vector<float> m_velY;
+	std::vector<float> m_velZ;
+	std::vector<float> m_gradient;
+};
@@ -0,0 +1,58 @@
+#include "SVKNBodyCpuAvx2.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+
+#include <immintrin.h>
+
+// MSVC builds this file with /arch:AVX2; other compilers get the target per function
+#if defined(_MSC_VER)
+#define SVK_TARGET_AVX2
+#else
+#define SVK_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+SVK_TARGET_AVX2 void SVKNBodyAccumulateAvx2(
+	const float* posX,
+	const float* posY,
+	const float* posZ,
+	const float* mass,
+	uint32_t count,
+	float x,
+	float y,
+	float z,
+	float soften,
+	float acceleration[3]
+) {
+	__m256 px = _mm256_set1_ps(x);
+	__m256 py = _mm256_set1_ps(y);
+	__m256 pz = _mm256_set1_ps(z);
+	__m256 soft = _mm256_set1_ps(soften);
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 ax = _mm256_setzero_ps();
+	__m256 ay = _mm256_setzero_ps();
+	__m256 az = _mm256_setzero_ps();
+	for (uint32_t j = 0; j < count; j += 8) {
+		__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(posX + j), px);
+		__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(posY + j), py);
+		__m256 dz = _mm256_sub_ps(_mm256_loadu_ps(posZ + j), pz);
+		__m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_add_ps(_mm256_mul_ps(dz, dz), soft));
+		// full precision division rather than _mm256_rsqrt_ps, the result is compared against the GPU
+		__m256 invSqrt = _mm256_div_ps(one, _mm256_sqrt_ps(d2));
+		__m256 s = _mm256_mul_ps(_mm256_loadu_ps(mass + j), _mm256_mul_ps(invSqrt, _mm256_sqrt_ps(invSqrt)));
+		ax = _mm256_add_ps(ax, _mm256_mul_ps(dx, s));
+		ay = _mm256_add_ps(ay, _mm256_mul_ps(dy, s));
+		az = _mm256_add_ps(az, _mm256_mul_ps(dz, s));
+	}
+
+	alignas(32) float lanes[3][8];
+	_mm256_store_ps(lanes[0], ax);
+	_mm256_store_ps(lanes[1], ay);
+	_mm256_store_ps(lanes[2], az);
+	for (uint32_t lane = 0; lane < 8; ++lane) {
+		acceleration[0] += lanes[0][lane];
+		acceleration[1] += lanes[1][lane];
+		acceleration[2] += lanes[2][lane];
+	}
+}
+
+#endif
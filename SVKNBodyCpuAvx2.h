@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+// AVX2 inner loop of SVKNBodyCpu::ComputeForces. It lives in a translation unit
+// of its own, the only one built with AVX2 code generation, which includes
+// nothing but the intrinsics so no inline library code compiled for AVX2 can
+// end up in the rest of the program. Only call it after SVKNBodyCpu has found
+// AVX2 on the CPU.
+//
+// Adds to acceleration the pull of count bodies (a multiple of 8) on the body
+// at x, y, z with the test.comp force law for POWER 0.75, without gravity.
+void SVKNBodyAccumulateAvx2(
+	const float* posX,
+	const float* posY,
+	const float* posZ,
+	const float* mass,
+	uint32_t count,
+	float x,
+	float y,
+	float z,
+	float soften,
+	float acceleration[3]
+);
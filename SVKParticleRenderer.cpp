@@ -0,0 +1,276 @@
+#include "SVKParticleRenderer.h"
+
+// the initial cloud spans about +-10 units, the camera looks at the origin from (2, 2, 2)
+const SVKParticleRenderer::PushConstants SVKParticleRenderer::g_defaultPushConstants = { 0.15f, 0.005f };
+
+// *********************************************************************************
+
+SVKParticleRenderer::SVKParticleRenderer() :
+	m_logicalDevice(VK_NULL_HANDLE),
+	m_pipelineCache(nullptr),
+	m_particleCount(0),
+	m_pushConstants(g_defaultPushConstants),
+	m_descriptorSetLayout(VK_NULL_HANDLE),
+	m_descriptorPool(VK_NULL_HANDLE),
+	m_pipelineLayout(VK_NULL_HANDLE),
+	m_pipeline(VK_NULL_HANDLE)
+{
+}
+
+void SVKParticleRenderer::Initialize(
+	VkDevice logicalDevice,
+	SVKPipelineCache& pipelineCache,
+	const std::filesystem::path& shaderDir,
+	VkRenderPass renderPass,
+	VkBuffer uniformBuffer,
+	VkDeviceSize uniformRange,
+	const std::vector<VkBuffer>& particleBuffers,
+	uint32_t particleCount
+) {
+	m_particleCount = particleCount;
+	if (!IsEnabled())
+		return;
+
+	m_logicalDevice = logicalDevice;
+	m_pipelineCache = &pipelineCache;
+	m_shaderDir = shaderDir;
+
+	CreateDescriptors(uniformBuffer, uniformRange, particleBuffers);
+	CreatePipeline(renderPass);
+}
+
+void SVKParticleRenderer::Cleanup() {
+	if (m_logicalDevice == VK_NULL_HANDLE)
+		return;
+
+	DestroyPipeline();
+
+	vkDestroyPipelineLayout(m_logicalDevice, m_pipelineLayout, nullptr);
+	m_pipelineLayout = VK_NULL_HANDLE;
+	vkDestroyDescriptorPool(m_logicalDevice, m_descriptorPool, nullptr);
+	m_descriptorPool = VK_NULL_HANDLE;
+	m_descriptorSets.clear();
+	vkDestroyDescriptorSetLayout(m_logicalDevice, m_descriptorSetLayout, nullptr);
+	m_descriptorSetLayout = VK_NULL_HANDLE;
+
+	m_logicalDevice = VK_NULL_HANDLE;
+}
+
+void SVKParticleRenderer::CreatePipeline(VkRenderPass renderPass) {
+	if (!IsEnabled())
+		return;
+
+	VkShaderModule shaderVertModule = CreateShaderModule("particle.vert.spv");
+	VkShaderModule shaderFragModule = CreateShaderModule("particle.frag.spv");
+
+	VkPipelineShaderStageCreateInfo shaderStages[2]{};
+	shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	shaderStages[0].module = shaderVertModule;
+	shaderStages[0].pName = "main";
+	shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	shaderStages[1].module = shaderFragModule;
+	shaderStages[1].pName = "main";
+
+	// no vertex input, the shader pulls the particles from the storage buffer
+	VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+	VkPipelineViewportStateCreateInfo viewportState{};
+	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportState.viewportCount = 1;
+	viewportState.scissorCount = 1;
+
+	VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+	VkPipelineDynamicStateCreateInfo dynamicState{};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = 2;
+	dynamicState.pDynamicStates = dynamicStates;
+
+	VkPipelineRasterizationStateCreateInfo rasterizer{};
+	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizer.depthClampEnable = VK_FALSE;
+	rasterizer.rasterizerDiscardEnable = VK_FALSE;
+	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizer.lineWidth = 1.0f;
+	rasterizer.cullMode = VK_CULL_MODE_NONE;
+	rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+	VkPipelineMultisampleStateCreateInfo multisampling{};
+	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+	multisampling.minSampleShading = 1.0f;
+
+	// additive: overlapping sprites accumulate, draw order does not matter
+	VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+	colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	colorBlendAttachment.blendEnable = VK_TRUE;
+	colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+	colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+	colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+	colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+	colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+	VkPipelineColorBlendStateCreateInfo colorBlending{};
+	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlending.logicOpEnable = VK_FALSE;
+	colorBlending.attachmentCount = 1;
+	colorBlending.pAttachments = &colorBlendAttachment;
+
+	VkGraphicsPipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineInfo.stageCount = 2;
+	pipelineInfo.pStages = shaderStages;
+	pipelineInfo.pVertexInputState = &vertexInputInfo;
+	pipelineInfo.pInputAssemblyState = &inputAssembly;
+	pipelineInfo.pViewportState = &viewportState;
+	pipelineInfo.pRasterizationState = &rasterizer;
+	pipelineInfo.pMultisampleState = &multisampling;
+	pipelineInfo.pColorBlendState = &colorBlending;
+	pipelineInfo.pDynamicState = &dynamicState;
+	pipelineInfo.layout = m_pipelineLayout;
+	pipelineInfo.renderPass = renderPass;
+	pipelineInfo.subpass = 0;
+	pipelineInfo.basePipelineIndex = -1;
+
+	auto startTm = std::chrono::high_resolution_clock::now();
+	vkCheckResult(vkCreateGraphicsPipelines(m_logicalDevice, m_pipelineCache->Get(), 1, &pipelineInfo, nullptr, &m_pipeline), "Create Particle Pipeline");
+	std::chrono::duration<double, std::milli> createTm = std::chrono::high_resolution_clock::now() - startTm;
+	m_pipelineCache->RecordCreation("particles", createTm.count());
+
+	vkDestroyShaderModule(m_logicalDevice, shaderVertModule, nullptr);
+	vkDestroyShaderModule(m_logicalDevice, shaderFragModule, nullptr);
+}
+
+void SVKParticleRenderer::DestroyPipeline() {
+	if (m_pipeline == VK_NULL_HANDLE)
+		return;
+
+	vkDestroyPipeline(m_logicalDevice, m_pipeline, nullptr);
+	m_pipeline = VK_NULL_HANDLE;
+}
+
+bool SVKParticleRenderer::IsEnabled() const {
+	return m_particleCount != 0;
+}
+
+void SVKParticleRenderer::RecordDraw(VkCommandBuffer commandBuffer, uint32_t uniformOffset, uint32_t particleBufferIndex) {
+	if (!IsEnabled())
+		return;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descriptorSets[particleBufferIndex], 1, &uniformOffset);
+	vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(m_pushConstants), &m_pushConstants);
+
+	// one instance per particle, six vertices per quad
+	vkCmdDraw(commandBuffer, 6, m_particleCount, 0, 0);
+}
+
+void SVKParticleRenderer::CreateDescriptors(VkBuffer uniformBuffer, VkDeviceSize uniformRange, const std::vector<VkBuffer>& particleBuffers) {
+	uint32_t setCount = static_cast<uint32_t>(particleBuffers.size());
+
+	VkDescriptorSetLayoutBinding bindings[2]{};
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[1].descriptorCount = 1;
+	bindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = 2;
+	layoutInfo.pBindings = bindings;
+
+	vkCheckResult(vkCreateDescriptorSetLayout(m_logicalDevice, &layoutInfo, nullptr, &m_descriptorSetLayout), "Create Particle DescriptorSetLayout");
+
+	VkDescriptorPoolSize poolSizes[2]{};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	poolSizes[0].descriptorCount = setCount;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[1].descriptorCount = setCount;
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = 2;
+	poolInfo.pPoolSizes = poolSizes;
+	poolInfo.maxSets = setCount;
+
+	vkCheckResult(vkCreateDescriptorPool(m_logicalDevice, &poolInfo, nullptr, &m_descriptorPool), "Create Particle DescriptorPool");
+
+	std::vector<VkDescriptorSetLayout> layouts(setCount, m_descriptorSetLayout);
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = m_descriptorPool;
+	allocInfo.descriptorSetCount = setCount;
+	allocInfo.pSetLayouts = layouts.data();
+
+	m_descriptorSets.resize(setCount);
+	vkCheckResult(vkAllocateDescriptorSets(m_logicalDevice, &allocInfo, m_descriptorSets.data()), "Allocate Particle DescriptorSets");
+
+	for (uint32_t i = 0; i < setCount; ++i) {
+		VkDescriptorBufferInfo uniformInfo{};
+		uniformInfo.buffer = uniformBuffer;
+		uniformInfo.offset = 0;
+		uniformInfo.range = uniformRange;
+
+		VkDescriptorBufferInfo particleInfo{};
+		particleInfo.buffer = particleBuffers[i];
+		particleInfo.offset = 0;
+		particleInfo.range = VK_WHOLE_SIZE;
+
+		VkWriteDescriptorSet descriptorWrites[2]{};
+		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[0].dstSet = m_descriptorSets[i];
+		descriptorWrites[0].dstBinding = 0;
+		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		descriptorWrites[0].descriptorCount = 1;
+		descriptorWrites[0].pBufferInfo = &uniformInfo;
+		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[1].dstSet = m_descriptorSets[i];
+		descriptorWrites[1].dstBinding = 1;
+		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[1].descriptorCount = 1;
+		descriptorWrites[1].pBufferInfo = &particleInfo;
+
+		vkUpdateDescriptorSets(m_logicalDevice, 2, descriptorWrites, 0, nullptr);
+	}
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(PushConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &m_descriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	vkCheckResult(vkCreatePipelineLayout(m_logicalDevice, &pipelineLayoutInfo, nullptr, &m_pipelineLayout), "Create Particle PipelineLayout");
+}
+
+VkShaderModule SVKParticleRenderer::CreateShaderModule(const char* shaderName) {
+	std::vector<char> code = ReadFile((m_shaderDir / shaderName).string());
+
+	VkShaderModuleCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	createInfo.codeSize = code.size();
+	createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+
+	VkShaderModule shaderModule;
+	vkCheckResult(vkCreateShaderModule(m_logicalDevice, &createInfo, nullptr, &shaderModule), "Create Particle ShaderModule");
+	return shaderModule;
+}
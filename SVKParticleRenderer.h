@@ -0,0 +1,61 @@
+#pragma once
+
+#include "common.h"
+
+#include "SVKPipelineCache.h"
+
+// Draws the N-body particles straight from the simulation storage buffer:
+// the vertex shader pulls each particle by gl_InstanceIndex and expands it to
+// a quad, so no vertex buffer is filled and the data never leaves the GPU.
+// Sprites are blended additively on top of the scene. Each particle buffer
+// (two with async compute) gets its own descriptor set.
+class SVKParticleRenderer
+{
+public:
+	// push constants of particle.vert
+	struct PushConstants {
+		float positionScale;
+		float spriteSize;
+	};
+
+	static const PushConstants g_defaultPushConstants;
+
+public:
+	SVKParticleRenderer();
+
+	void Initialize(
+		VkDevice logicalDevice,
+		SVKPipelineCache& pipelineCache,
+		const std::filesystem::path& shaderDir,
+		VkRenderPass renderPass,
+		VkBuffer uniformBuffer,
+		VkDeviceSize uniformRange,
+		const std::vector<VkBuffer>& particleBuffers,
+		uint32_t particleCount
+	);
+	void Cleanup();
+
+	// the pipeline depends on the render pass and is rebuilt with it
+	void CreatePipeline(VkRenderPass renderPass);
+	void DestroyPipeline();
+
+	bool IsEnabled() const;
+	void RecordDraw(VkCommandBuffer commandBuffer, uint32_t uniformOffset, uint32_t particleBufferIndex);
+
+protected:
+	void CreateDescriptors(VkBuffer uniformBuffer, VkDeviceSize uniformRange, const std::vector<VkBuffer>& particleBuffers);
+	VkShaderModule CreateShaderModule(const char* shaderName);
+
+protected:
+	VkDevice m_logicalDevice;
+	SVKPipelineCache* m_pipelineCache;
+	std::filesystem::path m_shaderDir;
+	uint32_t m_particleCount;
+	PushConstants m_pushConstants;
+
+	VkDescriptorSetLayout m_descriptorSetLayout;
+	VkDescriptorPool m_descriptorPool;
+	std::vector<VkDescriptorSet> m_descriptorSets;
+	VkPipelineLayout m_pipelineLayout;
+	VkPipeline m_pipeline;
+};
@@ -0,0 +1,140 @@
+#include "SVKPipelineCache.h"
+
+SVKPipelineCache::SVKPipelineCache() :
+	m_logicalDevice(VK_NULL_HANDLE),
+	m_pipelineCache(VK_NULL_HANDLE),
+	m_vendorID(0),
+	m_deviceID(0),
+	m_pipelineCacheUUID{},
+	m_loadedSize(0)
+{
+}
+
+void SVKPipelineCache::Initialize(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, const std::filesystem::path& path) {
+	m_logicalDevice = logicalDevice;
+	m_path = path;
+	m_loadedSize = 0;
+	m_creationTimes.clear();
+
+	VkPhysicalDeviceProperties physicalDeviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+	m_vendorID = physicalDeviceProperties.vendorID;
+	m_deviceID = physicalDeviceProperties.deviceID;
+	memcpy(m_pipelineCacheUUID, physicalDeviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+
+	std::vector<char> data;
+	std::ifstream file(m_path, std::ios::ate | std::ios::binary);
+	if (file.is_open()) {
+		data.resize(static_cast<size_t>(file.tellg()));
+		file.seekg(0);
+		file.read(data.data(), data.size());
+		if (!file)
+			data.clear();
+	}
+
+	std::string reason;
+	if (!data.empty() && !ValidateHeader(data, reason)) {
+		std::cerr << "Pipeline cache: ignoring '" << m_path.string() << "': " << reason << std::endl;
+		data.clear();
+	}
+
+	VkPipelineCacheCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	createInfo.initialDataSize = data.size();
+	createInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+	vkCheckResult(vkCreatePipelineCache(m_logicalDevice, &createInfo, nullptr, &m_pipelineCache), "Create PipelineCache");
+	m_loadedSize = data.size();
+}
+
+void SVKPipelineCache::Save() {
+	if (m_pipelineCache == VK_NULL_HANDLE || m_path.empty())
+		return;
+
+	size_t size = 0;
+	vkCheckResult(vkGetPipelineCacheData(m_logicalDevice, m_pipelineCache, &size, nullptr), "Get PipelineCache Size");
+	std::vector<char> data(size);
+	vkCheckResult(vkGetPipelineCacheData(m_logicalDevice, m_pipelineCache, &size, data.data()), "Get PipelineCache Data");
+	data.resize(size);
+
+	std::filesystem::path tempPath = m_path;
+	tempPath += ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		file.write(data.data(), data.size());
+		if (!file) {
+			std::cerr << "Pipeline cache: failed to write '" << tempPath.string() << '\'' << std::endl;
+			return;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, m_path, error);
+	if (error) {
+		std::cerr << "Pipeline cache: failed to replace '" << m_path.string() << "': " << error.message() << std::endl;
+		std::filesystem::remove(tempPath, error);
+	}
+}
+
+void SVKPipelineCache::Cleanup() {
+	if (m_pipelineCache != VK_NULL_HANDLE) {
+		vkDestroyPipelineCache(m_logicalDevice, m_pipelineCache, nullptr);
+		m_pipelineCache = VK_NULL_HANDLE;
+	}
+	m_logicalDevice = VK_NULL_HANDLE;
+}
+
+VkPipelineCache SVKPipelineCache::Get() const {
+	return m_pipelineCache;
+}
+
+bool SVKPipelineCache::IsWarm() const {
+	return m_loadedSize != 0;
+}
+
+void SVKPipelineCache::RecordCreation(const char* name, double milliseconds) {
+	m_creationTimes.emplace_back(name, milliseconds);
+}
+
+double SVKPipelineCache::GetCreationTime() const {
+	double total = 0.0;
+	for (const auto& [name, milliseconds] : m_creationTimes)
+		total += milliseconds;
+	return total;
+}
+
+void SVKPipelineCache::PrintStatistics(std::ostream& os) const {
+	os << "Pipeline cache: " << (IsWarm() ? "warm" : "cold") << " (" << m_loadedSize << " bytes loaded); "
+		<< m_creationTimes.size() << " pipeline(s) created in " << GetCreationTime() << " ms" << std::endl;
+	for (const auto& [name, milliseconds] : m_creationTimes)
+		os << "\t" << name << ": " << milliseconds << " ms" << std::endl;
+}
+
+bool SVKPipelineCache::ValidateHeader(const std::vector<char>& data, std::string& reason) const {
+	// VkPipelineCacheHeaderVersionOne: headerSize, headerVersion, vendorID, deviceID, pipelineCacheUUID
+	const size_t headerSize = 4 * sizeof(uint32_t) + VK_UUID_SIZE;
+	if (data.size() < headerSize) {
+		reason = "file too small";
+		return false;
+	}
+
+	uint32_t header[4];
+	memcpy(header, data.data(), sizeof(header));
+
+	std::stringstream ss;
+	if (header[0] < headerSize || header[0] > data.size())
+		ss << "invalid header size " << header[0];
+	else if (header[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+		ss << "unknown header version " << header[1];
+	else if (header[2] != m_vendorID)
+		ss << "vendor ID " << std::hex << header[2] << " does not match " << m_vendorID;
+	else if (header[3] != m_deviceID)
+		ss << "device ID " << std::hex << header[3] << " does not match " << m_deviceID;
+	else if (memcmp(data.data() + sizeof(header), m_pipelineCacheUUID, VK_UUID_SIZE) != 0)
+		ss << "pipeline cache UUID does not match (driver changed)";
+	else
+		return true;
+
+	reason = ss.str();
+	return false;
+}
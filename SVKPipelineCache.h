@@ -0,0 +1,39 @@
+#pragma once
+
+#include "common.h"
+
+// VkPipelineCache persisted between runs. The file is only used when its header
+// matches the current driver (vendor, device and cache UUID); it is written to
+// a temporary file and renamed over the old one, so an interrupted save never
+// leaves a truncated cache behind.
+class SVKPipelineCache
+{
+public:
+	SVKPipelineCache();
+
+	void Initialize(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, const std::filesystem::path& path);
+	void Save();
+	void Cleanup();
+
+	VkPipelineCache Get() const;
+	bool IsWarm() const;
+
+	void RecordCreation(const char* name, double milliseconds);
+	double GetCreationTime() const;
+	void PrintStatistics(std::ostream& os) const;
+
+protected:
+	bool ValidateHeader(const std::vector<char>& data, std::string& reason) const;
+
+protected:
+	VkDevice m_logicalDevice;
+	VkPipelineCache m_pipelineCache;
+	std::filesystem::path m_path;
+
+	uint32_t m_vendorID;
+	uint32_t m_deviceID;
+	uint8_t m_pipelineCacheUUID[VK_UUID_SIZE];
+
+	size_t m_loadedSize;
+	std::vector<std::pair<std::string, double>> m_creationTimes;
+};
@@ -0,0 +1,276 @@
+#include "SVKSnapshotWriter.h"
+
+#include <cmath>
+#include <limits>
+
+const char SVKSnapshotWriter::g_magic[4] = { 'S', 'V', 'K', 'S' };
+const uint32_t SVKSnapshotWriter::g_version = 1;
+
+// about 0.0002 units; positions span tens of units, velocities a few
+const float SVKSnapshotWriter::g_deltaQuantum = 1.0f / 4096.0f;
+
+static const char* g_encodingNames[] = { "raw", "quantized", "delta" };
+
+// *********************************************************************************
+
+SVKSnapshotWriter::SVKSnapshotWriter() :
+	m_encoding(Encoding::Raw),
+	m_particleCount(0),
+	m_closing(false),
+	m_nextTicket(1),
+	m_writtenTicket(0),
+	m_bytesWritten(0),
+	m_waitTime(0.0)
+{
+}
+
+SVKSnapshotWriter::~SVKSnapshotWriter() {
+	if (!m_worker.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closing = true;
+	}
+	m_jobAvailable.notify_one();
+	m_worker.join();
+}
+
+void SVKSnapshotWriter::Open(const std::filesystem::path& path, Encoding encoding, uint32_t particleCount, float deltaT) {
+	m_file.open(path, std::ios::binary | std::ios::trunc);
+	if (!m_file.is_open()) {
+		std::stringstream ss;
+		ss << "Snapshot writer: cannot open '" << path.string() << '\'';
+		throw std::runtime_error(ss.str());
+	}
+
+	m_encoding = encoding;
+	m_particleCount = particleCount;
+	m_previous.assign(particleCount * 6, 0);
+	m_closing = false;
+	m_error = nullptr;
+	m_nextTicket = 1;
+	m_writtenTicket = 0;
+	m_waitTime = 0.0;
+
+	FileHeader header{};
+	std::copy(g_magic, g_magic + 4, header.magic);
+	header.version = g_version;
+	header.encoding = static_cast<uint32_t>(encoding);
+	header.particleCount = particleCount;
+	header.deltaT = deltaT;
+	header.quantum = encoding == Encoding::Delta ? g_deltaQuantum : 0.0f;
+	m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	m_bytesWritten = sizeof(header);
+
+	m_worker = std::thread(&SVKSnapshotWriter::WorkerMain, this);
+}
+
+void SVKSnapshotWriter::Close() {
+	if (!m_worker.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closing = true;
+	}
+	m_jobAvailable.notify_one();
+	m_worker.join();
+	m_file.close();
+
+	if (m_error) {
+		std::exception_ptr error = m_error;
+		m_error = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+uint64_t SVKSnapshotWriter::Enqueue(uint64_t step, const SVKNBody::Particle* particles) {
+	uint64_t ticket;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		ticket = m_nextTicket++;
+		m_jobs.push_back(Job{ ticket, step, particles });
+	}
+	m_jobAvailable.notify_one();
+	return ticket;
+}
+
+void SVKSnapshotWriter::Wait(uint64_t ticket) {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (m_writtenTicket >= ticket)
+		return;
+
+	// the disk is slower than the GPU; the time shows up here, never on the GPU timeline
+	auto startTm = std::chrono::high_resolution_clock::now();
+	m_jobDone.wait(lock, [this, ticket]() { return m_writtenTicket >= ticket; });
+	std::chrono::duration<double, std::milli> waitTm = std::chrono::high_resolution_clock::now() - startTm;
+	m_waitTime += waitTm.count();
+}
+
+uint64_t SVKSnapshotWriter::GetSnapshotCount() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_writtenTicket;
+}
+
+uint64_t SVKSnapshotWriter::GetBytesWritten() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_bytesWritten;
+}
+
+double SVKSnapshotWriter::GetWaitTime() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_waitTime;
+}
+
+bool SVKSnapshotWriter::GetEncoding(const std::string& name, Encoding& encoding) {
+	for (size_t i = 0; i < sizeof(g_encodingNames) / sizeof(g_encodingNames[0]); ++i) {
+		if (name == g_encodingNames[i]) {
+			encoding = static_cast<Encoding>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* SVKSnapshotWriter::GetEncodingName(Encoding encoding) {
+	return g_encodingNames[static_cast<size_t>(encoding)];
+}
+
+void SVKSnapshotWriter::WorkerMain() {
+	for (;;) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_jobAvailable.wait(lock, [this]() { return !m_jobs.empty() || m_closing; });
+			if (m_jobs.empty())
+				return;
+			job = m_jobs.front();
+		}
+
+		// after a failure the jobs are only retired, so nobody waits forever; Close() reports the error
+		uint64_t bytes = 0;
+		if (!m_error) {
+			try {
+				if (job.ticket == 1 && m_encoding != Encoding::Raw) {
+					std::vector<float> masses(m_particleCount);
+					for (uint32_t i = 0; i < m_particleCount; ++i)
+						masses[i] = job.particles[i].pos.w;
+					m_file.write(reinterpret_cast<const char*>(masses.data()), masses.size() * sizeof(float));
+					bytes += masses.size() * sizeof(float);
+				}
+
+				Encode(job.particles);
+
+				SnapshotHeader header{};
+				header.step = job.step;
+				header.payloadSize = m_payload.size();
+				m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+				m_file.write(reinterpret_cast<const char*>(m_payload.data()), m_payload.size());
+				if (!m_file)
+					throw std::runtime_error("Snapshot writer: write failed");
+				bytes += sizeof(header) + m_payload.size();
+			}
+			catch (...) {
+				m_error = std::current_exception();
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_jobs.pop_front();
+			m_writtenTicket = job.ticket;
+			m_bytesWritten += bytes;
+		}
+		m_jobDone.notify_all();
+	}
+}
+
+void SVKSnapshotWriter::Encode(const SVKNBody::Particle* particles) {
+	if (m_encoding == Encoding::Raw) {
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(particles);
+		m_payload.assign(bytes, bytes + sizeof(SVKNBody::Particle) * m_particleCount);
+		return;
+	}
+
+	if (m_encoding == Encoding::Quantized)
+		EncodeQuantized(particles);
+	else
+		EncodeDelta(particles);
+	EncodePhases(particles);
+}
+
+void SVKSnapshotWriter::EncodeQuantized(const SVKNBody::Particle* particles) {
+	// components 0..2 position, 3..5 velocity
+	auto component = [particles](uint32_t i, uint32_t c) {
+		return c < 3 ? particles[i].pos[c] : particles[i].vel[c - 3];
+	};
+
+	float minValues[6], maxValues[6];
+	std::fill(minValues, minValues + 6, std::numeric_limits<float>::max());
+	std::fill(maxValues, maxValues + 6, std::numeric_limits<float>::lowest());
+	for (uint32_t i = 0; i < m_particleCount; ++i) {
+		for (uint32_t c = 0; c < 6; ++c) {
+			minValues[c] = std::min(minValues[c], component(i, c));
+			maxValues[c] = std::max(maxValues[c], component(i, c));
+		}
+	}
+
+	float bounds[12];
+	for (uint32_t c = 0; c < 3; ++c) {
+		bounds[c] = minValues[c];
+		bounds[3 + c] = maxValues[c];
+		bounds[6 + c] = minValues[3 + c];
+		bounds[9 + c] = maxValues[3 + c];
+	}
+
+	m_payload.resize(sizeof(bounds) + static_cast<size_t>(m_particleCount) * 6 * sizeof(uint16_t));
+	std::copy(reinterpret_cast<const uint8_t*>(bounds), reinterpret_cast<const uint8_t*>(bounds) + sizeof(bounds), m_payload.begin());
+
+	float scales[6];
+	for (uint32_t c = 0; c < 6; ++c)
+		scales[c] = maxValues[c] > minValues[c] ? 65535.0f / (maxValues[c] - minValues[c]) : 0.0f;
+
+	uint16_t* values = reinterpret_cast<uint16_t*>(m_payload.data() + sizeof(bounds));
+	for (uint32_t i = 0; i < m_particleCount; ++i) {
+		for (uint32_t c = 0; c < 6; ++c) {
+			float scaled = (component(i, c) - minValues[c]) * scales[c];
+			values[i * 6 + c] = static_cast<uint16_t>(std::lround(std::min(std::max(scaled, 0.0f), 65535.0f)));
+		}
+	}
+}
+
+void SVKSnapshotWriter::EncodeDelta(const SVKNBody::Particle* particles) {
+	// mostly one or two bytes per component between close snapshots
+	m_payload.clear();
+	m_payload.reserve(static_cast<size_t>(m_particleCount) * 6 * 2);
+
+	const double minValue = std::numeric_limits<int32_t>::min();
+	const double maxValue = std::numeric_limits<int32_t>::max();
+	for (uint32_t i = 0; i < m_particleCount; ++i) {
+		for (uint32_t c = 0; c < 6; ++c) {
+			double value = c < 3 ? particles[i].pos[c] : particles[i].vel[c - 3];
+			int32_t quantized = static_cast<int32_t>(std::llround(std::min(std::max(value / g_deltaQuantum, minValue), maxValue)));
+
+			int64_t delta = static_cast<int64_t>(quantized) - m_previous[i * 6 + c];
+			m_previous[i * 6 + c] = quantized;
+
+			uint64_t zigzag = (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63);
+			while (zigzag >= 0x80) {
+				m_payload.push_back(static_cast<uint8_t>(zigzag | 0x80));
+				zigzag >>= 7;
+			}
+			m_payload.push_back(static_cast<uint8_t>(zigzag));
+		}
+	}
+}
+
+void SVKSnapshotWriter::EncodePhases(const SVKNBody::Particle* particles) {
+	// the shaders advance vel.w every step and wrap it at 1, so it cannot go into the header
+	size_t offset = m_payload.size();
+	m_payload.resize(offset + m_particleCount);
+	for (uint32_t i = 0; i < m_particleCount; ++i) {
+		float scaled = particles[i].vel.w * 255.0f;
+		m_payload[offset + i] = static_cast<uint8_t>(std::lround(std::min(std::max(scaled, 0.0f), 255.0f)));
+	}
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "common.h"
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <exception>
+
+#include "SVKNBody.h"
+
+// Streams N-body snapshots to a binary file. Encoding and disk writes run on a
+// worker thread; Enqueue() only hands over a pointer to the particles (usually
+// mapped staging memory), which must stay valid until Wait() returns for the
+// ticket.
+//
+// File layout, little endian:
+//   FileHeader
+//   quantized and delta: particleCount x float mass, the pos.w that does not
+//   change during a run
+//   per snapshot: SnapshotHeader, then payloadSize bytes
+//     raw:       particleCount x Particle
+//     quantized: float bounds[12] (position min xyz, max xyz, velocity min xyz,
+//                max xyz), then particleCount x uint16_t[6] spread over the bounds
+//     delta:     per particle and component (position xyz, velocity xyz) the
+//                zigzag varint of the value in quantum units minus the value of
+//                the previous snapshot (0 before the first one)
+//     quantized and delta end with particleCount x uint8_t, the color phase in
+//     vel.w (0..1, advanced by the simulation every step) in 1/255 steps
+class SVKSnapshotWriter
+{
+public:
+	enum class Encoding {
+		Raw,
+		Quantized,
+		Delta
+	};
+
+	struct FileHeader {
+		char magic[4];
+		uint32_t version;
+		uint32_t encoding;
+		uint32_t particleCount;
+		float deltaT;
+		float quantum;
+	};
+
+	struct SnapshotHeader {
+		uint64_t step;
+		uint64_t payloadSize;
+	};
+
+	static const char g_magic[4];
+	static const uint32_t g_version;
+	static const float g_deltaQuantum;
+
+protected:
+	struct Job {
+		uint64_t ticket;
+		uint64_t step;
+		const SVKNBody::Particle* particles;
+	};
+
+public:
+	SVKSnapshotWriter();
+	~SVKSnapshotWriter();
+
+	void Open(const std::filesystem::path& path, Encoding encoding, uint32_t particleCount, float deltaT);
+	void Close();
+
+	uint64_t Enqueue(uint64_t step, const SVKNBody::Particle* particles);
+	void Wait(uint64_t ticket);
+
+	uint64_t GetSnapshotCount() const;
+	uint64_t GetBytesWritten() const;
+	double GetWaitTime() const;
+
+	static bool GetEncoding(const std::string& name, Encoding& encoding);
+	static const char* GetEncodingName(Encoding encoding);
+
+protected:
+	void WorkerMain();
+	void Encode(const SVKNBody::Particle* particles);
+	void EncodeQuantized(const SVKNBody::Particle* particles);
+	void EncodeDelta(const SVKNBody::Particle* particles);
+	void EncodePhases(const SVKNBody::Particle* particles);
+
+protected:
+	std::ofstream m_file;
+	Encoding m_encoding;
+	uint32_t m_particleCount;
+	std::vector<uint8_t> m_payload;
+	std::vector<int32_t> m_previous;
+
+	std::thread m_worker;
+	mutable std::mutex m_mutex;
+	std::condition_variable m_jobAvailable;
+	std::condition_variable m_jobDone;
+	std::deque<Job> m_jobs;
+	bool m_closing;
+	std::exception_ptr m_error;
+	uint64_t m_nextTicket;
+	uint64_t m_writtenTicket;
+	uint64_t m_bytesWritten;
+	double m_waitTime;
+};
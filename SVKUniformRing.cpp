@@ -0,0 +1,112 @@
+#include "SVKUniformRing.h"
+
+static VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment) {
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+// *********************************************************************************
+
+SVKUniformRing::SVKUniformRing() :
+	m_logicalDevice(VK_NULL_HANDLE),
+	m_memoryAllocator(nullptr),
+	m_buffer(VK_NULL_HANDLE),
+	m_allocation{},
+	m_alignment(1),
+	m_regionSize(0),
+	m_regionCount(0),
+	m_currentRegion(0),
+	m_currentOffset(0)
+{
+}
+
+void SVKUniformRing::Initialize(
+	VkPhysicalDevice physicalDevice,
+	VkDevice logicalDevice,
+	SVKMemoryAllocator& memoryAllocator,
+	uint32_t regionCount,
+	VkDeviceSize regionSize
+) {
+	m_logicalDevice = logicalDevice;
+	m_memoryAllocator = &memoryAllocator;
+
+	VkPhysicalDeviceProperties physicalDeviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+	m_alignment = std::max<VkDeviceSize>(physicalDeviceProperties.limits.minUniformBufferOffsetAlignment, 1);
+
+	m_regionCount = regionCount;
+	m_regionSize = AlignUp(regionSize, m_alignment);
+	m_currentRegion = 0;
+	m_currentOffset = 0;
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = m_regionSize * m_regionCount;
+	bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	vkCheckResult(vkCreateBuffer(m_logicalDevice, &bufferInfo, nullptr, &m_buffer), "Create Uniform Ring Buffer");
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(m_logicalDevice, m_buffer, &memRequirements);
+
+	m_allocation = m_memoryAllocator->Allocate(
+		memRequirements,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		SVKMemoryAllocator::Strategy::General,
+		false
+	);
+	vkCheckResult(vkBindBufferMemory(m_logicalDevice, m_buffer, m_allocation.memory, m_allocation.offset), "Bind Uniform Ring Memory");
+}
+
+void SVKUniformRing::Cleanup() {
+	if (m_logicalDevice == VK_NULL_HANDLE)
+		return;
+
+	vkDestroyBuffer(m_logicalDevice, m_buffer, nullptr);
+	m_buffer = VK_NULL_HANDLE;
+	m_memoryAllocator->Free(m_allocation);
+
+	m_regionCount = 0;
+	m_logicalDevice = VK_NULL_HANDLE;
+}
+
+void SVKUniformRing::BeginRegion(uint32_t region) {
+	if (region >= m_regionCount)
+		throw std::runtime_error("Uniform ring: region out of range");
+
+	m_currentRegion = region;
+	m_currentOffset = 0;
+}
+
+uint32_t SVKUniformRing::Allocate(VkDeviceSize size, void*& data) {
+	VkDeviceSize offset = m_currentOffset;
+	if (offset + size > m_regionSize) {
+		std::stringstream ss;
+		ss << "Uniform ring: region of " << m_regionSize << " bytes exhausted";
+		throw std::runtime_error(ss.str());
+	}
+	m_currentOffset = AlignUp(offset + size, m_alignment);
+
+	VkDeviceSize bufferOffset = m_currentRegion * m_regionSize + offset;
+	data = static_cast<char*>(m_allocation.mappedData) + bufferOffset;
+	return static_cast<uint32_t>(bufferOffset);
+}
+
+uint32_t SVKUniformRing::Push(const void* data, VkDeviceSize size) {
+	void* dst;
+	uint32_t offset = Allocate(size, dst);
+	memcpy(dst, data, static_cast<size_t>(size));
+	return offset;
+}
+
+VkBuffer SVKUniformRing::GetBuffer() const {
+	return m_buffer;
+}
+
+uint32_t SVKUniformRing::GetRegionOffset(uint32_t region) const {
+	return static_cast<uint32_t>(region * m_regionSize);
+}
+
+VkDeviceSize SVKUniformRing::GetAlignment() const {
+	return m_alignment;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "common.h"
+
+#include "SVKMemoryAllocator.h"
+
+// One persistently mapped, host visible uniform buffer split into equally sized
+// regions, one per frame. Each frame rewinds its region and bump allocates its
+// constant blocks from it; the returned offsets are meant to be used as dynamic
+// uniform buffer offsets.
+class SVKUniformRing
+{
+public:
+	SVKUniformRing();
+
+	void Initialize(
+		VkPhysicalDevice physicalDevice,
+		VkDevice logicalDevice,
+		SVKMemoryAllocator& memoryAllocator,
+		uint32_t regionCount,
+		VkDeviceSize regionSize
+	);
+	void Cleanup();
+
+	void BeginRegion(uint32_t region);
+	uint32_t Allocate(VkDeviceSize size, void*& data);
+	uint32_t Push(const void* data, VkDeviceSize size);
+
+	VkBuffer GetBuffer() const;
+	uint32_t GetRegionOffset(uint32_t region) const;
+	VkDeviceSize GetAlignment() const;
+
+protected:
+	VkDevice m_logicalDevice;
+	SVKMemoryAllocator* m_memoryAllocator;
+	VkBuffer m_buffer;
+	SVKMemoryAllocator::Allocation m_allocation;
+	VkDeviceSize m_alignment;
+	VkDeviceSize m_regionSize;
+	uint32_t m_regionCount;
+	uint32_t m_currentRegion;
+	VkDeviceSize m_currentOffset;
+};
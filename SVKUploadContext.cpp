@@ -0,0 +1,336 @@
+#include "SVKUploadContext.h"
+
+SVKUploadContext::SVKUploadContext() :
+	m_logicalDevice(VK_NULL_HANDLE),
+	m_memoryAllocator(nullptr),
+	m_transferFamilyIndex(0),
+	m_transferQueue(VK_NULL_HANDLE),
+	m_graphicsFamilyIndex(0),
+	m_graphicsQueue(VK_NULL_HANDLE),
+	m_transferCommandPool(VK_NULL_HANDLE),
+	m_graphicsCommandPool(VK_NULL_HANDLE),
+	m_nextTicket(1),
+	m_completedTicket(0)
+{
+}
+
+void SVKUploadContext::Initialize(
+	VkDevice logicalDevice,
+	SVKMemoryAllocator& memoryAllocator,
+	uint32_t transferFamilyIndex,
+	VkQueue transferQueue,
+	uint32_t graphicsFamilyIndex,
+	VkQueue graphicsQueue
+) {
+	m_logicalDevice = logicalDevice;
+	m_memoryAllocator = &memoryAllocator;
+	m_transferFamilyIndex = transferFamilyIndex;
+	m_transferQueue = transferQueue;
+	m_graphicsFamilyIndex = graphicsFamilyIndex;
+	m_graphicsQueue = graphicsQueue;
+
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	poolInfo.queueFamilyIndex = m_transferFamilyIndex;
+	vkCheckResult(vkCreateCommandPool(m_logicalDevice, &poolInfo, nullptr, &m_transferCommandPool), "Create Upload CommandPool");
+
+	if (HasDedicatedTransferQueue()) {
+		poolInfo.queueFamilyIndex = m_graphicsFamilyIndex;
+		vkCheckResult(vkCreateCommandPool(m_logicalDevice, &poolInfo, nullptr, &m_graphicsCommandPool), "Create Upload Acquire CommandPool");
+	}
+}
+
+void SVKUploadContext::Cleanup() {
+	if (m_logicalDevice == VK_NULL_HANDLE)
+		return;
+
+	if (m_recording.has_value())
+		Submit();
+	while (!m_pending.empty()) {
+		vkCheckResult(vkWaitForFences(m_logicalDevice, 1, &m_pending.front().fence, VK_TRUE, UINT64_MAX), "Upload Fence Wait");
+		RetireBatch(m_pending.front());
+		m_pending.pop_front();
+	}
+
+	if (m_graphicsCommandPool != VK_NULL_HANDLE) {
+		vkDestroyCommandPool(m_logicalDevice, m_graphicsCommandPool, nullptr);
+		m_graphicsCommandPool = VK_NULL_HANDLE;
+	}
+	vkDestroyCommandPool(m_logicalDevice, m_transferCommandPool, nullptr);
+	m_transferCommandPool = VK_NULL_HANDLE;
+
+	m_logicalDevice = VK_NULL_HANDLE;
+}
+
+bool SVKUploadContext::HasDedicatedTransferQueue() const {
+	return m_transferFamilyIndex != m_graphicsFamilyIndex;
+}
+
+void SVKUploadContext::UploadBuffer(
+	VkBuffer buffer,
+	const void* data,
+	VkDeviceSize size,
+	VkPipelineStageFlags dstStageMask,
+	VkAccessFlags dstAccessMask
+) {
+	BeginBatch();
+	Batch& batch = m_recording.value();
+
+	StagingBuffer staging = CreateStagingBuffer(data, size);
+	batch.stagingBuffers.push_back(staging);
+
+	VkBufferCopy copyRegion{};
+	copyRegion.size = size;
+	vkCmdCopyBuffer(batch.transferCommandBuffer, staging.buffer, buffer, 1, &copyRegion);
+
+	VkBufferMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = dstAccessMask;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = buffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+
+	if (!HasDedicatedTransferQueue()) {
+		vkCmdPipelineBarrier(batch.transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStageMask, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+		return;
+	}
+
+	// queue family ownership transfer: release on the transfer queue, acquire on the graphics queue
+	barrier.srcQueueFamilyIndex = m_transferFamilyIndex;
+	barrier.dstQueueFamilyIndex = m_graphicsFamilyIndex;
+
+	barrier.dstAccessMask = 0;
+	vkCmdPipelineBarrier(batch.transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = dstAccessMask;
+	vkCmdPipelineBarrier(batch.graphicsCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStageMask, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+	batch.graphicsStageMask |= dstStageMask;
+}
+
+void SVKUploadContext::UploadImage(
+	VkImage image,
+	const void* data,
+	VkDeviceSize size,
+	uint32_t width,
+	uint32_t height,
+	VkImageLayout finalLayout,
+	VkPipelineStageFlags dstStageMask,
+	VkAccessFlags dstAccessMask
+) {
+	BeginBatch();
+	Batch& batch = m_recording.value();
+
+	StagingBuffer staging = CreateStagingBuffer(data, size);
+	batch.stagingBuffers.push_back(staging);
+
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(batch.transferCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	VkBufferImageCopy region{};
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+
+	region.imageOffset = { 0, 0, 0 };
+	region.imageExtent = { width, height, 1 };
+
+	vkCmdCopyBufferToImage(batch.transferCommandBuffer, staging.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = finalLayout;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = dstAccessMask;
+
+	if (!HasDedicatedTransferQueue()) {
+		vkCmdPipelineBarrier(batch.transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStageMask, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		return;
+	}
+
+	// the layout transition is part of the ownership transfer and must match on both sides
+	barrier.srcQueueFamilyIndex = m_transferFamilyIndex;
+	barrier.dstQueueFamilyIndex = m_graphicsFamilyIndex;
+
+	barrier.dstAccessMask = 0;
+	vkCmdPipelineBarrier(batch.transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = dstAccessMask;
+	vkCmdPipelineBarrier(batch.graphicsCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dstStageMask, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	batch.graphicsStageMask |= dstStageMask;
+}
+
+uint64_t SVKUploadContext::Submit() {
+	if (!m_recording.has_value())
+		return m_nextTicket - 1;
+
+	Batch& batch = m_recording.value();
+
+	VkFenceCreateInfo fenceInfo{};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	vkCheckResult(vkCreateFence(m_logicalDevice, &fenceInfo, nullptr, &batch.fence), "Create Upload Fence");
+
+	vkCheckResult(vkEndCommandBuffer(batch.transferCommandBuffer), "End Upload Commands");
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &batch.transferCommandBuffer;
+
+	if (!HasDedicatedTransferQueue())
+		vkCheckResult(vkQueueSubmit(m_transferQueue, 1, &submitInfo, batch.fence), "Upload Queue Submit");
+	else {
+		VkSemaphoreCreateInfo semaphoreInfo{};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		vkCheckResult(vkCreateSemaphore(m_logicalDevice, &semaphoreInfo, nullptr, &batch.semaphore), "Create Upload Semaphore");
+
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &batch.semaphore;
+		vkCheckResult(vkQueueSubmit(m_transferQueue, 1, &submitInfo, VK_NULL_HANDLE), "Upload Queue Submit");
+
+		vkCheckResult(vkEndCommandBuffer(batch.graphicsCommandBuffer), "End Upload Acquire Commands");
+
+		VkSubmitInfo acquireInfo{};
+		acquireInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		acquireInfo.waitSemaphoreCount = 1;
+		acquireInfo.pWaitSemaphores = &batch.semaphore;
+		acquireInfo.pWaitDstStageMask = &batch.graphicsStageMask;
+		acquireInfo.commandBufferCount = 1;
+		acquireInfo.pCommandBuffers = &batch.graphicsCommandBuffer;
+		vkCheckResult(vkQueueSubmit(m_graphicsQueue, 1, &acquireInfo, batch.fence), "Upload Acquire Queue Submit");
+	}
+
+	uint64_t ticket = batch.ticket;
+	m_pending.push_back(std::move(batch));
+	m_recording.reset();
+	return ticket;
+}
+
+bool SVKUploadContext::IsComplete(uint64_t ticket) {
+	Poll();
+	return ticket <= m_completedTicket;
+}
+
+void SVKUploadContext::Wait(uint64_t ticket) {
+	if (m_recording.has_value() && ticket >= m_recording->ticket)
+		Submit();
+
+	while (!m_pending.empty() && m_pending.front().ticket <= ticket) {
+		vkCheckResult(vkWaitForFences(m_logicalDevice, 1, &m_pending.front().fence, VK_TRUE, UINT64_MAX), "Upload Fence Wait");
+		RetireBatch(m_pending.front());
+		m_pending.pop_front();
+	}
+}
+
+void SVKUploadContext::Poll() {
+	while (!m_pending.empty()) {
+		VkResult result = vkGetFenceStatus(m_logicalDevice, m_pending.front().fence);
+		if (result == VK_NOT_READY)
+			break;
+		vkCheckResult(result, "Upload Fence Status");
+
+		RetireBatch(m_pending.front());
+		m_pending.pop_front();
+	}
+}
+
+void SVKUploadContext::BeginBatch() {
+	if (m_recording.has_value())
+		return;
+
+	Batch batch{};
+	batch.ticket = m_nextTicket++;
+	batch.graphicsStageMask = 0;
+	batch.semaphore = VK_NULL_HANDLE;
+	batch.fence = VK_NULL_HANDLE;
+
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = 1;
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	allocInfo.commandPool = m_transferCommandPool;
+	vkCheckResult(vkAllocateCommandBuffers(m_logicalDevice, &allocInfo, &batch.transferCommandBuffer), "Allocate Upload CommandBuffer");
+	vkCheckResult(vkBeginCommandBuffer(batch.transferCommandBuffer, &beginInfo), "Begin Upload Commands");
+
+	if (HasDedicatedTransferQueue()) {
+		allocInfo.commandPool = m_graphicsCommandPool;
+		vkCheckResult(vkAllocateCommandBuffers(m_logicalDevice, &allocInfo, &batch.graphicsCommandBuffer), "Allocate Upload Acquire CommandBuffer");
+		vkCheckResult(vkBeginCommandBuffer(batch.graphicsCommandBuffer, &beginInfo), "Begin Upload Acquire Commands");
+	}
+	else
+		batch.graphicsCommandBuffer = VK_NULL_HANDLE;
+
+	m_recording = std::move(batch);
+}
+
+SVKUploadContext::StagingBuffer SVKUploadContext::CreateStagingBuffer(const void* data, VkDeviceSize size) {
+	StagingBuffer staging{};
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	vkCheckResult(vkCreateBuffer(m_logicalDevice, &bufferInfo, nullptr, &staging.buffer), "Create Staging Buffer");
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(m_logicalDevice, staging.buffer, &memRequirements);
+
+	staging.allocation = m_memoryAllocator->Allocate(
+		memRequirements,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		SVKMemoryAllocator::Strategy::Linear,
+		false
+	);
+	vkCheckResult(vkBindBufferMemory(m_logicalDevice, staging.buffer, staging.allocation.memory, staging.allocation.offset), "Bind Staging Memory");
+
+	memcpy(staging.allocation.mappedData, data, static_cast<size_t>(size));
+	return staging;
+}
+
+void SVKUploadContext::RetireBatch(Batch& batch) {
+	for (StagingBuffer& staging : batch.stagingBuffers) {
+		vkDestroyBuffer(m_logicalDevice, staging.buffer, nullptr);
+		m_memoryAllocator->Free(staging.allocation);
+	}
+	batch.stagingBuffers.clear();
+
+	vkFreeCommandBuffers(m_logicalDevice, m_transferCommandPool, 1, &batch.transferCommandBuffer);
+	if (batch.graphicsCommandBuffer != VK_NULL_HANDLE)
+		vkFreeCommandBuffers(m_logicalDevice, m_graphicsCommandPool, 1, &batch.graphicsCommandBuffer);
+	if (batch.semaphore != VK_NULL_HANDLE)
+		vkDestroySemaphore(m_logicalDevice, batch.semaphore, nullptr);
+	vkDestroyFence(m_logicalDevice, batch.fence, nullptr);
+
+	m_completedTicket = std::max(m_completedTicket, batch.ticket);
+}
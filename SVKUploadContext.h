@@ -0,0 +1,90 @@
+#pragma once
+
+#include "common.h"
+
+#include <deque>
+
+#include "SVKMemoryAllocator.h"
+
+// Collects buffer and image uploads into one command buffer and submits them
+// together. With a dedicated transfer queue the copies run there and the
+// resources are released to the graphics queue family, which acquires them in a
+// small command buffer that waits on the transfer. Staging memory is freed once
+// the batch fence signals; the graphics queue is already ordered after the
+// upload, so recorded work may use the resources right after Submit().
+class SVKUploadContext
+{
+protected:
+	struct StagingBuffer {
+		VkBuffer buffer;
+		SVKMemoryAllocator::Allocation allocation;
+	};
+
+	struct Batch {
+		uint64_t ticket;
+		VkCommandBuffer transferCommandBuffer;
+		VkCommandBuffer graphicsCommandBuffer;
+		VkPipelineStageFlags graphicsStageMask;
+		VkSemaphore semaphore;
+		VkFence fence;
+		std::vector<StagingBuffer> stagingBuffers;
+	};
+
+public:
+	SVKUploadContext();
+
+	void Initialize(
+		VkDevice logicalDevice,
+		SVKMemoryAllocator& memoryAllocator,
+		uint32_t transferFamilyIndex,
+		VkQueue transferQueue,
+		uint32_t graphicsFamilyIndex,
+		VkQueue graphicsQueue
+	);
+	void Cleanup();
+
+	bool HasDedicatedTransferQueue() const;
+
+	void UploadBuffer(
+		VkBuffer buffer,
+		const void* data,
+		VkDeviceSize size,
+		VkPipelineStageFlags dstStageMask,
+		VkAccessFlags dstAccessMask
+	);
+	void UploadImage(
+		VkImage image,
+		const void* data,
+		VkDeviceSize size,
+		uint32_t width,
+		uint32_t height,
+		VkImageLayout finalLayout,
+		VkPipelineStageFlags dstStageMask,
+		VkAccessFlags dstAccessMask
+	);
+
+	uint64_t Submit();
+	bool IsComplete(uint64_t ticket);
+	void Wait(uint64_t ticket);
+	void Poll();
+
+protected:
+	void BeginBatch();
+	StagingBuffer CreateStagingBuffer(const void* data, VkDeviceSize size);
+	void RetireBatch(Batch& batch);
+
+protected:
+	VkDevice m_logicalDevice;
+	SVKMemoryAllocator* m_memoryAllocator;
+	uint32_t m_transferFamilyIndex;
+	VkQueue m_transferQueue;
+	uint32_t m_graphicsFamilyIndex;
+	VkQueue m_graphicsQueue;
+	VkCommandPool m_transferCommandPool;
+	VkCommandPool m_graphicsCommandPool;
+
+	std::optional<Batch> m_recording;
+	std::deque<Batch> m_pending;
+	uint64_t m_nextTicket;
+	uint64_t m_completedTicket;
+};
@@ -14,11 +14,14 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <iomanip>
 
 #include <vector>
 #include <map>
 #include <set>
 #include <array>
+#include <string>
+#include <algorithm>
 
 #include <optional>
 #include <filesystem>
@@ -34,3 +37,5 @@ inline void vkCheckResult(VkResult result, const char* errMsg) {
 	if (result != VK_SUCCESS)
 		throw VkException(result, errMsg);
 }
+
+std::vector<char> ReadFile(const std::string& filename);
@@ -0,0 +1,25 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Instanced quads: binding 0 is the quad mesh, bindings 1 and 2 are per-instance
+// streams. Each attribute has its own stream, so the CPU rewrites the offsets
+// every frame without touching the colors.
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+} ubo;
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec4 inOffsetScale;     // xyz offset, w scale; streamed each frame
+layout(location = 3) in vec4 inInstanceColor;   // RGBA8, static
+
+layout(location = 0) out vec3 fragColor;
+
+void main() {
+    vec3 position = inOffsetScale.xyz + vec3(inPosition * inOffsetScale.w, 0.0);
+    gl_Position = ubo.proj * ubo.view * vec4(position, 1.0);
+    fragColor = inColor * inInstanceColor.rgb;
+}
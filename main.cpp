@@ -2,18 +2,40 @@
 
 #include "SVKConfig.h"
 #include "SVKApp.h"
+#include "SVKNBodyCpu.h"
 
 int main(int argc, char** argv) {
-    SVKConfig config(argc, argv);
-    SVKApp app(config);
-
     try {
-        app.Initialize();
-        app.Run();
-        app.Cleanup();
+        SVKConfig config(argc, argv);
+        if (config.m_nbodyCpu) {
+            SVKNBodyCpu::RunBenchmark(config);
+            return EXIT_SUCCESS;
+        }
+
+        SVKApp app(config);
+
+        bool initialized = false;
+        try {
+            app.Initialize();
+            initialized = true;
+            if (config.m_batchOutput.empty())
+                app.Run();
+            else
+                app.RunBatch();
+            app.Cleanup();
+        }
+        catch (const std::exception& e) {
+            // a failed run, e.g. an --nbody-validate mismatch, still releases the device and reports the failure
+            std::cerr << e.what() << std::endl;
+            if (initialized)
+                app.Cleanup();
+            return EXIT_FAILURE;
+        }
     }
     catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
+        SVKConfig::PrintUsage(std::cerr);
+        return EXIT_FAILURE;
     }
 
     return EXIT_SUCCESS;
@@ -0,0 +1,17 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec2 fragCoord;
+layout(location = 1) in vec3 fragColor;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    // round sprite with a soft edge, accumulated with additive blending
+    float distSq = dot(fragCoord, fragCoord);
+    if (distSq > 1.0)
+        discard;
+
+    float falloff = (1.0 - distSq) * (1.0 - distSq);
+    outColor = vec4(fragColor * falloff * 0.25, 1.0);
+}
@@ -0,0 +1,53 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Vertex pulling: no vertex or index buffer, the particle is read from the
+// simulation storage buffer by instance and expanded to a camera facing quad.
+
+struct Particle
+{
+	vec4 pos;
+	vec4 vel;
+};
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+    float interpolationTime;
+} ubo;
+
+layout(std140, binding = 1) readonly buffer Pos 
+{
+   Particle particles[ ];
+};
+
+layout(push_constant) uniform PushConstants {
+    float positionScale;
+    float spriteSize;
+} pc;
+
+layout(location = 0) out vec2 fragCoord;
+layout(location = 1) out vec3 fragColor;
+
+const vec2 corners[6] = vec2[](
+    vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0),
+    vec2(-1.0, -1.0), vec2(1.0, 1.0), vec2(-1.0, 1.0)
+);
+
+void main() {
+    Particle particle = particles[gl_InstanceIndex];
+    vec2 corner = corners[gl_VertexIndex];
+
+    // a step moves the position by deltaT * velocity; going back part of the last step interpolates between the
+    // two most recent simulation states
+    vec3 position = particle.pos.xyz + ubo.interpolationTime * particle.vel.xyz;
+    vec4 viewPosition = ubo.view * vec4(position * pc.positionScale, 1.0);
+    viewPosition.xy += corner * pc.spriteSize;
+    gl_Position = ubo.proj * viewPosition;
+
+    // vel.w is the gradient coordinate advanced by the simulation
+    vec3 hue = clamp(abs(fract(particle.vel.w + vec3(0.0, 2.0 / 3.0, 1.0 / 3.0)) * 6.0 - 3.0) - 1.0, 0.0, 1.0);
+    fragColor = mix(vec3(1.0), hue, 0.75);
+    fragCoord = corner;
+}